@@ -1,10 +1,23 @@
 ifneq ($(TARGET_NEEDS_CAMERA_WRAPPER),false)
 LOCAL_PATH := $(call my-dir)
 
+camera_wrapper_src := \
+    CameraWrapper.cpp \
+    CameraStats.cpp \
+    FixupArena.cpp \
+    PreviewConvert.cpp \
+    CameraOpLog.cpp \
+    PreviewRing.cpp \
+    CameraWatchdog.cpp
+
+# libcamera_client has no host build, the host tools that link the wrapper
+# build its CameraParameters themselves
+camera_parameters_src := \
+    ../../../../frameworks/av/camera/CameraParameters.cpp
+
 include $(CLEAR_VARS)
 
-LOCAL_SRC_FILES := \
-    CameraWrapper.cpp
+LOCAL_SRC_FILES := $(camera_wrapper_src)
 
 LOCAL_C_INCLUDES := \
     system/media/camera/include
@@ -12,10 +25,227 @@ LOCAL_C_INCLUDES := \
 LOCAL_SHARED_LIBRARIES := \
     libhardware liblog libcamera_client libutils libcutils
 
+ifneq ($(TARGET_BUILD_VARIANT),user)
+LOCAL_CFLAGS += -DCAMERA_WRAPPER_TRACE
+endif
+
 LOCAL_MODULE_PATH := $(TARGET_OUT_VENDOR_SHARED_LIBRARIES)/hw
 LOCAL_MODULE := camera.qcom
 
 LOCAL_MODULE_TAGS := optional
 
 include $(BUILD_SHARED_LIBRARY)
+
+# reads and replays the logs written with persist.camera.wrapper.oplog
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    CameraOpLogTool.cpp \
+    CameraStats.cpp
+
+LOCAL_C_INCLUDES := \
+    system/media/camera/include
+
+LOCAL_SHARED_LIBRARIES := \
+    libhardware liblog libutils libcutils
+
+LOCAL_MODULE := camera_oplog
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_EXECUTABLE)
+
+# on linux hosts it replays with the wrapper over the mock vendor HAL
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := CameraOpLogTool.cpp
+
+ifeq ($(HOST_OS),linux)
+LOCAL_SRC_FILES += \
+    CameraMockVendor.cpp \
+    $(camera_wrapper_src) \
+    $(camera_parameters_src)
+
+LOCAL_C_INCLUDES := \
+    system/media/camera/include
+
+LOCAL_CFLAGS := -DCAMERA_MOCK_STATIC
+
+LOCAL_SHARED_LIBRARIES := libbacktrace
+else
+LOCAL_SRC_FILES += CameraStats.cpp
+endif
+
+LOCAL_STATIC_LIBRARIES := \
+    libutils liblog libcutils
+
+LOCAL_LDLIBS := -lpthread
+ifeq ($(HOST_OS),linux)
+LOCAL_LDLIBS += -lrt
+endif
+
+LOCAL_MODULE := camera_oplog
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# reads the preview rings written with persist.camera.wrapper.preview_ring
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := PreviewRingReader.cpp
+LOCAL_EXPORT_C_INCLUDE_DIRS := $(LOCAL_PATH)
+
+LOCAL_MODULE := libcamera_preview_ring
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_STATIC_LIBRARY)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := PreviewRingReader.cpp
+LOCAL_EXPORT_C_INCLUDE_DIRS := $(LOCAL_PATH)
+
+LOCAL_MODULE := libcamera_preview_ring
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_STATIC_LIBRARY)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    PreviewRingTool.cpp \
+    PreviewRing.cpp
+
+LOCAL_STATIC_LIBRARIES := libcamera_preview_ring
+
+LOCAL_SHARED_LIBRARIES := \
+    liblog libutils libcutils
+
+LOCAL_MODULE := camera_preview_ring
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    PreviewRingTool.cpp \
+    PreviewRing.cpp
+
+LOCAL_STATIC_LIBRARIES := \
+    libcamera_preview_ring libutils liblog libcutils
+
+LOCAL_LDLIBS := -lpthread
+ifeq ($(HOST_OS),linux)
+LOCAL_LDLIBS += -lrt
+endif
+
+LOCAL_MODULE := camera_preview_ring
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# checks the vector preview kernels against the _c ones, -b for frames/s
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    PreviewConvertTest.cpp \
+    PreviewConvert.cpp
+
+LOCAL_SHARED_LIBRARIES := libutils
+
+LOCAL_MODULE := camera_preview_convert_test
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_EXECUTABLE)
+
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    PreviewConvertTest.cpp \
+    PreviewConvert.cpp
+
+LOCAL_STATIC_LIBRARIES := libutils
+
+LOCAL_LDLIBS := -lpthread
+ifeq ($(HOST_OS),linux)
+LOCAL_LDLIBS += -lrt
+endif
+
+LOCAL_MODULE := camera_preview_convert_test
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# mock vendor HAL, wrapped with camera.wrapper.vendor=mock on debuggable
+# builds
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := CameraMockVendor.cpp
+
+LOCAL_C_INCLUDES := \
+    system/media/camera/include
+
+LOCAL_SHARED_LIBRARIES := \
+    liblog libcamera_client libutils libcutils
+
+LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
+LOCAL_MODULE := camera.mock
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_SHARED_LIBRARY)
+
+# times every camera_device_ops entry through the wrapper and on the mock
+ifeq ($(HOST_OS),linux)
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    CameraWrapperBench.cpp \
+    CameraMockVendor.cpp \
+    $(camera_wrapper_src) \
+    $(camera_parameters_src)
+
+LOCAL_C_INCLUDES := \
+    system/media/camera/include
+
+LOCAL_CFLAGS := -DCAMERA_MOCK_STATIC
+
+LOCAL_STATIC_LIBRARIES := \
+    libutils liblog libcutils
+
+# for the CallStack of the watchdog
+LOCAL_SHARED_LIBRARIES := libbacktrace
+
+LOCAL_LDLIBS := -lpthread -lrt
+
+LOCAL_MODULE := camera_wrapper_bench
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
+
+# fuzzes the parameter fixups, seeded with the mock's canned parameters
+include $(CLEAR_VARS)
+
+LOCAL_SRC_FILES := \
+    CameraParamsFuzz.cpp \
+    CameraMockVendor.cpp \
+    $(camera_wrapper_src) \
+    $(camera_parameters_src)
+
+LOCAL_C_INCLUDES := \
+    system/media/camera/include
+
+LOCAL_CFLAGS := -DCAMERA_MOCK_STATIC
+
+LOCAL_STATIC_LIBRARIES := \
+    libutils liblog libcutils
+
+LOCAL_SHARED_LIBRARIES := libbacktrace
+
+LOCAL_LDLIBS := -lpthread -lrt
+
+LOCAL_MODULE := camera_params_fuzz
+LOCAL_MODULE_TAGS := optional
+
+include $(BUILD_HOST_EXECUTABLE)
+endif
 endif
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2014, The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file CameraMockParams.h
+*
+* Canned parameter strings for the mock vendor HAL, one per msm8960 Xperia
+* back camera.
+*
+* They are modelled on what the Sony HAL reports: the standard keys, the
+* sony-* keys the wrapper translates and the long value lists it has to
+* walk. They are not dumps of the devices, so update an entry from
+* "dumpsys media.camera" when one becomes available.
+*
+*/
+
+#ifndef CAMERA_MOCK_PARAMS_H
+#define CAMERA_MOCK_PARAMS_H
+
+typedef struct camera_mock_params {
+    const char *device;
+    const char *params;
+} camera_mock_params_t;
+
+#define CAMERA_MOCK_PARAMS_COMMON \
+    "antibanding=auto;antibanding-values=off,50hz,60hz,auto;" \
+    "auto-exposure-lock=false;auto-exposure-lock-supported=true;" \
+    "auto-whitebalance-lock=false;auto-whitebalance-lock-supported=true;" \
+    "effect=none;effect-values=none,mono,negative,solarize,sepia," \
+    "posterize,whiteboard,blackboard,aqua;" \
+    "exposure-compensation=0;exposure-compensation-step=0.333333;" \
+    "max-exposure-compensation=6;min-exposure-compensation=-6;" \
+    "flash-mode=auto;flash-mode-values=off,auto,on,red-eye,torch;" \
+    "focal-length=4.6;focus-areas=(0,0,0,0,0);" \
+    "focus-distances=0.10,1.20,Infinity;" \
+    "focus-mode=continuous-picture;focus-mode-values=auto,infinity,macro," \
+    "continuous-video,continuous-picture,face-detection,touch;" \
+    "horizontal-view-angle=63.2;vertical-view-angle=49.5;" \
+    "jpeg-quality=95;jpeg-thumbnail-height=384;jpeg-thumbnail-quality=90;" \
+    "jpeg-thumbnail-size-values=640x480,512x384,384x288,0x0;" \
+    "jpeg-thumbnail-width=512;max-num-detected-faces-hw=5;" \
+    "max-num-detected-faces-sw=0;max-num-focus-areas=1;" \
+    "max-num-metering-areas=1;metering-areas=(0,0,0,0,0);" \
+    "picture-format=jpeg;picture-format-values=jpeg;" \
+    "preview-format=yuv420sp;preview-format-values=yuv420sp,yuv420p;" \
+    "preview-fps-range=7500,30000;" \
+    "preview-fps-range-values=(7500,30000),(30000,30000);" \
+    "preview-frame-rate=30;preview-frame-rate-values=7,15,30;" \
+    "recording-hint=false;rotation=0;" \
+    "scene-mode=auto;scene-mode-values=auto,action,portrait,landscape," \
+    "night,night-portrait,beach,snow,sports,party,document,fireworks," \
+    "candlelight;" \
+    "smooth-zoom-supported=true;" \
+    "sony-ae-mode=auto;sony-ae-mode-values=auto,iso-prio,shutter-prio," \
+    "manual;" \
+    "sony-iso=auto;sony-iso-values=auto,50,100,200,400,800,1600;" \
+    "sony-max-burst-shot-size=30;sony-scene-detect=off;" \
+    "sony-scene-detect-values=off,on;" \
+    "sony-shutter-speed=auto;sony-shutter-speed-values=auto,1/1000,1/500," \
+    "1/250,1/125,1/60,1/30,1/15,1/8,1/4,1/2,1;" \
+    "sony-video-hdr=off;sony-video-hdr-values=off,on;" \
+    "sony-vs=off;sony-vs-values=off,on,on-intelligent-active;" \
+    "video-frame-format=yuv420sp;video-snapshot-supported=true;" \
+    "video-stabilization=false;video-stabilization-supported=true;" \
+    "whitebalance=auto;whitebalance-values=auto,incandescent,fluorescent," \
+    "daylight,cloudy-daylight;" \
+    "zoom=0;zoom-ratios=100,102,104,107,109,112,114,117,120,123,125,128," \
+    "131,135,138,141,144,148,151,155,158,162,166,170,174,178,182,186,190," \
+    "195,200,204,209,214,219,224,229,235,240,246,251,257,263,270,276,282," \
+    "289,296,303,310,317,324,332,340,348,356,364,373,381,390,400;" \
+    "zoom-supported=true;max-zoom=60"
+
+static const camera_mock_params_t camera_mock_params[] = {
+    { "mint",
+      CAMERA_MOCK_PARAMS_COMMON ";"
+      "picture-size=4128x3096;picture-size-values=4128x3096,4128x2322,"
+      "3264x2448,3264x1836,2048x1536,1920x1080,1280x720,640x480;"
+      "preview-size=1280x720;preview-size-values=1920x1080,1280x720,"
+      "960x720,800x480,720x480,640x480,320x240,176x144;"
+      "video-size=1920x1080;video-size-values=1920x1080,1280x720,"
+      "720x480,640x480,320x240,176x144;"
+      "preferred-preview-size-for-video=1280x720;"
+      "sony-is=off;sony-is-values=off,on,on-still-hdr" },
+    { "hayabusa",
+      CAMERA_MOCK_PARAMS_COMMON ";"
+      "picture-size=4128x3096;picture-size-values=4128x3096,4128x2322,"
+      "3264x2448,3264x1836,2048x1536,1920x1080,1280x720,640x480;"
+      "preview-size=1280x720;preview-size-values=1920x1080,1280x720,"
+      "960x720,800x480,720x480,640x480,320x240,176x144;"
+      "video-size=1920x1080;video-size-values=1920x1080,1280x720,"
+      "720x480,640x480,320x240,176x144;"
+      "preferred-preview-size-for-video=1280x720;"
+      "sony-is=off;sony-is-values=off,on,on-still-hdr" },
+    { "tsubasa",
+      CAMERA_MOCK_PARAMS_COMMON ";"
+      "picture-size=4128x3096;picture-size-values=4128x3096,4128x2322,"
+      "3264x2448,3264x1836,2048x1536,1920x1080,1280x720,640x480;"
+      "preview-size=1280x720;preview-size-values=1920x1080,1280x720,"
+      "960x720,800x480,720x480,640x480,320x240,176x144;"
+      "video-size=1920x1080;video-size-values=1920x1080,1280x720,"
+      "720x480,640x480,320x240,176x144;"
+      "preferred-preview-size-for-video=1280x720;"
+      "sony-is=off;sony-is-values=off,on" },
+    { "huashan",
+      CAMERA_MOCK_PARAMS_COMMON ";"
+      "picture-size=3264x2448;picture-size-values=3264x2448,3264x1836,"
+      "2592x1944,2048x1536,1920x1080,1280x720,640x480;"
+      "preview-size=1280x720;preview-size-values=1920x1080,1280x720,"
+      "960x720,800x480,720x480,640x480,320x240,176x144;"
+      "video-size=1920x1080;video-size-values=1920x1080,1280x720,"
+      "720x480,640x480,320x240,176x144;"
+      "preferred-preview-size-for-video=1280x720;"
+      "sony-is=off;sony-is-values=off,on,on-still-hdr,"
+      "on-intelligent-active" },
+};
+
+#define CAMERA_MOCK_PARAMS_COUNT \
+    (sizeof(camera_mock_params) / sizeof(camera_mock_params[0]))
+
+#endif /* CAMERA_MOCK_PARAMS_H */
@@ -0,0 +1,823 @@
+/*
+ * Copyright (C) 2014, The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file CameraMockVendor.cpp
+*
+* Mock of the Sony camera HAL.
+*
+* It keeps the state the wrapper looks at (enabled messages, preview and
+* recording, the parameter string) and answers like the vendor does:
+* focus and picture callbacks come from a thread of the device after the
+* op returned, frames are delivered on request with camera_mock_send_frame.
+* Nothing is validated, set_parameters takes the string as it is.
+*
+*/
+
+#define LOG_TAG "CameraMock"
+#include <cutils/log.h>
+#include <cutils/atomic.h>
+#include <cutils/properties.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <new>
+
+#include <utils/threads.h>
+#include <utils/String8.h>
+#include <hardware/hardware.h>
+#include <hardware/camera.h>
+#include <camera/CameraParameters.h>
+
+#include "CameraMockParams.h"
+#include "CameraMockVendor.h"
+#include "CameraStats.h"
+
+#define MOCK_NUM_CAMERAS 2
+#define MOCK_MAX_DEVICES 8
+#define MOCK_FRAME_BUFFERS 4
+#define MOCK_MAX_EVENTS 16
+#define MOCK_MAX_PROPERTIES 16
+#define MOCK_PROPERTY_KEY_MAX 64
+
+static const char *mock_op_names[CAMERA_OP_COUNT] = {
+#define CAMERA_OP_NAME(op) #op,
+    CAMERA_OP_LIST(CAMERA_OP_NAME)
+#undef CAMERA_OP_NAME
+};
+
+typedef struct mock_camera_device {
+    camera_device_t base;
+    int id;
+
+    android::Mutex lock;
+    camera_notify_callback notifyCb;
+    camera_data_callback dataCb;
+    camera_data_timestamp_callback dataCbTimestamp;
+    camera_request_memory getMemory;
+    void *user;
+    int32_t msgTypes;
+    bool preview;
+    bool recording;
+    /* a cancel_auto_focus came after the last auto_focus, the sweep's
+     * result is not sent */
+    bool focusCancelled;
+    android::CameraParameters params;
+    camera_memory_t *previewMem;
+    camera_memory_t *videoMem;
+    size_t frameSize;
+    unsigned int frameIndex;
+
+    /* notifications due after the op that caused them returned */
+    android::Condition eventCond;
+    int32_t events[MOCK_MAX_EVENTS];
+    int eventHead;
+    int eventCount;
+    bool eventExit;
+    pthread_t eventThread;
+} mock_camera_device_t;
+
+static android::Mutex gMockLock;
+static mock_camera_device_t *gMockDevices[MOCK_MAX_DEVICES];
+static android::String8 gMockParams;
+static volatile int32_t gMockDelayUs[CAMERA_OP_COUNT];
+static volatile int32_t gMockOpenDelayUs[MOCK_NUM_CAMERAS];
+static volatile int32_t gMockCloseDelayUs[MOCK_NUM_CAMERAS];
+static volatile int32_t gMockFocusUs;
+static pthread_once_t gMockDelaysOnce = PTHREAD_ONCE_INIT;
+
+static pthread_once_t gMockKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t gMockKey;
+
+static void mock_key_create(void)
+{
+    pthread_key_create(&gMockKey, free);
+}
+
+static nsecs_t *mock_thread_ns_slot(void)
+{
+    nsecs_t *slot;
+
+    pthread_once(&gMockKeyOnce, mock_key_create);
+    slot = (nsecs_t *)pthread_getspecific(gMockKey);
+    if (!slot) {
+        slot = (nsecs_t *)calloc(1, sizeof(*slot));
+        if (slot && pthread_setspecific(gMockKey, slot)) {
+            free(slot);
+            slot = NULL;
+        }
+    }
+    return slot;
+}
+
+nsecs_t camera_mock_thread_ns(void)
+{
+    nsecs_t *slot = mock_thread_ns_slot();
+
+    return slot ? *slot : 0;
+}
+
+void camera_mock_set_delay(int op, uint32_t us)
+{
+    if (op >= 0 && op < CAMERA_OP_COUNT)
+        android_atomic_release_store(us, &gMockDelayUs[op]);
+}
+
+void camera_mock_set_open_delay(int camera_id, uint32_t open_us,
+        uint32_t close_us)
+{
+    if (camera_id < 0 || camera_id >= MOCK_NUM_CAMERAS)
+        return;
+    android_atomic_release_store(open_us, &gMockOpenDelayUs[camera_id]);
+    android_atomic_release_store(close_us, &gMockCloseDelayUs[camera_id]);
+}
+
+void camera_mock_set_focus_time(uint32_t us)
+{
+    android_atomic_release_store(us, &gMockFocusUs);
+}
+
+void camera_mock_set_params(const char *params)
+{
+    android::Mutex::Autolock lock(gMockLock);
+    gMockParams.setTo(params ? params : "");
+}
+
+/* camera.mock.delays lists <op>=<us> pairs, e.g.
+ * "take_picture=300000,set_parameters=20000" */
+static void mock_load_delays(void)
+{
+    char value[PROPERTY_VALUE_MAX];
+    char *save, *pair, *eq;
+
+    if (property_get("camera.mock.delays", value, NULL) <= 0)
+        return;
+
+    for (pair = strtok_r(value, ",", &save); pair;
+            pair = strtok_r(NULL, ",", &save)) {
+        eq = strchr(pair, '=');
+        if (!eq)
+            continue;
+        *eq = '\0';
+        for (int op = 0; op < CAMERA_OP_COUNT; op++) {
+            if (strcmp(pair, mock_op_names[op]) == 0)
+                camera_mock_set_delay(op, strtoul(eq + 1, NULL, 0));
+        }
+    }
+}
+
+/* sleeps for the op's delay on entry and charges the whole op to the
+ * calling thread */
+class MockOpScope {
+public:
+    MockOpScope(int op) : mStart(systemTime(SYSTEM_TIME_MONOTONIC)) {
+        int32_t us = android_atomic_acquire_load(&gMockDelayUs[op]);
+
+        if (us > 0)
+            usleep(us);
+    }
+    ~MockOpScope() {
+        nsecs_t *slot = mock_thread_ns_slot();
+
+        if (slot)
+            *slot += systemTime(SYSTEM_TIME_MONOTONIC) - mStart;
+    }
+
+private:
+    nsecs_t mStart;
+};
+
+#define MOCK_OP(op) MockOpScope __mock_op(CAMERA_OP_##op)
+
+#define MOCK_DEV(device) ((mock_camera_device_t *)(device))
+
+/* must be called with dev->lock held */
+static void mock_post_event(mock_camera_device_t *dev, int32_t msg_type)
+{
+    if (dev->eventCount == MOCK_MAX_EVENTS) {
+        ALOGW("%s: camera %d: event queue full, dropping %#x", __FUNCTION__,
+                dev->id, msg_type);
+        return;
+    }
+    dev->events[(dev->eventHead + dev->eventCount++) % MOCK_MAX_EVENTS] =
+            msg_type;
+    dev->eventCond.signal();
+}
+
+static void mock_deliver_event(mock_camera_device_t *dev, int32_t msg_type)
+{
+    camera_notify_callback notifyCb;
+    camera_data_callback dataCb;
+    camera_request_memory getMemory;
+    camera_memory_t *mem;
+    void *user;
+
+    if (msg_type == CAMERA_MSG_FOCUS) {
+        int32_t us = android_atomic_acquire_load(&gMockFocusUs);
+
+        if (us > 0)
+            usleep(us);
+    }
+
+    {
+        android::Mutex::Autolock lock(dev->lock);
+        if (!(dev->msgTypes & msg_type))
+            return;
+        if (msg_type == CAMERA_MSG_FOCUS && dev->focusCancelled)
+            return;
+        notifyCb = dev->notifyCb;
+        dataCb = dev->dataCb;
+        getMemory = dev->getMemory;
+        user = dev->user;
+    }
+
+    /* without the lock, the service may call back into the device */
+    switch (msg_type) {
+    case CAMERA_MSG_FOCUS:
+        if (notifyCb)
+            notifyCb(CAMERA_MSG_FOCUS, 1, 0, user);
+        break;
+    case CAMERA_MSG_SHUTTER:
+        if (notifyCb)
+            notifyCb(CAMERA_MSG_SHUTTER, 0, 0, user);
+        break;
+    case CAMERA_MSG_COMPRESSED_IMAGE:
+        if (!dataCb || !getMemory)
+            break;
+        mem = getMemory(-1, CAMERA_MOCK_PICTURE_SIZE, 1, user);
+        if (!mem)
+            break;
+        memset(mem->data, 0, mem->size);
+        /* SOI and EOI, enough for anything that sniffs the buffer */
+        ((uint8_t *)mem->data)[0] = 0xff;
+        ((uint8_t *)mem->data)[1] = 0xd8;
+        ((uint8_t *)mem->data)[mem->size - 2] = 0xff;
+        ((uint8_t *)mem->data)[mem->size - 1] = 0xd9;
+        dataCb(CAMERA_MSG_COMPRESSED_IMAGE, mem, 0, NULL, user);
+        mem->release(mem);
+        break;
+    }
+}
+
+static void *mock_event_thread(void *arg)
+{
+    mock_camera_device_t *dev = (mock_camera_device_t *)arg;
+    int32_t msg_type;
+
+    for (;;) {
+        {
+            android::Mutex::Autolock lock(dev->lock);
+            while (!dev->eventCount && !dev->eventExit)
+                dev->eventCond.wait(dev->lock);
+            if (dev->eventExit)
+                break;
+            msg_type = dev->events[dev->eventHead];
+            dev->eventHead = (dev->eventHead + 1) % MOCK_MAX_EVENTS;
+            dev->eventCount--;
+        }
+        mock_deliver_event(dev, msg_type);
+    }
+    return NULL;
+}
+
+/* must be called with dev->lock held */
+static camera_memory_t *mock_frames_alloc(mock_camera_device_t *dev)
+{
+    camera_memory_t *mem;
+    int width, height;
+
+    if (!dev->getMemory)
+        return NULL;
+    dev->params.getPreviewSize(&width, &height);
+    if (width <= 0 || height <= 0)
+        return NULL;
+
+    dev->frameSize = (size_t)width * height * 3 / 2;
+    mem = dev->getMemory(-1, dev->frameSize, MOCK_FRAME_BUFFERS, dev->user);
+    if (mem)
+        memset(mem->data, 0x80, mem->size);
+    return mem;
+}
+
+static void mock_frames_release(camera_memory_t **mem)
+{
+    if (*mem) {
+        (*mem)->release(*mem);
+        *mem = NULL;
+    }
+}
+
+int camera_mock_send_frame(int camera_id, int32_t msg_type)
+{
+    android::Mutex::Autolock devicesLock(gMockLock);
+    int sent = 0;
+
+    for (int i = 0; i < MOCK_MAX_DEVICES; i++) {
+        mock_camera_device_t *dev = gMockDevices[i];
+        camera_data_callback dataCb;
+        camera_data_timestamp_callback dataCbTimestamp;
+        camera_memory_t *mem;
+        unsigned int index;
+        void *user;
+
+        if (!dev || dev->id != camera_id)
+            continue;
+        {
+            android::Mutex::Autolock lock(dev->lock);
+            if (!(dev->msgTypes & msg_type))
+                continue;
+            if (msg_type == CAMERA_MSG_VIDEO_FRAME) {
+                if (!dev->recording || !dev->videoMem)
+                    continue;
+                mem = dev->videoMem;
+            } else {
+                if (!dev->preview || !dev->previewMem)
+                    continue;
+                mem = dev->previewMem;
+            }
+            dataCb = dev->dataCb;
+            dataCbTimestamp = dev->dataCbTimestamp;
+            user = dev->user;
+            index = dev->frameIndex++ % MOCK_FRAME_BUFFERS;
+        }
+
+        /* gMockLock keeps the device and its buffers from going away */
+        if (msg_type == CAMERA_MSG_VIDEO_FRAME && dataCbTimestamp)
+            dataCbTimestamp(systemTime(SYSTEM_TIME_MONOTONIC),
+                    CAMERA_MSG_VIDEO_FRAME, mem, index, user);
+        else if (msg_type != CAMERA_MSG_VIDEO_FRAME && dataCb)
+            dataCb(msg_type, mem, index, NULL, user);
+        sent++;
+    }
+    return sent;
+}
+
+static int mock_set_preview_window(struct camera_device *device,
+        struct preview_stream_ops *window)
+{
+    MOCK_OP(set_preview_window);
+    (void)device;
+    (void)window;
+    return 0;
+}
+
+static void mock_set_callbacks(struct camera_device *device,
+        camera_notify_callback notify_cb,
+        camera_data_callback data_cb,
+        camera_data_timestamp_callback data_cb_timestamp,
+        camera_request_memory get_memory,
+        void *user)
+{
+    MOCK_OP(set_callbacks);
+    mock_camera_device_t *dev = MOCK_DEV(device);
+
+    android::Mutex::Autolock lock(dev->lock);
+    dev->notifyCb = notify_cb;
+    dev->dataCb = data_cb;
+    dev->dataCbTimestamp = data_cb_timestamp;
+    dev->getMemory = get_memory;
+    dev->user = user;
+}
+
+static void mock_enable_msg_type(struct camera_device *device,
+        int32_t msg_type)
+{
+    MOCK_OP(enable_msg_type);
+    mock_camera_device_t *dev = MOCK_DEV(device);
+
+    android::Mutex::Autolock lock(dev->lock);
+    dev->msgTypes |= msg_type;
+}
+
+static void mock_disable_msg_type(struct camera_device *device,
+        int32_t msg_type)
+{
+    MOCK_OP(disable_msg_type);
+    mock_camera_device_t *dev = MOCK_DEV(device);
+
+    android::Mutex::Autolock lock(dev->lock);
+    dev->msgTypes &= ~msg_type;
+}
+
+static int mock_msg_type_enabled(struct camera_device *device,
+        int32_t msg_type)
+{
+    MOCK_OP(msg_type_enabled);
+    mock_camera_device_t *dev = MOCK_DEV(device);
+
+    android::Mutex::Autolock lock(dev->lock);
+    return (dev->msgTypes & msg_type) == msg_type;
+}
+
+static int mock_start_preview(struct camera_device *device)
+{
+    MOCK_OP(start_preview);
+    mock_camera_device_t *dev = MOCK_DEV(device);
+
+    android::Mutex::Autolock lock(dev->lock);
+    if (!dev->previewMem)
+        dev->previewMem = mock_frames_alloc(dev);
+    dev->preview = true;
+    return 0;
+}
+
+static void mock_stop_preview(struct camera_device *device)
+{
+    MOCK_OP(stop_preview);
+    mock_camera_device_t *dev = MOCK_DEV(device);
+
+    /* frames are only sent under gMockLock */
+    android::Mutex::Autolock devicesLock(gMockLock);
+    android::Mutex::Autolock lock(dev->lock);
+    dev->preview = false;
+    mock_frames_release(&dev->previewMem);
+}
+
+static int mock_preview_enabled(struct camera_device *device)
+{
+    MOCK_OP(preview_enabled);
+    mock_camera_device_t *dev = MOCK_DEV(device);
+
+    android::Mutex::Autolock lock(dev->lock);
+    return dev->preview;
+}
+
+static int mock_store_meta_data_in_buffers(struct camera_device *device,
+        int enable)
+{
+    MOCK_OP(store_meta_data_in_buffers);
+    (void)device;
+    (void)enable;
+    return 0;
+}
+
+static int mock_start_recording(struct camera_device *device)
+{
+    MOCK_OP(start_recording);
+    mock_camera_device_t *dev = MOCK_DEV(device);
+
+    android::Mutex::Autolock lock(dev->lock);
+    if (!dev->videoMem)
+        dev->videoMem = mock_frames_alloc(dev);
+    dev->recording = true;
+    return 0;
+}
+
+static void mock_stop_recording(struct camera_device *device)
+{
+    MOCK_OP(stop_recording);
+    mock_camera_device_t *dev = MOCK_DEV(device);
+
+    android::Mutex::Autolock devicesLock(gMockLock);
+    android::Mutex::Autolock lock(dev->lock);
+    dev->recording = false;
+    mock_frames_release(&dev->videoMem);
+}
+
+static int mock_recording_enabled(struct camera_device *device)
+{
+    MOCK_OP(recording_enabled);
+    mock_camera_device_t *dev = MOCK_DEV(device);
+
+    android::Mutex::Autolock lock(dev->lock);
+    return dev->recording;
+}
+
+static void mock_release_recording_frame(struct camera_device *device,
+        const void *opaque)
+{
+    MOCK_OP(release_recording_frame);
+    (void)device;
+    (void)opaque;
+}
+
+static int mock_auto_focus(struct camera_device *device)
+{
+    MOCK_OP(auto_focus);
+    mock_camera_device_t *dev = MOCK_DEV(device);
+
+    android::Mutex::Autolock lock(dev->lock);
+    dev->focusCancelled = false;
+    mock_post_event(dev, CAMERA_MSG_FOCUS);
+    return 0;
+}
+
+static int mock_cancel_auto_focus(struct camera_device *device)
+{
+    MOCK_OP(cancel_auto_focus);
+    mock_camera_device_t *dev = MOCK_DEV(device);
+
+    android::Mutex::Autolock lock(dev->lock);
+    dev->focusCancelled = true;
+    return 0;
+}
+
+static int mock_take_picture(struct camera_device *device)
+{
+    MOCK_OP(take_picture);
+    mock_camera_device_t *dev = MOCK_DEV(device);
+
+    android::Mutex::Autolock lock(dev->lock);
+    mock_post_event(dev, CAMERA_MSG_SHUTTER);
+    mock_post_event(dev, CAMERA_MSG_COMPRESSED_IMAGE);
+    return 0;
+}
+
+static int mock_cancel_picture(struct camera_device *device)
+{
+    MOCK_OP(cancel_picture);
+    (void)device;
+    return 0;
+}
+
+static int mock_set_parameters(struct camera_device *device,
+        const char *params)
+{
+    MOCK_OP(set_parameters);
+    mock_camera_device_t *dev = MOCK_DEV(device);
+
+    android::Mutex::Autolock lock(dev->lock);
+    dev->params.unflatten(android::String8(params));
+    return 0;
+}
+
+static char *mock_get_parameters(struct camera_device *device)
+{
+    MOCK_OP(get_parameters);
+    mock_camera_device_t *dev = MOCK_DEV(device);
+
+    android::Mutex::Autolock lock(dev->lock);
+    return strdup(dev->params.flatten().string());
+}
+
+static void mock_put_parameters(struct camera_device *device, char *params)
+{
+    MOCK_OP(put_parameters);
+    (void)device;
+    free(params);
+}
+
+static int mock_send_command(struct camera_device *device, int32_t cmd,
+        int32_t arg1, int32_t arg2)
+{
+    MOCK_OP(send_command);
+    (void)device;
+    (void)cmd;
+    (void)arg1;
+    (void)arg2;
+    return 0;
+}
+
+static void mock_release(struct camera_device *device)
+{
+    MOCK_OP(release);
+    mock_camera_device_t *dev = MOCK_DEV(device);
+
+    android::Mutex::Autolock devicesLock(gMockLock);
+    android::Mutex::Autolock lock(dev->lock);
+    dev->preview = false;
+    dev->recording = false;
+    mock_frames_release(&dev->previewMem);
+    mock_frames_release(&dev->videoMem);
+}
+
+static int mock_dump(struct camera_device *device, int fd)
+{
+    MOCK_OP(dump);
+    (void)device;
+    (void)fd;
+    return 0;
+}
+
+static camera_device_ops_t mock_ops = {
+    .set_preview_window = mock_set_preview_window,
+    .set_callbacks = mock_set_callbacks,
+    .enable_msg_type = mock_enable_msg_type,
+    .disable_msg_type = mock_disable_msg_type,
+    .msg_type_enabled = mock_msg_type_enabled,
+    .start_preview = mock_start_preview,
+    .stop_preview = mock_stop_preview,
+    .preview_enabled = mock_preview_enabled,
+    .store_meta_data_in_buffers = mock_store_meta_data_in_buffers,
+    .start_recording = mock_start_recording,
+    .stop_recording = mock_stop_recording,
+    .recording_enabled = mock_recording_enabled,
+    .release_recording_frame = mock_release_recording_frame,
+    .auto_focus = mock_auto_focus,
+    .cancel_auto_focus = mock_cancel_auto_focus,
+    .take_picture = mock_take_picture,
+    .cancel_picture = mock_cancel_picture,
+    .set_parameters = mock_set_parameters,
+    .get_parameters = mock_get_parameters,
+    .put_parameters = mock_put_parameters,
+    .send_command = mock_send_command,
+    .release = mock_release,
+    .dump = mock_dump,
+};
+
+static int mock_device_close(hw_device_t *device)
+{
+    mock_camera_device_t *dev = (mock_camera_device_t *)device;
+    int32_t us = android_atomic_acquire_load(&gMockCloseDelayUs[dev->id]);
+
+    if (us > 0)
+        usleep(us);
+
+    {
+        android::Mutex::Autolock lock(gMockLock);
+        for (int i = 0; i < MOCK_MAX_DEVICES; i++) {
+            if (gMockDevices[i] == dev)
+                gMockDevices[i] = NULL;
+        }
+    }
+
+    {
+        android::Mutex::Autolock lock(dev->lock);
+        dev->eventExit = true;
+        dev->eventCond.signal();
+    }
+    pthread_join(dev->eventThread, NULL);
+
+    mock_frames_release(&dev->previewMem);
+    mock_frames_release(&dev->videoMem);
+    delete dev;
+    return 0;
+}
+
+static int mock_device_open(const hw_module_t *module, const char *name,
+        hw_device_t **device)
+{
+    mock_camera_device_t *dev;
+    int id = atoi(name);
+    int32_t us;
+    int slot;
+
+    *device = NULL;
+    if (id < 0 || id >= MOCK_NUM_CAMERAS)
+        return -EINVAL;
+
+    pthread_once(&gMockDelaysOnce, mock_load_delays);
+    us = android_atomic_acquire_load(&gMockOpenDelayUs[id]);
+    if (us > 0)
+        usleep(us);
+
+    android::Mutex::Autolock lock(gMockLock);
+    for (slot = 0; slot < MOCK_MAX_DEVICES && gMockDevices[slot]; slot++)
+        ;
+    if (slot == MOCK_MAX_DEVICES)
+        return -EUSERS;
+
+    dev = new (std::nothrow) mock_camera_device_t();
+    if (!dev)
+        return -ENOMEM;
+
+    dev->id = id;
+    dev->base.common.tag = HARDWARE_DEVICE_TAG;
+    dev->base.common.version = 0;
+    dev->base.common.module = (hw_module_t *)module;
+    dev->base.common.close = mock_device_close;
+    dev->base.ops = &mock_ops;
+    dev->base.priv = dev;
+    dev->params.unflatten(gMockParams.size() ? gMockParams :
+            android::String8(camera_mock_params[0].params));
+
+    if (pthread_create(&dev->eventThread, NULL, mock_event_thread, dev)) {
+        delete dev;
+        return -ENOMEM;
+    }
+
+    gMockDevices[slot] = dev;
+    *device = &dev->base.common;
+    return 0;
+}
+
+static int mock_get_number_of_cameras(void)
+{
+    return MOCK_NUM_CAMERAS;
+}
+
+static int mock_get_camera_info(int camera_id, struct camera_info *info)
+{
+    if (camera_id < 0 || camera_id >= MOCK_NUM_CAMERAS)
+        return -EINVAL;
+
+    memset(info, 0, sizeof(*info));
+    info->facing = camera_id ? CAMERA_FACING_FRONT : CAMERA_FACING_BACK;
+    info->orientation = camera_id ? 270 : 90;
+    info->device_version = CAMERA_DEVICE_API_VERSION_1_0;
+    return 0;
+}
+
+static struct hw_module_methods_t mock_module_methods = {
+    .open = mock_device_open
+};
+
+#ifdef CAMERA_MOCK_STATIC
+camera_module_t camera_mock_module = {
+#else
+camera_module_t HAL_MODULE_INFO_SYM = {
+#endif
+    .common = {
+         .tag = HARDWARE_MODULE_TAG,
+         .module_api_version = CAMERA_MODULE_API_VERSION_1_0,
+         .hal_api_version = HARDWARE_HAL_API_VERSION,
+         .id = CAMERA_HARDWARE_MODULE_ID,
+         .name = "Xperia Camera Mock",
+         .author = "The CyanogenMod Project",
+         .methods = &mock_module_methods,
+         .dso = NULL, /* remove compilation warnings */
+         .reserved = {0}, /* remove compilation warnings */
+    },
+    .get_number_of_cameras = mock_get_number_of_cameras,
+    .get_camera_info = mock_get_camera_info,
+    .set_callbacks = NULL, /* remove compilation warnings */
+    .get_vendor_tag_ops = NULL, /* remove compilation warnings */
+    .open_legacy = NULL, /* remove compilation warnings */
+    .reserved = {0}, /* remove compilation warnings */
+};
+
+#ifdef CAMERA_MOCK_STATIC
+typedef struct mock_property {
+    char key[MOCK_PROPERTY_KEY_MAX];
+    char value[PROPERTY_VALUE_MAX];
+} mock_property_t;
+
+static android::Mutex gMockPropertyLock;
+static mock_property_t gMockProperties[MOCK_MAX_PROPERTIES];
+static int gMockPropertyCount;
+
+int camera_mock_set_property(const char *key, const char *value)
+{
+    android::Mutex::Autolock lock(gMockPropertyLock);
+    int i;
+
+    if (strlen(key) >= MOCK_PROPERTY_KEY_MAX ||
+            (value && strlen(value) >= PROPERTY_VALUE_MAX))
+        return -EINVAL;
+
+    for (i = 0; i < gMockPropertyCount; i++) {
+        if (strcmp(gMockProperties[i].key, key) == 0)
+            break;
+    }
+    if (!value) {
+        if (i < gMockPropertyCount)
+            gMockProperties[i] = gMockProperties[--gMockPropertyCount];
+        return 0;
+    }
+    if (i == gMockPropertyCount) {
+        if (gMockPropertyCount == MOCK_MAX_PROPERTIES)
+            return -ENOSPC;
+        strcpy(gMockProperties[gMockPropertyCount++].key, key);
+    }
+    strcpy(gMockProperties[i].value, value);
+    return 0;
+}
+
+int camera_mock_property_get(const char *key, char *value,
+        const char *default_value)
+{
+    android::Mutex::Autolock lock(gMockPropertyLock);
+
+    for (int i = 0; i < gMockPropertyCount; i++) {
+        if (strcmp(gMockProperties[i].key, key) == 0) {
+            strcpy(value, gMockProperties[i].value);
+            return strlen(value);
+        }
+    }
+    return property_get(key, value, default_value);
+}
+
+/* the wrapper, linked into the same tool */
+extern camera_module_t HAL_MODULE_INFO_SYM;
+
+extern "C" int hw_get_module_by_class(const char *class_id,
+        const char *inst, const struct hw_module_t **module)
+{
+    if (strcmp(class_id, CAMERA_HARDWARE_MODULE_ID) != 0)
+        return -ENOENT;
+    *module = inst ? &camera_mock_module.common : &HAL_MODULE_INFO_SYM.common;
+    return 0;
+}
+
+extern "C" int hw_get_module(const char *id, const struct hw_module_t **module)
+{
+    return hw_get_module_by_class(id, NULL, module);
+}
+#endif
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2014, The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file CameraMockVendor.h
+*
+* Mock of the Sony camera HAL for measuring and exercising the wrapper
+* without a camera.
+*
+* On the device it is the camera.mock module, wrapped in place of the
+* vendor module with camera.wrapper.vendor=mock on debuggable builds. Ops
+* sleep for the microseconds camera.mock.delays gives them, a list such as
+* "take_picture=300000,set_parameters=20000".
+*
+* Built with CAMERA_MOCK_STATIC it is linked into host tools together with
+* the wrapper instead, and also stands in for hw_get_module() and
+* hw_get_module_by_class(): the camera module is the wrapper and any named
+* instance of it is the mock.
+*
+*/
+
+#ifndef CAMERA_MOCK_VENDOR_H
+#define CAMERA_MOCK_VENDOR_H
+
+#include <stdint.h>
+#include <hardware/camera.h>
+#include <utils/Timers.h>
+
+/* jpeg handed to the service for each picture taken */
+#define CAMERA_MOCK_PICTURE_SIZE (64 * 1024)
+
+/* sets how long an op (a CAMERA_OP_LIST id) takes on every mock device */
+void camera_mock_set_delay(int op, uint32_t us);
+/* sets how long opening and closing a camera take, slept outside of the
+ * mock's locks like a vendor open talking to the sensor */
+void camera_mock_set_open_delay(int camera_id, uint32_t open_us,
+        uint32_t close_us);
+/* sets how long a focus sweep runs before CAMERA_MSG_FOCUS is sent */
+void camera_mock_set_focus_time(uint32_t us);
+/* parameter string new mock devices start with, NULL for the default one
+ * of camera_mock_params[0] */
+void camera_mock_set_params(const char *params);
+/* time the calling thread has spent in mock ops, delays included */
+nsecs_t camera_mock_thread_ns(void);
+/* has the open mock devices of a camera deliver a CAMERA_MSG_PREVIEW_FRAME
+ * or CAMERA_MSG_VIDEO_FRAME from the calling thread, as the vendor's
+ * callback thread would; the number of devices that delivered it */
+int camera_mock_send_frame(int camera_id, int32_t msg_type);
+
+#ifdef CAMERA_MOCK_STATIC
+extern camera_module_t camera_mock_module;
+
+/* host tools have no property service: properties set here are seen by
+ * the wrapper and the mock, NULL value unsets one */
+int camera_mock_set_property(const char *key, const char *value);
+int camera_mock_property_get(const char *key, char *value,
+        const char *default_value);
+#endif
+
+#endif /* CAMERA_MOCK_VENDOR_H */
@@ -0,0 +1,252 @@
+/*
+ * Copyright (C) 2014, The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file CameraOpLog.cpp
+*
+* Binary log of the camera_device_ops calls made by the camera service.
+*
+* Records are gathered in a buffer and written out when it fills up or the
+* log is closed, so ops only pay for a memcpy. Once max_bytes have been
+* written further records are counted as dropped.
+*
+*/
+
+#define LOG_TAG "CameraWrapper"
+#include <cutils/log.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <new>
+
+#include <utils/threads.h>
+
+#include "CameraOpLog.h"
+
+#define OPLOG_BUFFER_SIZE (32 * 1024)
+
+struct camera_oplog {
+    android::Mutex lock;
+    int fd;
+    nsecs_t base;
+    char buf[OPLOG_BUFFER_SIZE];
+    size_t used;
+    size_t written;
+    size_t maxBytes;
+    int32_t records;
+    int32_t dropped;
+    int32_t errors;
+};
+
+static pthread_once_t gVendorKeyOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t gVendorKey;
+
+static void oplog_vendor_key_create(void)
+{
+    pthread_key_create(&gVendorKey, free);
+}
+
+nsecs_t *camera_oplog_vendor_ns(void)
+{
+    nsecs_t *slot;
+
+    pthread_once(&gVendorKeyOnce, oplog_vendor_key_create);
+    slot = (nsecs_t *)pthread_getspecific(gVendorKey);
+    if (!slot) {
+        slot = (nsecs_t *)calloc(1, sizeof(*slot));
+        if (slot && pthread_setspecific(gVendorKey, slot)) {
+            free(slot);
+            slot = NULL;
+        }
+    }
+    return slot;
+}
+
+static int oplog_write_all(int fd, struct iovec *iov, int count)
+{
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 0;
+}
+
+/* must be called with log->lock held */
+static void oplog_flush_locked(camera_oplog_t *log, const void *extra,
+        size_t extraLen)
+{
+    struct iovec iov[2];
+    int count = 0;
+
+    if (log->used) {
+        iov[count].iov_base = log->buf;
+        iov[count].iov_len = log->used;
+        count++;
+    }
+    if (extraLen) {
+        iov[count].iov_base = (void *)extra;
+        iov[count].iov_len = extraLen;
+        count++;
+    }
+    if (oplog_write_all(log->fd, iov, count))
+        log->errors++;
+    log->written += log->used + extraLen;
+    log->used = 0;
+}
+
+camera_oplog_t *camera_oplog_open(const char *path, int camera_id,
+        size_t max_bytes)
+{
+    camera_oplog_header_t header;
+    camera_oplog_t *log;
+    struct iovec iov;
+
+    log = new (std::nothrow) camera_oplog_t();
+    if (!log)
+        return NULL;
+
+    log->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (log->fd < 0) {
+        ALOGE("%s: cannot create %s: %s", __FUNCTION__, path,
+                strerror(errno));
+        delete log;
+        return NULL;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = CAMERA_OPLOG_MAGIC;
+    header.version = CAMERA_OPLOG_VERSION;
+    header.op_count = CAMERA_OP_COUNT;
+    header.camera_id = camera_id;
+    header.record_size = sizeof(camera_oplog_record_t);
+    header.start_ns = systemTime(SYSTEM_TIME_REALTIME);
+
+    iov.iov_base = &header;
+    iov.iov_len = sizeof(header);
+    if (oplog_write_all(log->fd, &iov, 1)) {
+        ALOGE("%s: cannot write %s: %s", __FUNCTION__, path,
+                strerror(errno));
+        close(log->fd);
+        delete log;
+        return NULL;
+    }
+
+    log->base = systemTime(SYSTEM_TIME_MONOTONIC);
+    log->written = sizeof(header);
+    log->maxBytes = max_bytes;
+    ALOGI("%s: logging camera %d ops to %s", __FUNCTION__, camera_id, path);
+    return log;
+}
+
+void camera_oplog_close(camera_oplog_t *log)
+{
+    if (!log)
+        return;
+
+    {
+        android::Mutex::Autolock lock(log->lock);
+        oplog_flush_locked(log, NULL, 0);
+    }
+    if (log->dropped)
+        ALOGW("%s: %d records dropped past %zu bytes", __FUNCTION__,
+                log->dropped, log->maxBytes);
+    close(log->fd);
+    delete log;
+}
+
+static uint32_t oplog_saturate(nsecs_t ns)
+{
+    if (ns < 0)
+        return 0;
+    if (ns > (nsecs_t)UINT32_MAX)
+        return UINT32_MAX;
+    return (uint32_t)ns;
+}
+
+void camera_oplog_write(camera_oplog_t *log, int op, nsecs_t start,
+        nsecs_t total, nsecs_t vendor, const int32_t args[3],
+        const char *payload)
+{
+    camera_oplog_record_t record;
+    size_t payloadLen = payload ? strlen(payload) : 0;
+    size_t size = sizeof(record) + payloadLen;
+
+    if (!log)
+        return;
+
+    memset(&record, 0, sizeof(record));
+    record.op = op;
+    record.payload = payloadLen;
+    record.start_ns = start - log->base;
+    record.total_ns = oplog_saturate(total);
+    record.vendor_ns = oplog_saturate(vendor);
+    memcpy(record.args, args, sizeof(record.args));
+    record.tid = camera_thread_tid();
+
+    android::Mutex::Autolock lock(log->lock);
+
+    if (log->written + log->used + size > log->maxBytes) {
+        log->dropped++;
+        return;
+    }
+
+    if (log->used + sizeof(record) > sizeof(log->buf))
+        oplog_flush_locked(log, NULL, 0);
+    memcpy(log->buf + log->used, &record, sizeof(record));
+    log->used += sizeof(record);
+
+    if (log->used + payloadLen > sizeof(log->buf)) {
+        /* parameter strings larger than the buffer go out directly */
+        oplog_flush_locked(log, payload, payloadLen);
+    } else if (payloadLen) {
+        memcpy(log->buf + log->used, payload, payloadLen);
+        log->used += payloadLen;
+    }
+    log->records++;
+}
+
+void camera_oplog_dump(camera_oplog_t *log, android::String8 &out)
+{
+    if (!log)
+        return;
+
+    android::Mutex::Autolock lock(log->lock);
+
+    /* make the file current for whoever pulls it after a dump */
+    oplog_flush_locked(log, NULL, 0);
+    out.appendFormat("   Op log: records=%d bytes=%zu dropped=%d "
+            "write errors=%d\n", log->records, log->written, log->dropped,
+            log->errors);
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (C) 2014, The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file CameraOpLog.h
+*
+* Binary log of the camera_device_ops calls made by the camera service,
+* written by the camera wrapper and read back by the camera_oplog tool.
+*
+* A log is a camera_oplog_header_t followed by camera_oplog_record_t
+* entries, each followed by payload bytes (the parameter string passed to
+* set_parameters, without its terminator). Everything is in the byte order
+* of the device that wrote it.
+*
+*/
+
+#ifndef CAMERA_OPLOG_H
+#define CAMERA_OPLOG_H
+
+#include <stdint.h>
+#include <utils/Timers.h>
+
+#include "CameraStats.h"
+
+#define CAMERA_OPLOG_MAGIC 0x4c4f5743 /* "CWOL" */
+#define CAMERA_OPLOG_VERSION 1
+
+typedef struct camera_oplog_header {
+    uint32_t magic;
+    uint16_t version;
+    /* CAMERA_OP_COUNT of the writer, op ids index CAMERA_OP_LIST */
+    uint16_t op_count;
+    int32_t camera_id;
+    uint32_t record_size;
+    /* CLOCK_REALTIME when the log was opened */
+    int64_t start_ns;
+} camera_oplog_header_t;
+
+typedef struct camera_oplog_record {
+    uint16_t op;
+    uint16_t reserved;
+    uint32_t payload;
+    /* CLOCK_MONOTONIC since the log was opened */
+    int64_t start_ns;
+    /* time spent in the op and, within it, in the vendor HAL; both
+     * saturate at UINT32_MAX */
+    uint32_t total_ns;
+    uint32_t vendor_ns;
+    int32_t args[3];
+    int32_t tid;
+} camera_oplog_record_t;
+
+typedef struct camera_oplog camera_oplog_t;
+
+/* creates path and writes the header, NULL on failure */
+camera_oplog_t *camera_oplog_open(const char *path, int camera_id,
+        size_t max_bytes);
+void camera_oplog_close(camera_oplog_t *log);
+void camera_oplog_write(camera_oplog_t *log, int op, nsecs_t start,
+        nsecs_t total, nsecs_t vendor, const int32_t args[3],
+        const char *payload);
+void camera_oplog_dump(camera_oplog_t *log, android::String8 &out);
+
+/* per-thread sum of the vendor time, added to by VENDOR_CALL while a log
+ * is open; NULL when it cannot be allocated */
+nsecs_t *camera_oplog_vendor_ns(void);
+
+/* logs the enclosing op when it goes out of scope */
+class CameraOpLogScope {
+public:
+    CameraOpLogScope(camera_oplog_t *log, int op, int32_t arg0 = 0,
+            int32_t arg1 = 0, int32_t arg2 = 0, const char *payload = NULL)
+        : mLog(log), mOp(op), mPayload(payload), mVendor(NULL),
+          mSaved(0), mStart(0) {
+        if (!mLog)
+            return;
+        mArgs[0] = arg0;
+        mArgs[1] = arg1;
+        mArgs[2] = arg2;
+        mVendor = camera_oplog_vendor_ns();
+        if (mVendor) {
+            mSaved = *mVendor;
+            *mVendor = 0;
+        }
+        mStart = systemTime(SYSTEM_TIME_MONOTONIC);
+    }
+    ~CameraOpLogScope() {
+        nsecs_t vendor = 0;
+
+        if (!mLog)
+            return;
+        if (mVendor) {
+            vendor = *mVendor;
+            *mVendor = mSaved + vendor;
+        }
+        camera_oplog_write(mLog, mOp, mStart,
+                systemTime(SYSTEM_TIME_MONOTONIC) - mStart, vendor, mArgs,
+                mPayload);
+    }
+
+private:
+    camera_oplog_t *mLog;
+    int mOp;
+    int32_t mArgs[3];
+    const char *mPayload;
+    nsecs_t *mVendor;
+    nsecs_t mSaved;
+    nsecs_t mStart;
+};
+
+#endif /* CAMERA_OPLOG_H */
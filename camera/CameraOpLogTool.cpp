@@ -0,0 +1,591 @@
+/*
+ * Copyright (C) 2014, The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file CameraOpLogTool.cpp
+*
+* Reads the op logs written by the camera wrapper.
+*
+* "dump" summarises a log per op: the latency seen by the service, the part
+* of it spent in the vendor HAL and what the wrapper added on top. It is
+* built for the host too, so logs can be pulled and compared off device.
+*
+* "replay" opens the camera through the camera module, which is the
+* wrapper, and issues the logged ops again with the recorded arguments and
+* parameter strings. On the device the latency it reports includes the
+* vendor HAL's: set persist.camera.wrapper.oplog while replaying and dump
+* the new log to see the wrapper's part, and point camera.wrapper.vendor at
+* the mock module on debuggable builds to take the real HAL out of it.
+*
+* On the host the wrapper is linked with the mock vendor HAL
+* (CAMERA_MOCK_STATIC), and replay reports the vendor's share of every op
+* and what the wrapper added to it, as dump does. Recording frames the log
+* releases are delivered by the mock first.
+*
+*/
+
+#define LOG_TAG "CameraOpLog"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <utils/String8.h>
+
+#include "CameraOpLog.h"
+#include "CameraStats.h"
+
+#if defined(__ANDROID__) || defined(CAMERA_MOCK_STATIC)
+#define OPLOG_REPLAY
+#include <sys/mman.h>
+#include <cutils/atomic.h>
+#include <hardware/hardware.h>
+#include <hardware/camera.h>
+#include <utils/threads.h>
+#endif
+
+#ifdef CAMERA_MOCK_STATIC
+#include "CameraMockVendor.h"
+#endif
+
+static const char *op_names[CAMERA_OP_COUNT] = {
+#define CAMERA_OP_NAME(op) #op,
+    CAMERA_OP_LIST(CAMERA_OP_NAME)
+#undef CAMERA_OP_NAME
+};
+
+typedef struct oplog_file {
+    char *data;
+    size_t size;
+    const camera_oplog_header_t *header;
+} oplog_file_t;
+
+static int oplog_file_load(const char *path, oplog_file_t *file)
+{
+    struct stat st;
+    size_t done = 0;
+    int fd;
+
+    memset(file, 0, sizeof(*file));
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &st)) {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    file->size = st.st_size;
+    file->data = (char *)malloc(file->size ? file->size : 1);
+    while (file->data && done < file->size) {
+        ssize_t n = read(fd, file->data + done, file->size - done);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            break;
+        }
+        done += n;
+    }
+    close(fd);
+
+    if (!file->data || done != file->size) {
+        fprintf(stderr, "%s: short read\n", path);
+        free(file->data);
+        return -1;
+    }
+
+    file->header = (const camera_oplog_header_t *)file->data;
+    if (file->size < sizeof(*file->header) ||
+            file->header->magic != CAMERA_OPLOG_MAGIC ||
+            file->header->version != CAMERA_OPLOG_VERSION ||
+            file->header->record_size != sizeof(camera_oplog_record_t)) {
+        fprintf(stderr, "%s: not a version %d camera op log\n", path,
+                CAMERA_OPLOG_VERSION);
+        free(file->data);
+        return -1;
+    }
+    if (file->header->op_count != CAMERA_OP_COUNT)
+        fprintf(stderr, "%s: written with %d ops, this tool knows %d\n",
+                path, file->header->op_count, CAMERA_OP_COUNT);
+    return 0;
+}
+
+/* walks the records, false at the end or on a truncated one; records
+ * are copied out as payloads leave them unaligned */
+static bool oplog_file_next(const oplog_file_t *file, size_t *offset,
+        camera_oplog_record_t *record, const char **payload)
+{
+    if (*offset == 0)
+        *offset = sizeof(camera_oplog_header_t);
+    if (file->size - *offset < sizeof(*record))
+        return false;
+
+    memcpy(record, file->data + *offset, sizeof(*record));
+    if (file->size - *offset - sizeof(*record) < record->payload)
+        return false;
+
+    *payload = file->data + *offset + sizeof(*record);
+    *offset += sizeof(*record) + record->payload;
+    return true;
+}
+
+static const char *op_name(int op)
+{
+    return op < CAMERA_OP_COUNT ? op_names[op] : "unknown";
+}
+
+static void print_histograms(const char *title, const camera_histogram_t *hist)
+{
+    android::String8 out;
+
+    out.appendFormat("   %s:\n", title);
+    for (int i = 0; i < CAMERA_OP_COUNT; i++)
+        camera_histogram_dump(&hist[i], op_names[i], out);
+    fwrite(out.string(), 1, out.size(), stdout);
+}
+
+static int oplog_dump(const char *path, bool verbose)
+{
+    camera_histogram_t total[CAMERA_OP_COUNT];
+    camera_histogram_t vendor[CAMERA_OP_COUNT];
+    camera_histogram_t wrapper[CAMERA_OP_COUNT];
+    camera_oplog_record_t record;
+    const char *payload;
+    oplog_file_t file;
+    size_t offset = 0;
+    int records = 0;
+
+    if (oplog_file_load(path, &file))
+        return 1;
+
+    memset(total, 0, sizeof(total));
+    memset(vendor, 0, sizeof(vendor));
+    memset(wrapper, 0, sizeof(wrapper));
+
+    while (oplog_file_next(&file, &offset, &record, &payload)) {
+        records++;
+        if (verbose) {
+            printf("%10.3fms %5d %-26s total=%uus vendor=%uus "
+                    "args=%d,%d,%d\n",
+                    record.start_ns / 1000000.0, record.tid,
+                    op_name(record.op), record.total_ns / 1000,
+                    record.vendor_ns / 1000, record.args[0],
+                    record.args[1], record.args[2]);
+            if (record.payload)
+                printf("%13s%.*s\n", "", (int)record.payload, payload);
+        }
+        if (record.op >= CAMERA_OP_COUNT)
+            continue;
+        camera_histogram_record(&total[record.op], record.total_ns);
+        camera_histogram_record(&vendor[record.op], record.vendor_ns);
+        camera_histogram_record(&wrapper[record.op],
+                (nsecs_t)record.total_ns - record.vendor_ns);
+    }
+
+    printf("  Camera op log %s (camera %d): %d records%s\n", path,
+            file.header->camera_id, records,
+            offset < file.size ? ", truncated" : "");
+    print_histograms("Op latency", total);
+    print_histograms("Vendor HAL latency", vendor);
+    print_histograms("Wrapper-added latency", wrapper);
+
+    free(file.data);
+    return 0;
+}
+
+#ifdef OPLOG_REPLAY
+
+/* the vendor gets through far fewer video buffers than this */
+#define REPLAY_MAX_FRAMES 64
+
+typedef struct replay_memory {
+    camera_memory_t mem;
+    size_t bufSize;
+    size_t size;
+    bool mapped;
+} replay_memory_t;
+
+typedef struct replay_state {
+    android::Mutex lock;
+    /* recording frames in delivery order, released in that order when the
+     * log says the service released one */
+    const void *frames[REPLAY_MAX_FRAMES];
+    int framesHead;
+    int framesCount;
+    int32_t framesDropped;
+    int32_t notifies;
+    int32_t data;
+} replay_state_t;
+
+static void replay_memory_release(camera_memory_t *mem)
+{
+    replay_memory_t *memory = (replay_memory_t *)mem;
+
+    if (memory->mapped)
+        munmap(mem->data, memory->size);
+    else
+        free(mem->data);
+    free(memory);
+}
+
+static camera_memory_t *replay_get_memory(int fd, size_t buf_size,
+        unsigned int num_bufs, void *user)
+{
+    replay_memory_t *memory;
+
+    (void)user;
+    memory = (replay_memory_t *)calloc(1, sizeof(*memory));
+    if (!memory)
+        return NULL;
+
+    memory->bufSize = buf_size;
+    memory->size = buf_size * num_bufs;
+    if (fd >= 0) {
+        memory->mem.data = mmap(NULL, memory->size, PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, 0);
+        memory->mapped = memory->mem.data != MAP_FAILED;
+        if (!memory->mapped)
+            memory->mem.data = NULL;
+    } else {
+        memory->mem.data = calloc(1, memory->size ? memory->size : 1);
+    }
+    if (!memory->mem.data) {
+        free(memory);
+        return NULL;
+    }
+    memory->mem.size = memory->size;
+    memory->mem.handle = memory;
+    memory->mem.release = replay_memory_release;
+    return &memory->mem;
+}
+
+static void replay_notify_cb(int32_t msg_type, int32_t ext1, int32_t ext2,
+        void *user)
+{
+    replay_state_t *state = (replay_state_t *)user;
+
+    (void)msg_type;
+    (void)ext1;
+    (void)ext2;
+    android_atomic_inc(&state->notifies);
+}
+
+static void replay_data_cb(int32_t msg_type, const camera_memory_t *data,
+        unsigned int index, camera_frame_metadata_t *metadata, void *user)
+{
+    replay_state_t *state = (replay_state_t *)user;
+
+    (void)msg_type;
+    (void)data;
+    (void)index;
+    (void)metadata;
+    android_atomic_inc(&state->data);
+}
+
+static void replay_data_cb_timestamp(nsecs_t timestamp, int32_t msg_type,
+        const camera_memory_t *data, unsigned int index, void *user)
+{
+    replay_state_t *state = (replay_state_t *)user;
+    const replay_memory_t *memory = (const replay_memory_t *)data->handle;
+
+    (void)timestamp;
+    (void)msg_type;
+
+    android::Mutex::Autolock lock(state->lock);
+    if (state->framesCount == REPLAY_MAX_FRAMES) {
+        state->framesDropped++;
+        return;
+    }
+    state->frames[(state->framesHead + state->framesCount++) %
+            REPLAY_MAX_FRAMES] =
+            (const char *)memory->mem.data + index * memory->bufSize;
+}
+
+static const void *replay_next_frame(replay_state_t *state)
+{
+    const void *frame;
+
+    android::Mutex::Autolock lock(state->lock);
+    if (!state->framesCount)
+        return NULL;
+    frame = state->frames[state->framesHead];
+    state->framesHead = (state->framesHead + 1) % REPLAY_MAX_FRAMES;
+    state->framesCount--;
+    return frame;
+}
+
+static int oplog_replay(const char *path, bool timed, bool dump)
+{
+    camera_histogram_t total[CAMERA_OP_COUNT];
+#ifdef CAMERA_MOCK_STATIC
+    camera_histogram_t vendor[CAMERA_OP_COUNT];
+    camera_histogram_t wrapper[CAMERA_OP_COUNT];
+    nsecs_t vendorStart = 0, vendorNs;
+#endif
+    camera_oplog_record_t record;
+    const camera_module_t *module;
+    camera_device_t *dev = NULL;
+    replay_state_t state;
+    const char *payload;
+    oplog_file_t file;
+    size_t offset = 0;
+    nsecs_t base;
+    char name[16];
+    int replayed = 0;
+    int skipped = 0;
+    int rv;
+
+    if (oplog_file_load(path, &file))
+        return 1;
+
+    rv = hw_get_module(CAMERA_HARDWARE_MODULE_ID,
+            (const hw_module_t **)&module);
+    if (rv) {
+        fprintf(stderr, "cannot load the camera module: %d\n", rv);
+        free(file.data);
+        return 1;
+    }
+
+    snprintf(name, sizeof(name), "%d", file.header->camera_id);
+    rv = module->common.methods->open(&module->common, name,
+            (hw_device_t **)&dev);
+    if (rv) {
+        fprintf(stderr, "cannot open camera %s: %d\n", name, rv);
+        free(file.data);
+        return 1;
+    }
+
+    memset(total, 0, sizeof(total));
+#ifdef CAMERA_MOCK_STATIC
+    memset(vendor, 0, sizeof(vendor));
+    memset(wrapper, 0, sizeof(wrapper));
+#endif
+    state.framesHead = 0;
+    state.framesCount = 0;
+    state.framesDropped = 0;
+    state.notifies = 0;
+    state.data = 0;
+    base = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    while (oplog_file_next(&file, &offset, &record, &payload)) {
+        const int32_t *args = record.args;
+        android::String8 params;
+        const void *frame;
+        char *got;
+        nsecs_t start, elapsed;
+
+        if (timed) {
+            nsecs_t wait = base + record.start_ns -
+                    systemTime(SYSTEM_TIME_MONOTONIC);
+            if (wait > 0)
+                usleep(wait / 1000);
+        }
+
+#ifdef CAMERA_MOCK_STATIC
+        vendorStart = camera_mock_thread_ns();
+#endif
+        start = systemTime(SYSTEM_TIME_MONOTONIC);
+        switch (record.op) {
+        case CAMERA_OP_set_preview_window:
+            /* there is no surface to hand out, the vendor renders to none */
+            dev->ops->set_preview_window(dev, NULL);
+            break;
+        case CAMERA_OP_set_callbacks:
+            dev->ops->set_callbacks(dev, replay_notify_cb, replay_data_cb,
+                    replay_data_cb_timestamp, replay_get_memory, &state);
+            break;
+        case CAMERA_OP_enable_msg_type:
+            dev->ops->enable_msg_type(dev, args[0]);
+            break;
+        case CAMERA_OP_disable_msg_type:
+            dev->ops->disable_msg_type(dev, args[0]);
+            break;
+        case CAMERA_OP_msg_type_enabled:
+            dev->ops->msg_type_enabled(dev, args[0]);
+            break;
+        case CAMERA_OP_start_preview:
+            dev->ops->start_preview(dev);
+            break;
+        case CAMERA_OP_stop_preview:
+            dev->ops->stop_preview(dev);
+            break;
+        case CAMERA_OP_preview_enabled:
+            dev->ops->preview_enabled(dev);
+            break;
+        case CAMERA_OP_store_meta_data_in_buffers:
+            dev->ops->store_meta_data_in_buffers(dev, args[0]);
+            break;
+        case CAMERA_OP_start_recording:
+            dev->ops->start_recording(dev);
+            break;
+        case CAMERA_OP_stop_recording:
+            dev->ops->stop_recording(dev);
+            break;
+        case CAMERA_OP_recording_enabled:
+            dev->ops->recording_enabled(dev);
+            break;
+        case CAMERA_OP_release_recording_frame:
+            frame = replay_next_frame(&state);
+#ifdef CAMERA_MOCK_STATIC
+            // the frame the vendor would have delivered meanwhile
+            if (!frame && camera_mock_send_frame(file.header->camera_id,
+                    CAMERA_MSG_VIDEO_FRAME))
+                frame = replay_next_frame(&state);
+            vendorStart = camera_mock_thread_ns();
+#endif
+            if (!frame) {
+                skipped++;
+                continue;
+            }
+            start = systemTime(SYSTEM_TIME_MONOTONIC);
+            dev->ops->release_recording_frame(dev, frame);
+            break;
+        case CAMERA_OP_auto_focus:
+            dev->ops->auto_focus(dev);
+            break;
+        case CAMERA_OP_cancel_auto_focus:
+            dev->ops->cancel_auto_focus(dev);
+            break;
+        case CAMERA_OP_take_picture:
+            dev->ops->take_picture(dev);
+            break;
+        case CAMERA_OP_cancel_picture:
+            dev->ops->cancel_picture(dev);
+            break;
+        case CAMERA_OP_set_parameters:
+            params.setTo(payload, record.payload);
+            start = systemTime(SYSTEM_TIME_MONOTONIC);
+            dev->ops->set_parameters(dev, params.string());
+            break;
+        case CAMERA_OP_get_parameters:
+            /* put_parameters is not logged, the service always pairs them */
+            got = dev->ops->get_parameters(dev);
+            dev->ops->put_parameters(dev, got);
+            break;
+        case CAMERA_OP_send_command:
+            dev->ops->send_command(dev, args[0], args[1], args[2]);
+            break;
+        case CAMERA_OP_release:
+            dev->ops->release(dev);
+            break;
+        default:
+            skipped++;
+            continue;
+        }
+        elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+        camera_histogram_record(&total[record.op], elapsed);
+#ifdef CAMERA_MOCK_STATIC
+        vendorNs = camera_mock_thread_ns() - vendorStart;
+        camera_histogram_record(&vendor[record.op], vendorNs);
+        camera_histogram_record(&wrapper[record.op], elapsed - vendorNs);
+#endif
+        replayed++;
+    }
+
+    /* frames the session ended holding are handed back before closing */
+    while (const void *frame = replay_next_frame(&state))
+        dev->ops->release_recording_frame(dev, frame);
+
+    printf("  Replayed %d ops of %s on camera %s, %d skipped, "
+            "%d notifications, %d data callbacks, %d frames not tracked\n",
+            replayed, path, name, skipped, state.notifies, state.data,
+            state.framesDropped);
+    print_histograms("Op latency", total);
+#ifdef CAMERA_MOCK_STATIC
+    print_histograms("Vendor HAL latency", vendor);
+    print_histograms("Wrapper-added latency", wrapper);
+#endif
+    fflush(stdout);
+    if (dump)
+        dev->ops->dump(dev, STDOUT_FILENO);
+
+    dev->common.close(&dev->common);
+    free(file.data);
+    return 0;
+}
+
+#endif /* OPLOG_REPLAY */
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s dump [-v] <log>\n"
+#ifdef OPLOG_REPLAY
+            "       %s replay [-t] [-d] <log>\n"
+            "  -t  keep the recorded spacing between ops\n"
+            "  -d  append the wrapper's dump after replaying\n"
+#endif
+            "  -v  list every record\n",
+            argv0
+#ifdef OPLOG_REPLAY
+            , argv0
+#endif
+            );
+}
+
+int main(int argc, char **argv)
+{
+    bool verbose = false;
+    bool timed = false;
+    bool dump = false;
+    const char *cmd;
+    int opt;
+
+    if (argc < 2) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    cmd = argv[1];
+    optind = 2;
+    while ((opt = getopt(argc, argv, "vtd")) != -1) {
+        switch (opt) {
+        case 'v':
+            verbose = true;
+            break;
+        case 't':
+            timed = true;
+            break;
+        case 'd':
+            dump = true;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (strcmp(cmd, "dump") == 0)
+        return oplog_dump(argv[optind], verbose);
+#ifdef OPLOG_REPLAY
+    if (strcmp(cmd, "replay") == 0)
+        return oplog_replay(argv[optind], timed, dump);
+#else
+    (void)timed;
+    (void)dump;
+#endif
+
+    usage(argv[0]);
+    return 2;
+}
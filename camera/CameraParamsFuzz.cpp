@@ -0,0 +1,340 @@
+/*
+ * Copyright (C) 2014, The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file CameraParamsFuzz.cpp
+*
+* Fuzzes the parameter fixups through the wrapper and the mock vendor HAL.
+*
+* Every input is a parameter string. A mock device is opened with it as
+* its parameters, so get_parameters translates it as the vendor's. It is
+* then set as the service's, once as it is and once as read back.
+*
+* The canned parameters of CameraMockParams.h are the seed corpus. Each
+* round mutates one of them: entries are dropped, repeated or cut short,
+* and value lists the fixups walk are grown far past what a vendor
+* reports. Files given on the command line are run as they are instead,
+* which is how an input written with -w is rerun. Built with
+* CAMERA_PARAMS_FUZZ_LIBFUZZER, main() is left to libFuzzer.
+*
+* It only finds what crashes, so build it with ASan and UBSan. The time
+* and allocations of the fixups are measured by camera_wrapper_bench.
+*
+*/
+
+#define LOG_TAG "CameraParamsFuzz"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <utils/String8.h>
+#include <hardware/hardware.h>
+#include <hardware/camera.h>
+
+#include "CameraMockParams.h"
+#include "CameraMockVendor.h"
+
+#define FUZZ_ROUNDS 5000
+#define FUZZ_MAX_INPUT (256 * 1024)
+#define FUZZ_MAX_ENTRIES 256
+/* longest value list grown by a mutation */
+#define FUZZ_MAX_LIST 400
+
+/* keys the fixups read or write, and values they look for */
+static const char *fuzz_keys[] = {
+    "iso", "iso-values", "sony-iso", "sony-iso-values",
+    "sony-ae-mode", "sony-ae-mode-values", "sony-is", "sony-is-values",
+    "sony-vs", "sony-vs-values", "sony-video-hdr", "sony-video-hdr-values",
+    "video-hdr", "video-hdr-values", "scene-mode", "scene-mode-values",
+    "shutter-speed", "sony-shutter-speed", "recording-hint",
+    "preview-size", "preview-format", "wrapper-preview-cb-size",
+    "wrapper-preview-cb-format", "wrapper-preview-cb-interval",
+    "wrapper-preview-cb-roi", "wrapper-auto-hdr-recommended",
+};
+
+static const char *fuzz_values[] = {
+    "", "auto", "on", "off", "true", "false", "hdr", "ISO", "ISO100",
+    "100", "1600", "iso-prio", "shutter-prio", "manual", "on-still-hdr",
+    "on-intelligent-active", "1/1000", "0x0", "1x1", "99999x99999",
+    "-1x-1", "rgba8888", "yuv420sp", "(0,0,1,1)", "(-5,7,99999,3)",
+    "2147483647", "-2147483648", ",", ",,",
+};
+
+#define FUZZ_COUNT(a) (sizeof(a) / sizeof((a)[0]))
+
+static const hw_module_t *gWrapper;
+static uint32_t gSeed = 1;
+
+static uint32_t fuzz_rand(void)
+{
+    gSeed ^= gSeed << 13;
+    gSeed ^= gSeed >> 17;
+    gSeed ^= gSeed << 5;
+    return gSeed;
+}
+
+/* a value list, usually short, every fourth one up to FUZZ_MAX_LIST */
+static void fuzz_list(android::String8 &out)
+{
+    int count = fuzz_rand() % 4 ? fuzz_rand() % 4 + 1 :
+            fuzz_rand() % FUZZ_MAX_LIST + 1;
+
+    for (int i = 0; i < count; i++) {
+        if (i)
+            out.append(",");
+        out.append(fuzz_values[fuzz_rand() % FUZZ_COUNT(fuzz_values)]);
+    }
+}
+
+static int fuzz_split(const char *params, android::String8 *entries)
+{
+    int count = 0;
+
+    while (*params && count < FUZZ_MAX_ENTRIES) {
+        const char *end = strchr(params, ';');
+        size_t len = end ? (size_t)(end - params) : strlen(params);
+
+        entries[count++].setTo(params, len);
+        params += end ? len + 1 : len;
+    }
+    return count;
+}
+
+static void fuzz_mutate(android::String8 &out)
+{
+    static android::String8 entries[FUZZ_MAX_ENTRIES];
+    const char *seed = camera_mock_params[fuzz_rand() %
+            CAMERA_MOCK_PARAMS_COUNT].params;
+    int count = fuzz_split(seed, entries);
+    int edits = fuzz_rand() % 8 + 1;
+
+    for (int e = 0; e < edits && count > 0; e++) {
+        int i = fuzz_rand() % count;
+        android::String8 &entry = entries[i];
+
+        switch (fuzz_rand() % 6) {
+        case 0: {
+            // the same key with another value
+            const char *eq = strchr(entry.string(), '=');
+            android::String8 key(entry.string(),
+                    eq ? eq - entry.string() : entry.length());
+
+            entry.setTo(key);
+            entry.append("=");
+            fuzz_list(entry);
+            break;
+        }
+        case 1:
+            if (count < FUZZ_MAX_ENTRIES) {
+                entries[count].setTo(fuzz_keys[fuzz_rand() %
+                        FUZZ_COUNT(fuzz_keys)]);
+                entries[count].append("=");
+                fuzz_list(entries[count]);
+                count++;
+            }
+            break;
+        case 2:
+            entry.setTo(entries[--count]);
+            break;
+        case 3:
+            if (count < FUZZ_MAX_ENTRIES)
+                entries[count++].setTo(entry);
+            break;
+        case 4:
+            // may lose the '=' or leave the key alone
+            entry.setTo(entry.string(), fuzz_rand() % (entry.length() + 1));
+            break;
+        case 5: {
+            static const char seps[] = ",;=x(";
+            size_t at = fuzz_rand() % (entry.length() + 1);
+            android::String8 cut(entry.string(), at);
+
+            cut.append(&seps[fuzz_rand() % (sizeof(seps) - 1)], 1);
+            cut.append(entry.string() + at);
+            entry.setTo(cut);
+            break;
+        }
+        }
+    }
+
+    out.clear();
+    for (int i = 0; i < count; i++) {
+        if (i)
+            out.append(";");
+        out.append(entries[i]);
+    }
+    if (fuzz_rand() % 16 == 0)
+        out.setTo(out.string(), fuzz_rand() % (out.length() + 1));
+}
+
+static int fuzz_init(void)
+{
+    if (gWrapper)
+        return 0;
+    if (hw_get_module(CAMERA_HARDWARE_MODULE_ID, &gWrapper)) {
+        fprintf(stderr, "cannot load the camera module\n");
+        return -1;
+    }
+    return 0;
+}
+
+static void fuzz_one(const char *params)
+{
+    camera_device_t *dev;
+    char *got;
+
+    camera_mock_set_params(params);
+    if (gWrapper->methods->open(gWrapper, "0", (hw_device_t **)&dev)) {
+        fprintf(stderr, "cannot open the wrapped mock camera\n");
+        abort();
+    }
+
+    got = dev->ops->get_parameters(dev);
+    dev->ops->set_parameters(dev, params);
+    if (got) {
+        dev->ops->set_parameters(dev, got);
+        dev->ops->put_parameters(dev, got);
+    }
+    got = dev->ops->get_parameters(dev);
+    if (got)
+        dev->ops->put_parameters(dev, got);
+
+    dev->ops->release(dev);
+    dev->common.close(&dev->common);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    if (fuzz_init())
+        abort();
+
+    // a NUL ends the parameters, as it would for the vendor
+    android::String8 params((const char *)data, size);
+    fuzz_one(params.string());
+    return 0;
+}
+
+#ifndef CAMERA_PARAMS_FUZZ_LIBFUZZER
+
+static int fuzz_file(const char *path)
+{
+    static char buf[FUZZ_MAX_INPUT];
+    ssize_t size;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    size = read(fd, buf, sizeof(buf));
+    close(fd);
+    if (size < 0) {
+        perror(path);
+        return -1;
+    }
+
+    LLVMFuzzerTestOneInput((const uint8_t *)buf, size);
+    return 0;
+}
+
+/* keeps the input about to run in path, so the one that crashed is left */
+static void fuzz_save(const char *path, const android::String8 &params)
+{
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (fd < 0)
+        return;
+    if (write(fd, params.string(), params.length()) !=
+            (ssize_t)params.length())
+        perror(path);
+    close(fd);
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [-n rounds] [-s seed] [-w file] [input]...\n"
+            "  -n  mutated inputs to run after the seeds (%d)\n"
+            "  -s  seed of the mutations\n"
+            "  -w  write each input to this file before running it\n"
+            "  inputs given are run instead of the seeds and mutations\n",
+            argv0, FUZZ_ROUNDS);
+}
+
+int main(int argc, char **argv)
+{
+    const char *save = NULL;
+    int rounds = FUZZ_ROUNDS;
+    android::String8 params;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:w:")) != -1) {
+        switch (opt) {
+        case 'n':
+            rounds = atoi(optarg);
+            break;
+        case 's':
+            gSeed = strtoul(optarg, NULL, 0);
+            break;
+        case 'w':
+            save = optarg;
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (rounds < 0 || !gSeed) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (fuzz_init())
+        return 1;
+
+    if (optind < argc) {
+        for (int i = optind; i < argc; i++) {
+            if (fuzz_file(argv[i]))
+                return 1;
+        }
+        printf("  Parameter fixups: %d inputs run\n", argc - optind);
+        return 0;
+    }
+
+    for (size_t i = 0; i < CAMERA_MOCK_PARAMS_COUNT; i++) {
+        params.setTo(camera_mock_params[i].params);
+        if (save)
+            fuzz_save(save, params);
+        fuzz_one(params.string());
+    }
+    for (int i = 0; i < rounds; i++) {
+        fuzz_mutate(params);
+        if (save)
+            fuzz_save(save, params);
+        fuzz_one(params.string());
+    }
+    camera_mock_set_params(NULL);
+
+    printf("  Parameter fixups: %zu seeds and %d mutations run\n",
+            CAMERA_MOCK_PARAMS_COUNT, rounds);
+    return 0;
+}
+
+#endif /* CAMERA_PARAMS_FUZZ_LIBFUZZER */
@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) 2014, The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file CameraStats.cpp
+*
+* Lock-free latency histograms kept per camera id by the camera wrapper.
+*
+* Recording only uses atomic increments so that it can be done from any
+* HAL or callback thread; readers may observe a sample half-recorded, which
+* is fine for statistics.
+*
+*/
+
+#define LOG_TAG "CameraWrapper"
+#include <cutils/log.h>
+#include <cutils/atomic.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#if !defined(__ANDROID__) && defined(__linux__)
+#include <sys/syscall.h>
+#endif
+
+#include "CameraStats.h"
+
+static camera_module_stats_t gCameraModuleStats;
+static camera_stats_t gCameraStats[CAMERA_STATS_MAX_CAMERAS];
+
+static const char *camera_op_names[CAMERA_OP_COUNT] = {
+#define CAMERA_OP_NAME(op) #op,
+    CAMERA_OP_LIST(CAMERA_OP_NAME)
+#undef CAMERA_OP_NAME
+};
+
+static const char *camera_fixup_names[CAMERA_FIXUP_COUNT] = {
+    "fixup_getparams",
+    "fixup_setparams",
+    "preview_cb_convert",
+    "auto_hdr_luma_stats",
+};
+
+static const char *camera_latency_names[CAMERA_LATENCY_COUNT] = {
+    "take_picture_to_shutter",
+    "take_picture_to_raw",
+    "take_picture_to_jpeg",
+    "auto_focus_to_focus",
+    "start_preview_to_first_frame",
+    "preview_frame_interval",
+    "preview_frame_jitter",
+};
+
+static const char *camera_window_names[CAMERA_WINDOW_COUNT] = {
+    "dequeue_buffer",
+    "enqueue_buffer",
+    "cancel_buffer",
+    "lock_buffer",
+    "frame_interval",
+};
+
+static pthread_once_t gThreadTidOnce = PTHREAD_ONCE_INIT;
+static pthread_key_t gThreadTidKey;
+
+static void camera_thread_tid_key_create(void)
+{
+    pthread_key_create(&gThreadTidKey, NULL);
+}
+
+int32_t camera_thread_tid(void)
+{
+    int32_t tid;
+
+    pthread_once(&gThreadTidOnce, camera_thread_tid_key_create);
+    /* tids are never 0, so the key's value itself is the cache */
+    tid = (int32_t)(intptr_t)pthread_getspecific(gThreadTidKey);
+    if (!tid) {
+#if defined(__ANDROID__)
+        tid = gettid();
+#elif defined(__linux__)
+        tid = syscall(SYS_gettid);
+#else
+        /* other hosts only read op logs, nothing is recorded there */
+        tid = getpid();
+#endif
+        pthread_setspecific(gThreadTidKey, (void *)(intptr_t)tid);
+    }
+    return tid;
+}
+
+static int camera_histogram_bucket(nsecs_t ns)
+{
+    uint64_t us = ns > 0 ? (uint64_t)ns / 1000 : 0;
+    int bucket;
+
+    if (us == 0)
+        return 0;
+
+    bucket = 63 - __builtin_clzll(us);
+    if (bucket >= CAMERA_HISTOGRAM_BUCKETS)
+        bucket = CAMERA_HISTOGRAM_BUCKETS - 1;
+    return bucket;
+}
+
+void camera_histogram_record(camera_histogram_t *hist, nsecs_t ns)
+{
+    int64_t max;
+
+    if (ns < 0)
+        ns = 0;
+
+    android_atomic_inc(&hist->buckets[camera_histogram_bucket(ns)]);
+    android_atomic_inc(&hist->count);
+    __sync_fetch_and_add(&hist->total_ns, ns);
+
+    do {
+        max = hist->max_ns;
+    } while (ns > max &&
+            !__sync_bool_compare_and_swap(&hist->max_ns, max, ns));
+}
+
+void camera_histogram_reset(camera_histogram_t *hist)
+{
+    for (int i = 0; i < CAMERA_HISTOGRAM_BUCKETS; i++)
+        android_atomic_release_store(0, &hist->buckets[i]);
+    android_atomic_release_store(0, &hist->count);
+    __sync_lock_test_and_set(&hist->total_ns, 0);
+    __sync_lock_test_and_set(&hist->max_ns, 0);
+}
+
+/* upper bound, in microseconds, of the bucket holding the given percentile */
+static int64_t camera_histogram_percentile(const camera_histogram_t *hist,
+        int32_t count, int percent)
+{
+    int64_t target = ((int64_t)count * percent + 99) / 100;
+    int64_t seen = 0;
+
+    for (int i = 0; i < CAMERA_HISTOGRAM_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= target)
+            return 2LL << i;
+    }
+    return 2LL << (CAMERA_HISTOGRAM_BUCKETS - 1);
+}
+
+void camera_histogram_dump(const camera_histogram_t *hist, const char *name,
+        android::String8 &out)
+{
+    int32_t count = android_atomic_acquire_load(&hist->count);
+
+    if (count <= 0)
+        return;
+
+    out.appendFormat("    %-28s n=%d avg=%lldus max=%lldus "
+            "p50<%lldus p90<%lldus p99<%lldus\n",
+            name, count,
+            (long long)(hist->total_ns / count / 1000),
+            (long long)(hist->max_ns / 1000),
+            (long long)camera_histogram_percentile(hist, count, 50),
+            (long long)camera_histogram_percentile(hist, count, 90),
+            (long long)camera_histogram_percentile(hist, count, 99));
+}
+
+camera_module_stats_t *camera_stats_module(void)
+{
+    return &gCameraModuleStats;
+}
+
+camera_histogram_t *camera_stats_vendor(int camera_id, int op)
+{
+    if (camera_id < 0 || camera_id >= CAMERA_STATS_MAX_CAMERAS)
+        return NULL;
+    return &gCameraStats[camera_id].vendor[op];
+}
+
+camera_histogram_t *camera_stats_fixup(int camera_id, int fixup)
+{
+    if (camera_id < 0 || camera_id >= CAMERA_STATS_MAX_CAMERAS)
+        return NULL;
+    return &gCameraStats[camera_id].fixup[fixup];
+}
+
+camera_histogram_t *camera_stats_latency(int camera_id, int latency)
+{
+    if (camera_id < 0 || camera_id >= CAMERA_STATS_MAX_CAMERAS)
+        return NULL;
+    return &gCameraStats[camera_id].latency[latency];
+}
+
+camera_histogram_t *camera_stats_window(int camera_id, int op)
+{
+    if (camera_id < 0 || camera_id >= CAMERA_STATS_MAX_CAMERAS)
+        return NULL;
+    return &gCameraStats[camera_id].window[op];
+}
+
+void camera_stats_reset(int camera_id)
+{
+    camera_stats_t *stats;
+
+    if (camera_id < 0 || camera_id >= CAMERA_STATS_MAX_CAMERAS)
+        return;
+
+    stats = &gCameraStats[camera_id];
+    for (int i = 0; i < CAMERA_OP_COUNT; i++)
+        camera_histogram_reset(&stats->vendor[i]);
+    for (int i = 0; i < CAMERA_FIXUP_COUNT; i++)
+        camera_histogram_reset(&stats->fixup[i]);
+    for (int i = 0; i < CAMERA_LATENCY_COUNT; i++)
+        camera_histogram_reset(&stats->latency[i]);
+    for (int i = 0; i < CAMERA_WINDOW_COUNT; i++)
+        camera_histogram_reset(&stats->window[i]);
+}
+
+void camera_stats_dump(int camera_id, int fd)
+{
+    android::String8 out;
+    camera_stats_t *stats;
+
+    if (camera_id < 0 || camera_id >= CAMERA_STATS_MAX_CAMERAS)
+        return;
+
+    stats = &gCameraStats[camera_id];
+    out.appendFormat("  Camera wrapper statistics (camera %d):\n", camera_id);
+    out.appendFormat("   Vendor module: loaded in %lldus%s\n",
+            (long long)(gCameraModuleStats.load_ns / 1000),
+            gCameraModuleStats.preloaded ? " (preloaded)" : "");
+    camera_histogram_dump(&gCameraModuleStats.load_wait, "load_wait", out);
+    out.appendFormat("    cached info: count hits=%d info hits=%d misses=%d\n",
+            gCameraModuleStats.count_hits, gCameraModuleStats.info_hits,
+            gCameraModuleStats.info_misses);
+    out.append("   Vendor HAL latency:\n");
+    for (int i = 0; i < CAMERA_OP_COUNT; i++)
+        camera_histogram_dump(&stats->vendor[i], camera_op_names[i], out);
+    out.append("   Wrapper processing latency:\n");
+    for (int i = 0; i < CAMERA_FIXUP_COUNT; i++)
+        camera_histogram_dump(&stats->fixup[i], camera_fixup_names[i], out);
+    out.append("   End-to-end latency:\n");
+    for (int i = 0; i < CAMERA_LATENCY_COUNT; i++)
+        camera_histogram_dump(&stats->latency[i], camera_latency_names[i], out);
+    out.append("   Preview window latency:\n");
+    for (int i = 0; i < CAMERA_WINDOW_COUNT; i++)
+        camera_histogram_dump(&stats->window[i], camera_window_names[i], out);
+
+    camera_stats_write(fd, out);
+}
+
+void camera_stats_write(int fd, const android::String8 &out)
+{
+    const char *data = out.string();
+    size_t left = out.size();
+    ssize_t written;
+
+    while (left) {
+        written = write(fd, data, left);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0) {
+            ALOGW("%s: dump truncated, %zu bytes not written: %s",
+                    __FUNCTION__, left, written ? strerror(errno) : "EOF");
+            return;
+        }
+        data += written;
+        left -= written;
+    }
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright (C) 2014, The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file CameraStats.h
+*
+* Lock-free latency histograms kept per camera id by the camera wrapper.
+*
+*/
+
+#ifndef CAMERA_STATS_H
+#define CAMERA_STATS_H
+
+#include <stdint.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
+#define CAMERA_STATS_MAX_CAMERAS 4
+
+/* bucket i counts samples in [2^i, 2^(i+1)) microseconds, the last one
+ * also takes everything slower */
+#define CAMERA_HISTOGRAM_BUCKETS 24
+
+#define CAMERA_OP_LIST(X) \
+    X(set_preview_window) \
+    X(set_callbacks) \
+    X(enable_msg_type) \
+    X(disable_msg_type) \
+    X(msg_type_enabled) \
+    X(start_preview) \
+    X(stop_preview) \
+    X(preview_enabled) \
+    X(store_meta_data_in_buffers) \
+    X(start_recording) \
+    X(stop_recording) \
+    X(recording_enabled) \
+    X(release_recording_frame) \
+    X(auto_focus) \
+    X(cancel_auto_focus) \
+    X(take_picture) \
+    X(cancel_picture) \
+    X(set_parameters) \
+    X(get_parameters) \
+    X(put_parameters) \
+    X(send_command) \
+    X(release) \
+    X(dump)
+
+/* operation ids are named after the camera_device_ops member so that
+ * VENDOR_CALL can paste them */
+enum camera_op {
+#define CAMERA_OP_ENUM(op) CAMERA_OP_##op,
+    CAMERA_OP_LIST(CAMERA_OP_ENUM)
+#undef CAMERA_OP_ENUM
+    CAMERA_OP_COUNT
+};
+
+enum camera_fixup {
+    CAMERA_FIXUP_GETPARAMS,
+    CAMERA_FIXUP_SETPARAMS,
+    CAMERA_FIXUP_PREVIEW_CB,
+    CAMERA_FIXUP_LUMA_STATS,
+    CAMERA_FIXUP_COUNT
+};
+
+/* end-to-end latencies seen by the service, measured between the wrapper's
+ * entry points and the callbacks they lead to */
+enum camera_latency {
+    CAMERA_LATENCY_SHUTTER,
+    CAMERA_LATENCY_RAW,
+    CAMERA_LATENCY_JPEG,
+    CAMERA_LATENCY_FOCUS,
+    CAMERA_LATENCY_FIRST_PREVIEW,
+    CAMERA_LATENCY_PREVIEW_INTERVAL,
+    CAMERA_LATENCY_PREVIEW_JITTER,
+    CAMERA_LATENCY_COUNT
+};
+
+/* calls made by the vendor into the service's preview window */
+enum camera_window_op {
+    CAMERA_WINDOW_DEQUEUE,
+    CAMERA_WINDOW_ENQUEUE,
+    CAMERA_WINDOW_CANCEL,
+    CAMERA_WINDOW_LOCK,
+    CAMERA_WINDOW_FRAME_INTERVAL,
+    CAMERA_WINDOW_COUNT
+};
+
+typedef struct camera_histogram {
+    volatile int32_t buckets[CAMERA_HISTOGRAM_BUCKETS];
+    volatile int32_t count;
+    volatile int64_t total_ns;
+    volatile int64_t max_ns;
+} camera_histogram_t;
+
+typedef struct camera_stats {
+    /* time spent inside the vendor HAL */
+    camera_histogram_t vendor[CAMERA_OP_COUNT];
+    /* time spent in the wrapper's own parameter and frame processing */
+    camera_histogram_t fixup[CAMERA_FIXUP_COUNT];
+    camera_histogram_t latency[CAMERA_LATENCY_COUNT];
+    camera_histogram_t window[CAMERA_WINDOW_COUNT];
+} camera_stats_t;
+
+typedef struct camera_module_stats {
+    /* set when the vendor module load was started at wrapper load time */
+    volatile int32_t preloaded;
+    volatile int64_t load_ns;
+    /* time camera module callers spent blocked on the vendor load */
+    camera_histogram_t load_wait;
+    /* queries answered from the static camera info snapshot */
+    volatile int32_t count_hits;
+    volatile int32_t info_hits;
+    volatile int32_t info_misses;
+} camera_module_stats_t;
+
+void camera_histogram_record(camera_histogram_t *hist, nsecs_t ns);
+void camera_histogram_reset(camera_histogram_t *hist);
+void camera_histogram_dump(const camera_histogram_t *hist, const char *name,
+        android::String8 &out);
+
+camera_module_stats_t *camera_stats_module(void);
+camera_histogram_t *camera_stats_vendor(int camera_id, int op);
+camera_histogram_t *camera_stats_fixup(int camera_id, int fixup);
+camera_histogram_t *camera_stats_latency(int camera_id, int latency);
+camera_histogram_t *camera_stats_window(int camera_id, int op);
+void camera_stats_reset(int camera_id);
+void camera_stats_dump(int camera_id, int fd);
+/* writes all of out to a dump fd, giving up on the first error */
+void camera_stats_write(int fd, const android::String8 &out);
+
+/* tid of the calling thread, looked up once per thread: gettid() is a
+ * system call and this is asked for on every vendor call */
+int32_t camera_thread_tid(void);
+
+/* records the lifetime of the enclosing scope into a histogram and, when
+ * given, adds it to *accum */
+class CameraStatsTimer {
+public:
+    CameraStatsTimer(camera_histogram_t *hist, nsecs_t *accum = NULL)
+        : mHist(hist), mAccum(accum),
+          mStart(hist || accum ? systemTime(SYSTEM_TIME_MONOTONIC) : 0) {}
+    ~CameraStatsTimer() {
+        nsecs_t elapsed;
+
+        if (!mHist && !mAccum)
+            return;
+        elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - mStart;
+        if (mHist)
+            camera_histogram_record(mHist, elapsed);
+        if (mAccum)
+            *mAccum += elapsed;
+    }
+
+    /* 0 when not timing */
+    nsecs_t start() const { return mStart; }
+
+private:
+    camera_histogram_t *mHist;
+    nsecs_t *mAccum;
+    nsecs_t mStart;
+};
+
+#endif /* CAMERA_STATS_H */
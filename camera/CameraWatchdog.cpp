@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2014, The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file CameraWatchdog.cpp
+*
+* Watchdog for calls into the vendor HAL that do not return.
+*
+* A stalled call is logged with its thread's stack once it passes its op's
+* threshold, again without the stack every time its duration doubles, and
+* once more when it eventually returns. The watchdog thread only holds its
+* own lock, so it keeps reporting while the camera's locks are held by the
+* stuck call.
+*
+*/
+
+#define LOG_TAG "CameraWrapper"
+#include <cutils/log.h>
+
+#include <unistd.h>
+
+#include <new>
+
+#include <utils/CallStack.h>
+#include <utils/threads.h>
+
+#include "CameraWatchdog.h"
+
+#define WATCHDOG_PERIOD_MS 500
+#define WATCHDOG_MAX_CAMERAS CAMERA_STATS_MAX_CAMERAS
+
+static const char *watchdog_op_names[CAMERA_OP_COUNT] = {
+#define CAMERA_OP_NAME(op) #op,
+    CAMERA_OP_LIST(CAMERA_OP_NAME)
+#undef CAMERA_OP_NAME
+};
+
+static android::Mutex gWatchdogLock;
+static camera_watchdog_t *gWatchdogs[WATCHDOG_MAX_CAMERAS];
+/* the thread exits once no camera is open */
+static bool gWatchdogRunning;
+
+/* how long the Sony HAL may reasonably take, with room for a long
+ * exposure on take_picture and a sensor restart on the others */
+static int32_t watchdog_threshold_ms(int op)
+{
+    switch (op) {
+    case CAMERA_OP_take_picture:
+        return 5000;
+    case CAMERA_OP_start_preview:
+    case CAMERA_OP_stop_preview:
+    case CAMERA_OP_start_recording:
+    case CAMERA_OP_stop_recording:
+    case CAMERA_OP_release:
+        return 3000;
+    case CAMERA_OP_set_parameters:
+        return 2000;
+    default:
+        return 1000;
+    }
+}
+
+/* tick counts wrap after about 26 days */
+static int32_t watchdog_elapsed_ms(int32_t now, int32_t then)
+{
+    int32_t ticks = (int32_t)((uint32_t)now - (uint32_t)then);
+
+    return (int32_t)(((int64_t)ticks << 20) / 1000000);
+}
+
+/* must be called with gWatchdogLock held */
+static void watchdog_report_returned(camera_watchdog_t *watchdog, int op,
+        int32_t now)
+{
+    camera_watchdog_slot_t *slot = &watchdog->slots[op];
+
+    ALOGW("camera %d: vendor %s returned after about %dms",
+            watchdog->cameraId, watchdog_op_names[op],
+            watchdog_elapsed_ms(now, slot->reported));
+    slot->reported = 0;
+}
+
+/* must be called with gWatchdogLock held */
+static void watchdog_check_slot(camera_watchdog_t *watchdog, int op,
+        int32_t now)
+{
+    camera_watchdog_slot_t *slot = &watchdog->slots[op];
+    int32_t start = android_atomic_acquire_load(&slot->start);
+    int32_t elapsed;
+    pid_t tid;
+
+    if (slot->reported && start != slot->reported)
+        watchdog_report_returned(watchdog, op, now);
+    if (!start)
+        return;
+
+    elapsed = watchdog_elapsed_ms(now, start);
+    if (start == slot->reported) {
+        if (elapsed < slot->nextReport)
+            return;
+        ALOGE("camera %d: vendor %s still has not returned after %dms",
+                watchdog->cameraId, watchdog_op_names[op], elapsed);
+        slot->nextReport = elapsed * 2;
+        return;
+    }
+    if (elapsed < watchdog_threshold_ms(op))
+        return;
+
+    tid = slot->tid;
+    ALOGE("camera %d: vendor %s has not returned after %dms, thread %d:",
+            watchdog->cameraId, watchdog_op_names[op], elapsed, tid);
+    if (tid > 0) {
+        android::CallStack stack;
+        stack.update(0, tid);
+        stack.log(LOG_TAG, ANDROID_LOG_ERROR, "  ");
+    }
+    android_atomic_inc(&watchdog->stalls[op]);
+    slot->reported = start;
+    slot->nextReport = elapsed * 2;
+}
+
+static void *watchdog_thread(void *)
+{
+    for (;;) {
+        usleep(WATCHDOG_PERIOD_MS * 1000);
+
+        android::Mutex::Autolock lock(gWatchdogLock);
+        int32_t now = camera_watchdog_ticks(systemTime(SYSTEM_TIME_MONOTONIC));
+        bool watching = false;
+
+        for (int i = 0; i < WATCHDOG_MAX_CAMERAS; i++) {
+            if (!gWatchdogs[i])
+                continue;
+            watching = true;
+            for (int op = 0; op < CAMERA_OP_COUNT; op++)
+                watchdog_check_slot(gWatchdogs[i], op, now);
+        }
+        if (!watching) {
+            gWatchdogRunning = false;
+            break;
+        }
+    }
+    return NULL;
+}
+
+camera_watchdog_t *camera_watchdog_open(int camera_id)
+{
+    android::Mutex::Autolock lock(gWatchdogLock);
+    camera_watchdog_t *watchdog;
+    int i;
+
+    for (i = 0; i < WATCHDOG_MAX_CAMERAS && gWatchdogs[i]; i++)
+        ;
+    if (i == WATCHDOG_MAX_CAMERAS)
+        return NULL;
+
+    if (!gWatchdogRunning) {
+        pthread_attr_t attr;
+        pthread_t thread;
+        int rv;
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        rv = pthread_create(&thread, &attr, watchdog_thread, NULL);
+        pthread_attr_destroy(&attr);
+        if (rv) {
+            ALOGE("%s: cannot start the watchdog thread", __FUNCTION__);
+            return NULL;
+        }
+        gWatchdogRunning = true;
+    }
+
+    watchdog = new (std::nothrow) camera_watchdog_t();
+    if (!watchdog)
+        return NULL;
+    watchdog->cameraId = camera_id;
+    gWatchdogs[i] = watchdog;
+    return watchdog;
+}
+
+void camera_watchdog_close(camera_watchdog_t *watchdog)
+{
+    if (!watchdog)
+        return;
+
+    {
+        android::Mutex::Autolock lock(gWatchdogLock);
+        int32_t now = camera_watchdog_ticks(systemTime(SYSTEM_TIME_MONOTONIC));
+
+        for (int i = 0; i < WATCHDOG_MAX_CAMERAS; i++) {
+            if (gWatchdogs[i] == watchdog)
+                gWatchdogs[i] = NULL;
+        }
+        for (int op = 0; op < CAMERA_OP_COUNT; op++) {
+            if (watchdog->slots[op].reported)
+                watchdog_report_returned(watchdog, op, now);
+        }
+    }
+    delete watchdog;
+}
+
+void camera_watchdog_dump(camera_watchdog_t *watchdog, android::String8 &out)
+{
+    int32_t now, start;
+    bool stalled = false;
+
+    if (!watchdog)
+        return;
+
+    now = camera_watchdog_ticks(systemTime(SYSTEM_TIME_MONOTONIC));
+    out.append("   Vendor call watchdog: stalls");
+    for (int op = 0; op < CAMERA_OP_COUNT; op++) {
+        if (!watchdog->stalls[op])
+            continue;
+        out.appendFormat(" %s=%d", watchdog_op_names[op],
+                watchdog->stalls[op]);
+        stalled = true;
+    }
+    out.append(stalled ? "\n" : " none\n");
+    for (int op = 0; op < CAMERA_OP_COUNT; op++) {
+        start = android_atomic_acquire_load(&watchdog->slots[op].start);
+        if (start && watchdog_elapsed_ms(now, start) >=
+                watchdog_threshold_ms(op))
+            out.appendFormat("    %s in flight for %dms\n",
+                    watchdog_op_names[op], watchdog_elapsed_ms(now, start));
+    }
+}
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2014, The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file CameraWatchdog.h
+*
+* Watchdog for calls into the vendor HAL that do not return.
+*
+* Every VENDOR_CALL marks the op's slot of the device as in flight for its
+* duration. One thread shared by all cameras looks at the slots twice a
+* second and logs the calls that have been in flight for longer than the
+* op's threshold, with the stack of the thread stuck in the call.
+*
+*/
+
+#ifndef CAMERA_WATCHDOG_H
+#define CAMERA_WATCHDOG_H
+
+#include <stdint.h>
+#include <cutils/atomic.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
+#include "CameraStats.h"
+
+typedef struct camera_watchdog_slot {
+    /* monotonic time the call was made, in units of 2^20ns (about 1ms),
+     * 0 while no call is in flight */
+    volatile int32_t start;
+    /* tid of the calling thread, valid while start is set */
+    volatile int32_t tid;
+    /* only used by the watchdog thread */
+    int32_t reported;
+    int32_t nextReport;
+} camera_watchdog_slot_t;
+
+typedef struct camera_watchdog {
+    int cameraId;
+    camera_watchdog_slot_t slots[CAMERA_OP_COUNT];
+    /* calls that went past their op's threshold */
+    int32_t stalls[CAMERA_OP_COUNT];
+} camera_watchdog_t;
+
+/* registers a camera with the watchdog, starting its thread on first use,
+ * NULL on failure */
+camera_watchdog_t *camera_watchdog_open(int camera_id);
+/* must only be called once no vendor call can be in flight */
+void camera_watchdog_close(camera_watchdog_t *watchdog);
+void camera_watchdog_dump(camera_watchdog_t *watchdog, android::String8 &out);
+
+static inline int32_t camera_watchdog_ticks(nsecs_t ns)
+{
+    int32_t ticks = (int32_t)(ns >> 20);
+
+    return ticks ? ticks : 1;
+}
+
+/* Marks the enclosing vendor call as in flight. Concurrent calls of the
+ * same op on the same camera share the slot: the newest one is watched
+ * until the first of them returns. */
+class CameraWatchdogScope {
+public:
+    CameraWatchdogScope(camera_watchdog_t *watchdog, int op, nsecs_t now)
+        : mSlot(NULL) {
+        if (!watchdog)
+            return;
+        mSlot = &watchdog->slots[op];
+        mSlot->tid = camera_thread_tid();
+        android_atomic_release_store(camera_watchdog_ticks(now ? now :
+                systemTime(SYSTEM_TIME_MONOTONIC)), &mSlot->start);
+    }
+    ~CameraWatchdogScope() {
+        /* no ordering needed, the watchdog only looks at calls that have
+         * been in flight for a second or more */
+        if (mSlot)
+            mSlot->start = 0;
+    }
+
+private:
+    camera_watchdog_slot_t *mSlot;
+};
+
+#endif /* CAMERA_WATCHDOG_H */
@@ -24,15 +24,57 @@
 //#define LOG_NDEBUG 0
 
 #define LOG_TAG "CameraWrapper"
+#ifdef CAMERA_WRAPPER_TRACE
+#define ATRACE_TAG ATRACE_TAG_CAMERA
+#endif
 #include <cutils/log.h>
+#include <cutils/atomic.h>
+#include <cutils/properties.h>
+
+#include <new>
+#include <unistd.h>
 
 #include <utils/threads.h>
 #include <utils/String8.h>
 #include <hardware/hardware.h>
 #include <hardware/camera.h>
+#include <system/graphics.h>
 #include <camera/Camera.h>
 #include <camera/CameraParameters.h>
 
+#include "CameraOpLog.h"
+#include "CameraStats.h"
+#include "CameraWatchdog.h"
+#include "FixupArena.h"
+#include "PreviewConvert.h"
+#include "PreviewRing.h"
+
+#ifdef CAMERA_MOCK_STATIC
+/* linked into a host tool, the options come from the mock */
+#include "CameraMockVendor.h"
+#define property_get camera_mock_property_get
+#endif
+
+/* Trace spans go to the kernel trace_marker when the camera atrace tag is
+ * enabled at runtime ("atrace camera"), and are compiled out of user
+ * builds entirely. */
+#ifdef CAMERA_WRAPPER_TRACE
+#include <utils/Trace.h>
+#define WRAPPER_TRACE_CALL() ATRACE_CALL()
+#define WRAPPER_TRACE_NAME(name) ATRACE_NAME(name)
+#define WRAPPER_TRACE_BEGIN(name) ATRACE_BEGIN(name)
+#define WRAPPER_TRACE_END() ATRACE_END()
+#else
+#define WRAPPER_TRACE_CALL()
+#define WRAPPER_TRACE_NAME(name)
+#define WRAPPER_TRACE_BEGIN(name)
+#define WRAPPER_TRACE_END()
+#endif
+
+/* private send_command() id used to clear the wrapper statistics, it is
+ * handled here and never reaches the vendor HAL */
+#define CAMERA_CMD_WRAPPER_RESET_STATS 0x43570001
+
 static char KEY_SUPPORTED_ISO_MODES[] = "iso-values";
 static char KEY_ISO_MODE[] = "iso";
 
@@ -47,6 +89,7 @@ static char KEY_SONY_ISO_AVAIL_MODES[] = "sony-iso-values";
 static char KEY_SONY_ISO_MODE[] = "sony-iso";
 static char KEY_SONY_AE_MODE_VALUES[] = "sony-ae-mode-values";
 static char KEY_SONY_AE_MODE[] = "sony-ae-mode";
+static char KEY_ZSL[] = "zsl";
 
 // Sony parameter values
 static char VALUE_SONY_ON[] = "on";
@@ -54,8 +97,31 @@ static char VALUE_SONY_OFF[] = "off";
 static char VALUE_SONY_STILL_HDR[] = "on-still-hdr";
 static char VALUE_SONY_INTELLIGENT_ACTIVE[] = "on-intelligent-active";
 
-static android::Mutex gCameraWrapperLock;
+// Wrapper parameter names, handled here and never passed to the vendor
+static char KEY_WRAPPER_PREVIEW_CB_SIZE[] = "wrapper-preview-cb-size";
+static char KEY_WRAPPER_PREVIEW_CB_FORMAT[] = "wrapper-preview-cb-format";
+static char KEY_WRAPPER_PREVIEW_CB_FORMAT_VALUES[] = "wrapper-preview-cb-format-values";
+static char KEY_WRAPPER_PREVIEW_CB_INTERVAL[] = "wrapper-preview-cb-interval";
+static char KEY_WRAPPER_PREVIEW_CB_ROI[] = "wrapper-preview-cb-roi";
+static char KEY_WRAPPER_AUTO_HDR_RECOMMENDED[] = "wrapper-auto-hdr-recommended";
+
 static camera_module_t *gVendorModule = 0;
+static pthread_once_t gVendorModuleOnce = PTHREAD_ONCE_INIT;
+static volatile int32_t gVendorModuleLoaded = 0;
+static int gVendorModuleStatus = -ENODEV;
+
+/* snapshot of the vendor's static camera info, taken once when the vendor
+ * module is loaded and never modified afterwards */
+static int gNumCameras = 0;
+static int gCachedCameras = 0;
+static struct camera_info gCameraInfo[CAMERA_STATS_MAX_CAMERAS];
+static int gCameraInfoStatus[CAMERA_STATS_MAX_CAMERAS];
+
+/* Opening and closing a camera only serializes against the same camera, so
+ * switching between cameras does not wait on the other's vendor close.
+ * Ids without a slot of their own share the last lock. */
+static android::Mutex gCameraLocks[CAMERA_STATS_MAX_CAMERAS + 1];
+static struct wrapper_camera_device *gCameraDevices[CAMERA_STATS_MAX_CAMERAS];
 
 static int camera_device_open(const hw_module_t *module, const char *name,
         hw_device_t **device);
@@ -86,219 +152,3054 @@ camera_module_t HAL_MODULE_INFO_SYM = {
     .reserved = {0}, /* remove compilation warnings */
 };
 
-typedef struct wrapper_camera_device {
-    camera_device_t base;
-    int id;
-    camera_device_t *vendor;
-} wrapper_camera_device_t;
+#define MEMORY_REGISTRY_SIZE 64
+#define PREVIEW_CB_POOL_SIZE 4
+/* initial size of the fixup arenas, the vendor parameters flatten to
+ * around 6KB */
+#define FIXUP_ARENA_SIZE 8192
+#define CAPTURE_QUEUE_MAX 8
+#define CAPTURE_TIMEOUT_MS 5000
+/* a cancel_auto_focus followed this soon by auto_focus leaves the sweep
+ * running, and a sweep not done after the timeout is given up on */
+#define FOCUS_CANCEL_DEBOUNCE_MS 50
+#define FOCUS_SWEEP_TIMEOUT_MS 5000
+#define FOCUS_AREAS_MAX 256
+/* the vendor cycles through far fewer video buffers than this */
+#define RECORDING_SLOTS 32
+#define RECORDING_HOLD_WARN_MS 1000
+/* buffers released by the vendor are kept for reuse up to this many
+ * bytes, and for this long */
+#define MEMORY_POOL_MAX_FREE_BYTES (16 * 1024 * 1024)
+#define MEMORY_POOL_IDLE_MS 5000
+#define DISPATCH_RING_SIZE 8
+#define DISPATCH_MAX_FACES 16
+/* data callbacks the vendor waits for room in a full dispatch ring for,
+ * any other is dropped instead */
+#define DISPATCH_MSG_KEEP CAMERA_MSG_COMPRESSED_IMAGE
+/* op logs stop growing past this unless overridden */
+#define OPLOG_MAX_KB (16 * 1024)
+/* preview ring defaults, enough for 1080p NV21 */
+#define PREVIEW_RING_SLOTS 4
+#define PREVIEW_RING_FRAME_KB 3060
+/* values indexed per vendor list, longer lists are searched instead */
+#define CAPABILITY_MAX_VALUES 32
+#define CAPABILITY_SLOTS 64
+
+/* automatic HDR analyses every AUTO_HDR_FRAME_INTERVAL'th preview frame
+ * and changes its mind after AUTO_HDR_STREAK consecutive disagreeing
+ * frames; the clip ratios are in per mille */
+#define AUTO_HDR_FRAME_INTERVAL 10
+#define AUTO_HDR_ROW_STEP 4
+#define AUTO_HDR_STREAK 3
+#define AUTO_HDR_ENTER_DARK 100
+#define AUTO_HDR_ENTER_BRIGHT 30
+#define AUTO_HDR_EXIT_DARK 50
+#define AUTO_HDR_EXIT_BRIGHT 10
+
+#define CAPTURE_MSG_TYPES (CAMERA_MSG_SHUTTER | CAMERA_MSG_POSTVIEW_FRAME | \
+        CAMERA_MSG_RAW_IMAGE | CAMERA_MSG_RAW_IMAGE_NOTIFY | \
+        CAMERA_MSG_COMPRESSED_IMAGE)
+
+/* jobs run by the per-device worker thread */
+enum {
+    WORKER_JOB_SET_PARAMETERS = 1 << 0,
+    WORKER_JOB_TAKE_PICTURE = 1 << 1,
+    WORKER_JOB_AUTO_HDR = 1 << 2,
+    WORKER_JOB_FOCUS_CANCEL = 1 << 3,
+    WORKER_JOB_CAPTURE_TIMEOUT = 1 << 4,
+};
+
+enum {
+    AUTO_HDR_OFF,
+    /* only report the recommendation through the parameters */
+    AUTO_HDR_RECOMMEND,
+    /* also switch the vendor to still HDR while scene mode is auto */
+    AUTO_HDR_SWITCH,
+};
+
+/* vendor keys written by the parameter translation, checked against the
+ * value lists the vendor advertised before they are handed to it */
+enum {
+    CAPABILITY_ISO,
+    CAPABILITY_AE_MODE,
+    CAPABILITY_IMAGE_STABILISER,
+    CAPABILITY_VIDEO_STABILISER,
+    CAPABILITY_VIDEO_HDR,
+    CAPABILITY_COUNT
+};
+
+typedef struct capability_set {
+    /* the vendor's list as last seen, NULL while it has advertised none */
+    char *list;
+    /* the list split at the commas, the slots point into it */
+    char *values;
+    const char *slots[CAPABILITY_SLOTS];
+    uint32_t hashes[CAPABILITY_SLOTS];
+    bool indexed;
+    /* the vendor's value for the key when the list was read */
+    char *current;
+    int32_t corrections;
+} capability_set_t;
+
+typedef struct memory_registry_entry {
+    const camera_memory_t *mem;
+    size_t buf_size;
+} memory_registry_entry_t;
+
+typedef struct memory_pool memory_pool_t;
+
+/* what the vendor is handed in place of the service's camera_memory_t */
+typedef struct pooled_memory {
+    /* must stay first, data, size and handle are the service's */
+    camera_memory_t mem;
+    camera_memory_t *app;
+    memory_pool_t *pool;
+    size_t bufSize;
+    unsigned int numBufs;
+    /* passed to the service in a way that lets the app keep using it */
+    bool tainted;
+    nsecs_t released;
+    struct pooled_memory *next;
+} pooled_memory_t;
+
+/* Outlives the device while the vendor still holds pooled buffers. */
+struct memory_pool {
+    android::Mutex lock;
+    /* one per pooled buffer, free or not, and one for the device */
+    int refs;
+    bool closed;
+    pooled_memory_t *free;
+    size_t freeBytes;
+    size_t residentBytes;
+    int32_t hits;
+    int32_t misses;
+    int32_t discards;
+};
+
+typedef struct preview_cb {
+    /* requested through the wrapper-preview-cb-* parameters */
+    int width;
+    int height;
+    bool rgba;
+    int srcWidth;
+    int srcHeight;
+    bool srcNV21;
+    /* HAL_PIXEL_FORMAT_* of the preview, 0 if unknown */
+    int srcFormat;
+    /* deliver one frame in interval, and only the left,top,right,bottom
+     * rectangle of it when roiRight > roiLeft */
+    int interval;
+    int roiLeft;
+    int roiTop;
+    int roiRight;
+    int roiBottom;
+    /* preview frames seen and skipped while decimating */
+    int frame;
+    int32_t decimated;
+
+    /* only used from the vendor's preview callback thread */
+    int32_t cropped;
+    camera_memory_t *pool[PREVIEW_CB_POOL_SIZE];
+    size_t poolBufSize;
+    int poolNext;
+    uint8_t *scratch;
+    size_t scratchSize;
+} preview_cb_t;
+
+typedef struct capture_queue {
+    /* a take_picture is with the vendor and its JPEG has not arrived yet */
+    bool inFlight;
+    nsecs_t issued;
+    /* picture messages enabled by the service for the in-flight capture */
+    int32_t msgTypes;
+    /* the same for each queued request, oldest first */
+    int32_t pendingMsgTypes[CAPTURE_QUEUE_MAX];
+    int pendingHead;
+    int pending;
+    int maxPending;
+    int32_t queued;
+    int32_t drops;
+    int32_t timeouts;
+    /* queued requests failed because preview had stopped */
+    int32_t failed;
+    /* the service's last parameters turned zero shutter lag on; without
+     * it the vendor stops preview for a capture and cannot take another
+     * until the service restarts it */
+    bool zsl;
+} capture_queue_t;
+
+enum {
+    FOCUS_IDLE,
+    /* an auto_focus is with the vendor and its CAMERA_MSG_FOCUS has not
+     * arrived yet */
+    FOCUS_RUNNING,
+    /* the sweep is done and the lens stays locked until a cancel */
+    FOCUS_LOCKED,
+};
+
+typedef struct focus_tracker {
+    int state;
+    nsecs_t started;
+    /* a cancel_auto_focus held back in case auto_focus follows */
+    bool cancelPending;
+    nsecs_t cancelAt;
+    /* the focus parameters changed since the sweep was started */
+    bool stale;
+    char focusMode[PROPERTY_VALUE_MAX];
+    char focusAreas[FOCUS_AREAS_MAX];
+    int32_t requests;
+    int32_t sweeps;
+    int32_t coalesced;
+    int32_t merged;
+    int32_t cancels;
+    int32_t cancelsDropped;
+    int32_t cancelsSent;
+    int32_t swallowed;
+} focus_tracker_t;
+
+typedef struct recording_slot {
+    const void *volatile handle;
+    volatile int64_t delivered;
+    volatile int32_t warned;
+} recording_slot_t;
+
+/* recording frames handed to the service and not released yet, updated
+ * without locks from the vendor's callback thread and the encoder's */
+typedef struct recording_tracker {
+    recording_slot_t slots[RECORDING_SLOTS];
+    volatile int32_t inFlight;
+    volatile int32_t maxInFlight;
+    volatile int32_t delivered;
+    volatile int32_t untracked;
+    volatile int32_t unknownReleases;
+    volatile int32_t neverReturned;
+    camera_histogram_t hold;
+} recording_tracker_t;
+
+/* start times of the requests whose callbacks are being timed, zero when
+ * none is outstanding */
+typedef struct latency_tracker {
+    nsecs_t picture;
+    /* capture callbacks already timed for the current picture */
+    int32_t pictureSeen;
+    nsecs_t focus;
+    nsecs_t preview;
+    nsecs_t lastFrame;
+    nsecs_t lastInterval;
+} latency_tracker_t;
+
+/* Handed to the vendor in place of the service's preview window when
+ * persist.camera.wrapper.window_stats is set; every op forwards to the
+ * service's window. */
+typedef struct preview_window_shim {
+    /* must stay first, the vendor passes it back to every op */
+    preview_stream_ops_t ops;
+    int id;
+    preview_stream_ops_t *volatile window;
+    /* buffers dequeued by the vendor and not yet enqueued or cancelled */
+    volatile int32_t held;
+    volatile int32_t maxHeld;
+    volatile int32_t frames;
+    volatile int32_t dequeueFails;
+    volatile int64_t firstFrame;
+    volatile int64_t lastFrame;
+} preview_window_shim_t;
+
+typedef struct dispatch_slot {
+    int32_t msgType;
+    /* copy of the payload, allocated from the service */
+    camera_memory_t *mem;
+    bool hasMetadata;
+    camera_frame_metadata_t metadata;
+    camera_face_t faces[DISPATCH_MAX_FACES];
+} dispatch_slot_t;
+
+/* data callbacks waiting to be delivered by the dispatch thread */
+typedef struct callback_dispatch {
+    pthread_t thread;
+    bool started;
+    bool exit;
+    dispatch_slot_t slots[DISPATCH_RING_SIZE];
+    int head;
+    int count;
+    int maxCount;
+    int32_t queued;
+    /* queued preview frames replaced by a newer one */
+    int32_t coalesced;
+    int32_t dropped;
+    int32_t blocked;
+    int32_t direct;
+} callback_dispatch_t;
+
+typedef struct auto_hdr {
+    int mode;
+    /* only used from the vendor's preview callback thread */
+    int frame;
+    int streak;
+    volatile int32_t recommended;
+    /* still HDR was set on the vendor for the recommendation, under
+     * paramsLock */
+    volatile int32_t engaged;
+    int32_t samples;
+    int32_t changes;
+    int32_t dark;
+    int32_t bright;
+} auto_hdr_t;
+
+typedef struct wrapper_camera_device {
+    camera_device_t base;
+    int id;
+    camera_device_t *vendor;
+
+    /* callbacks registered by the camera service; the vendor is handed the
+     * wrapper's own, which forward to these */
+    camera_notify_callback notify_cb;
+    camera_data_callback data_cb;
+    camera_data_timestamp_callback data_cb_timestamp;
+    camera_request_memory get_memory;
+    void *user;
+
+    /* per-buffer size of the memory allocated by the vendor */
+    android::Mutex memoryLock;
+    memory_registry_entry_t memory[MEMORY_REGISTRY_SIZE];
+    int memoryNext;
+
+    /* with persist.camera.wrapper.memory_pool, anonymous memory requested
+     * by the vendor is recycled instead of going back to the service */
+    memory_pool_t *memoryPool;
+
+    android::Mutex previewCbLock;
+    preview_cb_t previewCb;
+
+    /* worker thread for vendor calls deferred off the caller's thread */
+    pthread_t worker;
+    bool workerStarted;
+    bool workerExit;
+    uint32_t workerJobs;
+    /* jobs to add to workerJobs once workerWakeAt has passed */
+    uint32_t workerDelayedJobs;
+    nsecs_t workerWakeAt;
+    android::Mutex workerLock;
+    android::Condition workerCond;
+    /* The service makes its ops one at a time, but not with the worker's
+     * vendor calls, so both hold this around them; the vendor never sees
+     * two of them at once. The msg type ops and release_recording_frame
+     * go without: the service makes them from its callback threads too,
+     * which a vendor op holding this may be waiting on. */
+    android::Mutex vendorLock;
+
+    android::Mutex captureLock;
+    capture_queue_t capture;
+
+    /* with persist.camera.wrapper.af_coalesce, redundant auto_focus and
+     * cancel_auto_focus calls are kept from the vendor; focusCallLock is
+     * held across the vendor calls to keep them in order, focusLock only
+     * guards the state */
+    bool focusCoalesce;
+    android::Mutex focusCallLock;
+    android::Mutex focusLock;
+    focus_tracker_t focus;
+
+    /* held across parameter translation and the vendor set_parameters,
+     * setArena backs the translated parameters until the vendor returns */
+    android::Mutex paramsLock;
+    fixup_arena_t setArena;
+    android::Mutex getArenaLock;
+    fixup_arena_t getArena;
+    /* with persist.camera.wrapper.async_params, set_parameters only stores
+     * the newest parameters here and the worker applies them */
+    bool asyncParams;
+    android::Mutex pendingLock;
+    char *pendingParams;
+    uint32_t pendingGen;
+    int32_t paramsSubmitted;
+    int32_t paramsApplied;
+    int32_t paramsFailed;
+
+    recording_tracker_t recording;
+
+    android::Mutex latencyLock;
+    latency_tracker_t latency;
+
+    bool windowStats;
+    preview_window_shim_t windowShim;
+
+    /* with persist.camera.wrapper.dispatch, data callbacks are copied and
+     * delivered to the service from a thread of their own */
+    bool dispatchEnabled;
+    android::Mutex dispatchLock;
+    android::Condition dispatchCond;
+    android::Condition dispatchSpaceCond;
+    callback_dispatch_t dispatch;
+
+    /* message types enabled by the service, the vendor may have more
+     * enabled for the wrapper's own use */
+    volatile int32_t appMsgTypes;
+    auto_hdr_t autoHdr;
+    /* last parameters set by the service, under paramsLock, kept to
+     * reapply them when automatic HDR changes its mind */
+    char *lastParams;
+
+    /* with persist.camera.wrapper.oplog, every op is logged to
+     * <value>.<camera id> for the camera_oplog tool */
+    camera_oplog_t *oplog;
+
+    /* with persist.camera.wrapper.preview_ring, preview frames are also
+     * written to the ring file <value>.<camera id> */
+    camera_preview_ring_t *previewRing;
+
+    /* with persist.camera.wrapper.watchdog, vendor calls that do not
+     * return are reported with the stuck thread's stack */
+    camera_watchdog_t *watchdog;
+
+    /* with persist.camera.wrapper.passthrough, the per-frame ops skip the
+     * wrapper's bookkeeping, see passthrough_install() */
+    bool passthrough;
+
+    /* built from the vendor parameters seen by get_parameters */
+    android::Mutex capsLock;
+    capability_set_t caps[CAPABILITY_COUNT];
+} wrapper_camera_device_t;
+
+#define VENDOR_CALL(device, func, ...) ({ \
+    wrapper_camera_device_t *__wrapper_dev = (wrapper_camera_device_t*) device; \
+    WRAPPER_TRACE_NAME("vendor:" #func); \
+    CameraStatsTimer __timer(camera_stats_vendor(__wrapper_dev->id, \
+            CAMERA_OP_##func), \
+            __wrapper_dev->oplog ? camera_oplog_vendor_ns() : NULL); \
+    CameraWatchdogScope __watch(__wrapper_dev->watchdog, CAMERA_OP_##func, \
+            __timer.start()); \
+    __wrapper_dev->vendor->ops->func(__wrapper_dev->vendor, ##__VA_ARGS__); \
+})
+
+#define OPLOG_SCOPE(device, op, ...) \
+    CameraOpLogScope __oplog(((wrapper_camera_device_t*)(device))->oplog, \
+            CAMERA_OP_##op, ##__VA_ARGS__)
+
+#define CAMERA_ID(device) (((wrapper_camera_device_t *)(device))->id)
+
+static android::Mutex &camera_lock(int camera_id)
+{
+    if (camera_id < 0 || camera_id >= CAMERA_STATS_MAX_CAMERAS)
+        return gCameraLocks[CAMERA_STATS_MAX_CAMERAS];
+    return gCameraLocks[camera_id];
+}
+
+static bool property_get_bool(const char *key)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get(key, value, "0");
+    return strcmp(value, "1") == 0 || strcmp(value, "true") == 0;
+}
+
+static int32_t property_get_int32(const char *key, int32_t def)
+{
+    char value[PROPERTY_VALUE_MAX];
+    char *end;
+    long ret;
+
+    if (property_get(key, value, NULL) <= 0)
+        return def;
+    ret = strtol(value, &end, 0);
+    return *end == '\0' ? (int32_t)ret : def;
+}
+
+static int auto_hdr_mode(void)
+{
+    char value[PROPERTY_VALUE_MAX];
+
+    property_get("persist.camera.wrapper.auto_hdr", value, "off");
+    if (strcmp(value, "recommend") == 0)
+        return AUTO_HDR_RECOMMEND;
+    if (strcmp(value, "switch") == 0)
+        return AUTO_HDR_SWITCH;
+    return AUTO_HDR_OFF;
+}
+
+/* A log that cannot be created only costs the recording, the camera still
+ * opens */
+static void oplog_open(wrapper_camera_device_t *dev)
+{
+    char value[PROPERTY_VALUE_MAX];
+    char path[PROPERTY_VALUE_MAX + 16];
+    int32_t maxKb;
+
+    if (property_get("persist.camera.wrapper.oplog", value, NULL) <= 0)
+        return;
+
+    maxKb = property_get_int32("persist.camera.wrapper.oplog_max_kb",
+            OPLOG_MAX_KB);
+    if (maxKb <= 0)
+        maxKb = OPLOG_MAX_KB;
+    snprintf(path, sizeof(path), "%s.%d", value, dev->id);
+    dev->oplog = camera_oplog_open(path, dev->id, (size_t)maxKb * 1024);
+}
+
+/* As for the op log, a ring that cannot be created does not fail the
+ * open */
+static void preview_ring_open(wrapper_camera_device_t *dev)
+{
+    char value[PROPERTY_VALUE_MAX];
+    char path[PROPERTY_VALUE_MAX + 16];
+    int32_t slots, frameKb;
+
+    if (property_get("persist.camera.wrapper.preview_ring", value, NULL) <= 0)
+        return;
+
+    slots = property_get_int32("persist.camera.wrapper.preview_ring_slots",
+            PREVIEW_RING_SLOTS);
+    frameKb = property_get_int32(
+            "persist.camera.wrapper.preview_ring_frame_kb",
+            PREVIEW_RING_FRAME_KB);
+    if (frameKb <= 0)
+        frameKb = PREVIEW_RING_FRAME_KB;
+    snprintf(path, sizeof(path), "%s.%d", value, dev->id);
+    dev->previewRing = camera_preview_ring_open(path, dev->id,
+            slots > 0 ? slots : 0, (size_t)frameKb * 1024);
+}
+
+/* On debuggable builds camera.wrapper.vendor may name another camera
+ * module instance to wrap instead of the Sony HAL, e.g. "mock" for the
+ * camera.mock module of CameraMockVendor.cpp, so the wrapper overhead
+ * reported by camera_dump can be measured in isolation. */
+static void get_vendor_module_inst(char *inst)
+{
+    char debuggable[PROPERTY_VALUE_MAX];
+
+    property_get("ro.debuggable", debuggable, "0");
+    if (strcmp(debuggable, "1") != 0 ||
+            property_get("camera.wrapper.vendor", inst, "vendor") <= 0)
+        strcpy(inst, "vendor");
+}
+
+static void load_vendor_module(void)
+{
+    camera_module_stats_t *stats = camera_stats_module();
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    char inst[PROPERTY_VALUE_MAX];
+
+    get_vendor_module_inst(inst);
+    if (strcmp(inst, "vendor") != 0)
+        ALOGW("wrapping camera.%s instead of the vendor camera module", inst);
+
+    gVendorModuleStatus = hw_get_module_by_class("camera", inst,
+            (const hw_module_t**)&gVendorModule);
+    if (gVendorModuleStatus) {
+        ALOGE("failed to open vendor camera module");
+    } else {
+        gNumCameras = gVendorModule->get_number_of_cameras();
+        gCachedCameras = gNumCameras < CAMERA_STATS_MAX_CAMERAS ?
+                gNumCameras : CAMERA_STATS_MAX_CAMERAS;
+        for (int i = 0; i < gCachedCameras; i++)
+            gCameraInfoStatus[i] = gVendorModule->get_camera_info(i,
+                    &gCameraInfo[i]);
+    }
+
+    stats->load_ns = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    android_atomic_release_store(1, &gVendorModuleLoaded);
+}
+
+static int check_vendor_module()
+{
+    nsecs_t start;
+    ALOGV("%s", __FUNCTION__);
+
+    if (android_atomic_acquire_load(&gVendorModuleLoaded))
+        return gVendorModuleStatus;
+
+    start = systemTime(SYSTEM_TIME_MONOTONIC);
+    pthread_once(&gVendorModuleOnce, load_vendor_module);
+    camera_histogram_record(&camera_stats_module()->load_wait,
+            systemTime(SYSTEM_TIME_MONOTONIC) - start);
+
+    return gVendorModuleStatus;
+}
+
+static void *preload_vendor_module(void *)
+{
+    android_atomic_release_store(1, &camera_stats_module()->preloaded);
+    pthread_once(&gVendorModuleOnce, load_vendor_module);
+    return NULL;
+}
+
+/* With persist.camera.wrapper.preload set, the vendor module dlopen and its
+ * static initialization run on a background thread as soon as the wrapper
+ * itself is loaded, instead of on the first camera module call. Callers
+ * then only block on the once-latch if the load is still in progress. */
+__attribute__((constructor)) static void camera_wrapper_preload(void)
+{
+    pthread_attr_t attr;
+    pthread_t thread;
+
+    if (!property_get_bool("persist.camera.wrapper.preload"))
+        return;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    if (pthread_create(&thread, &attr, preload_vendor_module, NULL))
+        ALOGE("failed to start vendor camera module preload");
+    pthread_attr_destroy(&attr);
+}
+
+/* whether a comma separated value list holds the given value */
+static bool value_list_contains(const char *list, const char *value)
+{
+    size_t len = strlen(value);
+
+    while (list) {
+        if (strncmp(list, value, len) == 0 &&
+                (list[len] == ',' || list[len] == '\0'))
+            return true;
+        list = strchr(list, ',');
+        if (list)
+            list++;
+    }
+    return false;
+}
+
+void camera_fixup_capability(android::CameraParameters *params,
+        fixup_arena_t *arena)
+{
+    ALOGV("%s", __FUNCTION__);
+
+    if (params->get(KEY_SONY_IMAGE_STABILISER_VALUES)) {
+        const char *supportedIsModes = params->get(KEY_SONY_IMAGE_STABILISER_VALUES);
+
+        if (strstr(supportedIsModes, VALUE_SONY_STILL_HDR) != NULL) {
+            const char *supportedSceneModes = params->get(android::CameraParameters::KEY_SUPPORTED_SCENE_MODES);
+            char *sceneModes;
+
+            if (!supportedSceneModes)
+                sceneModes = fixup_arena_strdup(arena, "hdr");
+            else if (!value_list_contains(supportedSceneModes, "hdr"))
+                sceneModes = fixup_arena_printf(arena, "%s,hdr",
+                        supportedSceneModes);
+            else
+                sceneModes = NULL;
+            if (sceneModes)
+                params->set(android::CameraParameters::KEY_SUPPORTED_SCENE_MODES, sceneModes);
+        }
+    }
+}
+
+/* Sony lists bare ISO values, the service expects them prefixed with "ISO"
+ * and followed by auto, e.g. "100,200" becomes "ISO100,ISO200,auto". */
+static char *camera_fixup_iso_list(fixup_arena_t *arena, const char *isoModeList)
+{
+    size_t len = strlen(isoModeList);
+    size_t values = 1;
+    char *buffer, *pos;
+
+    for (size_t i = 0; i < len; i++) {
+        if (isoModeList[i] == ',')
+            values++;
+    }
+
+    buffer = (char*)fixup_arena_alloc(arena, len + values * 3 + sizeof(",auto"));
+    if (!buffer)
+        return NULL;
+
+    pos = buffer;
+    memcpy(pos, "ISO", 3);
+    pos += 3;
+    for (size_t i = 0; i < len; i++) {
+        *pos++ = isoModeList[i];
+        if (isoModeList[i] == ',') {
+            memcpy(pos, "ISO", 3);
+            pos += 3;
+        }
+    }
+    memcpy(pos, ",auto", sizeof(",auto"));
+    return buffer;
+}
+
+static const struct {
+    const char *key;
+    const char *values;
+} capability_keys[CAPABILITY_COUNT] = {
+    { KEY_SONY_ISO_MODE, KEY_SONY_ISO_AVAIL_MODES },
+    { KEY_SONY_AE_MODE, KEY_SONY_AE_MODE_VALUES },
+    { KEY_SONY_IMAGE_STABILISER, KEY_SONY_IMAGE_STABILISER_VALUES },
+    { KEY_SONY_VIDEO_STABILISER, KEY_SONY_VIDEO_STABILISER_VALUES },
+    { KEY_SONY_VIDEO_HDR, KEY_SONY_VIDEO_HDR_VALUES },
+};
+
+/* FNV-1a */
+static uint32_t capability_hash(const char *value)
+{
+    uint32_t hash = 2166136261u;
+
+    while (*value)
+        hash = (hash ^ (uint8_t)*value++) * 16777619u;
+    return hash;
+}
+
+static void capability_set_release(capability_set_t *set)
+{
+    free(set->list);
+    free(set->values);
+    free(set->current);
+    memset(set->slots, 0, sizeof(set->slots));
+    set->list = set->values = set->current = NULL;
+    set->indexed = false;
+}
+
+/* Hashes the values of a vendor list into an open addressed table so a
+ * translated value is checked without walking the list. */
+static void capability_set_build(capability_set_t *set, const char *list)
+{
+    int count = 0;
+    char *value;
+
+    capability_set_release(set);
+    set->list = strdup(list);
+    set->values = strdup(list);
+    if (!set->list || !set->values) {
+        capability_set_release(set);
+        return;
+    }
+
+    value = set->values;
+    while (value) {
+        char *next = strchr(value, ',');
+        uint32_t hash;
+        int slot;
+
+        if (next)
+            *next++ = '\0';
+        if (++count > CAPABILITY_MAX_VALUES) {
+            memset(set->slots, 0, sizeof(set->slots));
+            return;
+        }
+
+        hash = capability_hash(value);
+        slot = hash & (CAPABILITY_SLOTS - 1);
+        while (set->slots[slot])
+            slot = (slot + 1) & (CAPABILITY_SLOTS - 1);
+        set->slots[slot] = value;
+        set->hashes[slot] = hash;
+        value = next;
+    }
+    set->indexed = true;
+}
+
+static bool capability_set_contains(const capability_set_t *set,
+        const char *value)
+{
+    uint32_t hash;
+    int slot;
+
+    if (!set->indexed)
+        return value_list_contains(set->list, value);
+
+    hash = capability_hash(value);
+    for (slot = hash & (CAPABILITY_SLOTS - 1); set->slots[slot];
+            slot = (slot + 1) & (CAPABILITY_SLOTS - 1)) {
+        if (set->hashes[slot] == hash && strcmp(set->slots[slot], value) == 0)
+            return true;
+    }
+    return false;
+}
+
+/* Takes the value lists and current values from parameters the vendor
+ * returned; lists are only reindexed when they change. */
+static void capability_index_update(wrapper_camera_device_t *dev,
+        const android::CameraParameters &params)
+{
+    android::Mutex::Autolock lock(dev->capsLock);
+
+    for (int i = 0; i < CAPABILITY_COUNT; i++) {
+        capability_set_t *set = &dev->caps[i];
+        const char *list = params.get(capability_keys[i].values);
+        const char *current = params.get(capability_keys[i].key);
+
+        if (!list) {
+            capability_set_release(set);
+            continue;
+        }
+        if (!set->list || strcmp(set->list, list) != 0)
+            capability_set_build(set, list);
+        if (!set->list)
+            continue;
+
+        if (!current) {
+            free(set->current);
+            set->current = NULL;
+        } else if (!set->current || strcmp(set->current, current) != 0) {
+            free(set->current);
+            set->current = strdup(current);
+        }
+    }
+}
+
+/* Values the translation produced that the vendor does not advertise
+ * would only make it fail set_parameters after it has done the costly
+ * part of the work; such keys are set back to the vendor's current value,
+ * or left out for the vendor to keep it. */
+static void capability_index_check(wrapper_camera_device_t *dev,
+        android::CameraParameters *params)
+{
+    android::Mutex::Autolock lock(dev->capsLock);
+
+    for (int i = 0; i < CAPABILITY_COUNT; i++) {
+        capability_set_t *set = &dev->caps[i];
+        const char *value;
+
+        if (!set->list)
+            continue;
+        value = params->get(capability_keys[i].key);
+        if (!value || capability_set_contains(set, value))
+            continue;
+
+        ALOGV("%s: %s=%s is not supported", __FUNCTION__,
+                capability_keys[i].key, value);
+        android_atomic_inc(&set->corrections);
+        if (set->current && capability_set_contains(set, set->current))
+            params->set(capability_keys[i].key, set->current);
+        else
+            params->remove(capability_keys[i].key);
+    }
+}
+
+static void capability_index_release(wrapper_camera_device_t *dev)
+{
+    for (int i = 0; i < CAPABILITY_COUNT; i++)
+        capability_set_release(&dev->caps[i]);
+}
+
+static void capability_index_dump(wrapper_camera_device_t *dev,
+        android::String8 &out)
+{
+    android::Mutex::Autolock lock(dev->capsLock);
+    bool any = false;
+
+    for (int i = 0; i < CAPABILITY_COUNT; i++) {
+        if (!dev->caps[i].corrections)
+            continue;
+        if (!any)
+            out.append("   Unsupported values corrected:");
+        out.appendFormat(" %s=%d", capability_keys[i].key,
+                dev->caps[i].corrections);
+        any = true;
+    }
+    if (any)
+        out.append("\n");
+}
+
+static void focus_params(wrapper_camera_device_t *dev,
+        const android::CameraParameters &params);
+static void capture_params(wrapper_camera_device_t *dev,
+        const android::CameraParameters &params);
+static void preview_cb_fixup_getparams(wrapper_camera_device_t *dev,
+        android::CameraParameters *params);
+static void preview_cb_fixup_setparams(wrapper_camera_device_t *dev,
+        android::CameraParameters *params);
+
+static char *camera_fixup_getparams(wrapper_camera_device_t *dev,
+        const char *settings)
+{
+    CameraStatsTimer timer(camera_stats_fixup(dev->id, CAMERA_FIXUP_GETPARAMS));
+    WRAPPER_TRACE_CALL();
+    android::Mutex::Autolock lock(dev->getArenaLock);
+    fixup_arena_t *arena = &dev->getArena;
+    android::CameraParameters params;
+
+    fixup_arena_reset(arena);
+
+    WRAPPER_TRACE_BEGIN("unflatten");
+    params.unflatten(android::String8(settings));
+    WRAPPER_TRACE_END();
+
+#if !LOG_NDEBUG
+    ALOGV("%s: original parameters:", __FUNCTION__);
+    params.dump();
+#endif
+
+    capability_index_update(dev, params);
+
+    WRAPPER_TRACE_BEGIN("translate");
+
+    camera_fixup_capability(&params, arena);
+
+    if (params.get(KEY_SONY_ISO_AVAIL_MODES)) {
+        // fixup the iso mode list with those that are in the sony list
+        char *isoModes = camera_fixup_iso_list(arena,
+                params.get(KEY_SONY_ISO_AVAIL_MODES));
+        if (isoModes)
+            params.set(KEY_SUPPORTED_ISO_MODES, isoModes);
+    }
+
+    if (params.get(KEY_SONY_IMAGE_STABILISER)) {
+        const char *sony_is = params.get(KEY_SONY_IMAGE_STABILISER);
+        if (strcmp(sony_is, VALUE_SONY_STILL_HDR) == 0 &&
+                !dev->autoHdr.engaged) {
+            // Scene mode is HDR then (see fixup_setparams)
+            params.set(android::CameraParameters::KEY_SCENE_MODE, "hdr");
+        }
+    }
+
+    if (params.get(KEY_SONY_VIDEO_HDR) && params.get(KEY_SONY_VIDEO_HDR_VALUES)) {
+        params.set("video-hdr-values", params.get(KEY_SONY_VIDEO_HDR_VALUES));
+        params.set("video-hdr", params.get(KEY_SONY_VIDEO_HDR));
+    }
+
+    if (params.get(KEY_SONY_ISO_MODE)) {
+        if (params.get(KEY_SONY_AE_MODE_VALUES)) {
+            const char *aeMode = params.get(KEY_SONY_AE_MODE);
+            if (!aeMode)
+                aeMode = "";
+            if (strcmp(aeMode, "auto") == 0 ) {
+                params.set(KEY_ISO_MODE, "auto");
+                params.set("shutter-speed","auto");
+            } else if (strcmp(aeMode, "iso-prio") == 0) {
+                char *isoVal = fixup_arena_printf(arena, "ISO%s",
+                        params.get(KEY_SONY_ISO_MODE));
+                if (isoVal)
+                    params.set(KEY_ISO_MODE,isoVal);
+                params.set("shutter-speed","auto");
+            } else if (strcmp(aeMode, "shutter-prio") == 0) {
+                params.set(KEY_ISO_MODE, "auto");
+                const char *shutterSpeed = params.get("sony-shutter-speed");
+                if (shutterSpeed) {
+                    params.set("shutter-speed",shutterSpeed);
+                }
+            } else if (strcmp(aeMode, "manual") == 0) {
+                const char *shutterSpeed = params.get("sony-shutter-speed");
+                if (shutterSpeed) {
+                    params.set("shutter-speed",shutterSpeed);
+                }
+                char *isoVal = fixup_arena_printf(arena, "ISO%s",
+                        params.get(KEY_SONY_ISO_MODE));
+                if (isoVal)
+                    params.set(KEY_ISO_MODE,isoVal);
+            } else {
+                params.set(KEY_ISO_MODE, "auto");
+                params.set("shutter-speed","auto");
+            }
+        }
+    }
+
+    preview_cb_fixup_getparams(dev, &params);
+    if (dev->autoHdr.mode != AUTO_HDR_OFF)
+        params.set(KEY_WRAPPER_AUTO_HDR_RECOMMENDED,
+                dev->autoHdr.recommended ? "true" : "false");
+
+    WRAPPER_TRACE_END();
+
+#if !LOG_NDEBUG
+    ALOGV("%s: fixed parameters:", __FUNCTION__);
+    params.dump();
+#endif
+
+    WRAPPER_TRACE_BEGIN("flatten");
+    android::String8 strParams = params.flatten();
+    char *ret = strdup(strParams.string());
+    WRAPPER_TRACE_END();
+
+    return ret;
+}
+
+/* Translates parameters set by the service for the vendor. Must be called
+ * with paramsLock held; the result lives in setArena until the next call. */
+static char *camera_fixup_setparams(wrapper_camera_device_t *dev,
+        const char *settings)
+{
+    CameraStatsTimer timer(camera_stats_fixup(dev->id, CAMERA_FIXUP_SETPARAMS));
+    WRAPPER_TRACE_CALL();
+    fixup_arena_t *arena = &dev->setArena;
+    android::CameraParameters params;
+
+    fixup_arena_reset(arena);
+
+    WRAPPER_TRACE_BEGIN("unflatten");
+    params.unflatten(android::String8(settings));
+    WRAPPER_TRACE_END();
+
+#if !LOG_NDEBUG
+    ALOGV("%s: original parameters:", __FUNCTION__);
+    params.dump();
+#endif
+
+    focus_params(dev, params);
+    capture_params(dev, params);
+
+    WRAPPER_TRACE_BEGIN("translate");
+
+    const char *shutterSpeed = params.get("shutter-speed");
+    if (shutterSpeed) {
+        if (strcmp(shutterSpeed, "auto") != 0) {
+            params.set("sony-shutter-speed", shutterSpeed);
+            params.set(KEY_SONY_AE_MODE, "shutter-prio");
+        } else {
+            const char *aeModes = params.get(KEY_SONY_AE_MODE_VALUES);
+            if (aeModes && strstr(aeModes, "auto") != NULL) {
+                params.set(KEY_SONY_AE_MODE, "auto");
+            }
+        }
+    }
+
+    if (params.get(KEY_ISO_MODE)) {
+        const char *isoMode = params.get(KEY_ISO_MODE);
+        if (strcmp(isoMode, "auto") != 0) {
+            // values are the ones advertised by getparams, "ISO" prefixed
+            params.set(KEY_SONY_ISO_MODE,
+                    strncmp(isoMode, "ISO", 3) == 0 ? isoMode + 3 : isoMode);
+        }
+        if (params.get(KEY_SONY_AE_MODE_VALUES)) {
+            const char *aeModes = params.get(KEY_SONY_AE_MODE_VALUES);
+            const char *aeMode = params.get(KEY_SONY_AE_MODE);
+            if (!aeMode)
+                aeMode = "";
+            if (strcmp(isoMode, "auto") == 0) {
+                if ((strstr(aeModes, "auto") != NULL) &&
+                    (strcmp(aeMode, "shutter-prio") != 0)) {
+                    params.set(KEY_SONY_AE_MODE, "auto");
+                }
+            } else {
+                if (strstr(aeModes, "iso-prio") != NULL) {
+                    if (strcmp(aeMode, "shutter-prio") == 0) {
+                        params.set(KEY_SONY_AE_MODE, "manual");
+                    } else {
+                        params.set(KEY_SONY_AE_MODE, "iso-prio");
+                    }
+                }
+            }
+        }
+    }
+
+    if (params.get(android::CameraParameters::KEY_SCENE_MODE)) {
+        const char *sceneMode = params.get(android::CameraParameters::KEY_SCENE_MODE);
+        dev->autoHdr.engaged = 0;
+        if (strcmp(sceneMode, "hdr") == 0) {
+            params.set(KEY_SONY_IMAGE_STABILISER, VALUE_SONY_STILL_HDR);
+            params.set(android::CameraParameters::KEY_SCENE_MODE, android::CameraParameters::SCENE_MODE_AUTO);
+        } else if (dev->autoHdr.mode == AUTO_HDR_SWITCH &&
+                dev->autoHdr.recommended &&
+                strcmp(sceneMode, android::CameraParameters::SCENE_MODE_AUTO) == 0 &&
+                params.get(KEY_SONY_IMAGE_STABILISER_VALUES) &&
+                strstr(params.get(KEY_SONY_IMAGE_STABILISER_VALUES), VALUE_SONY_STILL_HDR)) {
+            params.set(KEY_SONY_IMAGE_STABILISER, VALUE_SONY_STILL_HDR);
+            dev->autoHdr.engaged = 1;
+        } else {
+            params.set(KEY_SONY_IMAGE_STABILISER, VALUE_SONY_ON);
+        }
+    }
+
+    if (params.get(KEY_SONY_VIDEO_HDR) && params.get("video-hdr")) {
+        //params.set("video-hdr-values", params.get(KEY_SONY_VIDEO_HDR_VALUES));
+        params.set(KEY_SONY_VIDEO_HDR, params.get("video-hdr"));
+    }
+
+    if (params.get(android::CameraParameters::KEY_RECORDING_HINT)) {
+        if (strcmp(params.get(android::CameraParameters::KEY_RECORDING_HINT), android::CameraParameters::TRUE) == 0) {
+            if (params.get(KEY_SONY_VIDEO_STABILISER_VALUES) && (strstr(params.get(KEY_SONY_VIDEO_STABILISER_VALUES), VALUE_SONY_INTELLIGENT_ACTIVE) != NULL) ) {
+                params.set(KEY_SONY_VIDEO_STABILISER, VALUE_SONY_INTELLIGENT_ACTIVE);
+            } else {
+                params.set(KEY_SONY_VIDEO_STABILISER, VALUE_SONY_ON);
+            }
+            params.set(KEY_SONY_IMAGE_STABILISER, VALUE_SONY_OFF);
+            dev->autoHdr.engaged = 0;
+        }
+    }
+
+    preview_cb_fixup_setparams(dev, &params);
+    params.remove(KEY_WRAPPER_AUTO_HDR_RECOMMENDED);
+    capability_index_check(dev, &params);
+
+    WRAPPER_TRACE_END();
+
+#if !LOG_NDEBUG
+    ALOGV("%s: fixed parameters:", __FUNCTION__);
+    params.dump();
+#endif
+
+    WRAPPER_TRACE_BEGIN("flatten");
+    android::String8 strParams = params.flatten();
+    char *ret = fixup_arena_strdup(arena, strParams.string());
+    WRAPPER_TRACE_END();
+
+    return ret;
+}
+
+/*******************************************************************
+ * callbacks interposed between the vendor and the camera service
+ *******************************************************************/
+
+static void memory_registry_add(wrapper_camera_device_t *dev,
+        const camera_memory_t *mem, size_t buf_size)
+{
+    android::Mutex::Autolock lock(dev->memoryLock);
+    int slot = dev->memoryNext;
+
+    for (int i = 0; i < MEMORY_REGISTRY_SIZE; i++) {
+        if (dev->memory[i].mem == mem) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot == dev->memoryNext)
+        dev->memoryNext = (slot + 1) % MEMORY_REGISTRY_SIZE;
+
+    dev->memory[slot].mem = mem;
+    dev->memory[slot].buf_size = buf_size;
+}
+
+/* size of each buffer in memory allocated by the vendor, 0 if unknown */
+static size_t memory_registry_buf_size(wrapper_camera_device_t *dev,
+        const camera_memory_t *mem)
+{
+    android::Mutex::Autolock lock(dev->memoryLock);
+
+    for (int i = 0; i < MEMORY_REGISTRY_SIZE; i++) {
+        if (dev->memory[i].mem == mem)
+            return dev->memory[i].buf_size;
+    }
+    return 0;
+}
+
+static void memory_pool_release(camera_memory_t *mem)
+{
+    pooled_memory_t *entry = (pooled_memory_t *)mem;
+    memory_pool_t *pool = entry->pool;
+    size_t size = entry->app->size;
+    bool destroy;
+
+    {
+        android::Mutex::Autolock lock(pool->lock);
+
+        if (!pool->closed && !entry->tainted &&
+                pool->freeBytes + size <= MEMORY_POOL_MAX_FREE_BYTES) {
+            entry->released = systemTime(SYSTEM_TIME_MONOTONIC);
+            entry->next = pool->free;
+            pool->free = entry;
+            pool->freeBytes += size;
+            return;
+        }
+
+        pool->residentBytes -= size;
+        pool->discards++;
+        destroy = --pool->refs == 0;
+    }
+
+    entry->app->release(entry->app);
+    free(entry);
+    if (destroy)
+        delete pool;
+}
+
+/* Called with the pool lock held, unlinks buffers unused for too long. */
+static pooled_memory_t *memory_pool_expire(memory_pool_t *pool, nsecs_t now)
+{
+    pooled_memory_t *expired = NULL;
+    pooled_memory_t **link = &pool->free;
+
+    while (*link) {
+        pooled_memory_t *entry = *link;
+
+        if (now - entry->released < ms2ns(MEMORY_POOL_IDLE_MS)) {
+            link = &entry->next;
+            continue;
+        }
+        *link = entry->next;
+        pool->freeBytes -= entry->app->size;
+        pool->residentBytes -= entry->app->size;
+        pool->refs--;
+        entry->next = expired;
+        expired = entry;
+    }
+    return expired;
+}
+
+static void memory_pool_free_list(pooled_memory_t *entry)
+{
+    while (entry) {
+        pooled_memory_t *next = entry->next;
+
+        entry->app->release(entry->app);
+        free(entry);
+        entry = next;
+    }
+}
+
+/* Allocates from the service, reusing a released buffer of the same
+ * geometry when there is one. Memory backed by a file descriptor is
+ * never pooled. */
+static camera_memory_t *memory_pool_get(wrapper_camera_device_t *dev, int fd,
+        size_t buf_size, unsigned int num_bufs)
+{
+    memory_pool_t *pool = dev->memoryPool;
+    pooled_memory_t *entry = NULL, *expired;
+    camera_memory_t *app;
+
+    if (!pool || fd >= 0)
+        return dev->get_memory(fd, buf_size, num_bufs, dev->user);
+
+    {
+        android::Mutex::Autolock lock(pool->lock);
+        pooled_memory_t **link;
+
+        expired = memory_pool_expire(pool,
+                systemTime(SYSTEM_TIME_MONOTONIC));
+        for (link = &pool->free; *link; link = &(*link)->next) {
+            if ((*link)->bufSize == buf_size && (*link)->numBufs == num_bufs) {
+                entry = *link;
+                *link = entry->next;
+                pool->freeBytes -= entry->app->size;
+                pool->hits++;
+                break;
+            }
+        }
+    }
+    memory_pool_free_list(expired);
+    if (entry)
+        return &entry->mem;
+
+    app = dev->get_memory(-1, buf_size, num_bufs, dev->user);
+    if (!app || !app->data)
+        return app;
+
+    entry = (pooled_memory_t *)calloc(1, sizeof(*entry));
+    if (!entry)
+        return app;
+
+    entry->mem.data = app->data;
+    entry->mem.size = app->size;
+    entry->mem.handle = app->handle;
+    entry->mem.release = memory_pool_release;
+    entry->app = app;
+    entry->pool = pool;
+    entry->bufSize = buf_size;
+    entry->numBufs = num_bufs;
+
+    android::Mutex::Autolock lock(pool->lock);
+    pool->refs++;
+    pool->residentBytes += app->size;
+    pool->misses++;
+    return &entry->mem;
+}
+
+/* The service hands captured pictures to the app without copying them, so
+ * their buffers must not be reused. */
+static void memory_pool_taint(const camera_memory_t *mem)
+{
+    if (mem && mem->release == memory_pool_release)
+        ((pooled_memory_t *)mem)->tainted = true;
+}
+
+static int memory_pool_open(wrapper_camera_device_t *dev)
+{
+    if (!property_get_bool("persist.camera.wrapper.memory_pool"))
+        return 0;
+
+    dev->memoryPool = new (std::nothrow) memory_pool_t();
+    if (!dev->memoryPool)
+        return -ENOMEM;
+    dev->memoryPool->refs = 1;
+    return 0;
+}
+
+/* Buffers the vendor still holds are released to the service, rather than
+ * pooled, when the vendor lets go of them. */
+static void memory_pool_close(wrapper_camera_device_t *dev)
+{
+    memory_pool_t *pool = dev->memoryPool;
+    pooled_memory_t *entries;
+    bool destroy;
+
+    if (!pool)
+        return;
+
+    {
+        android::Mutex::Autolock lock(pool->lock);
+
+        pool->closed = true;
+        entries = pool->free;
+        pool->free = NULL;
+        for (pooled_memory_t *entry = entries; entry; entry = entry->next) {
+            pool->residentBytes -= entry->app->size;
+            pool->refs--;
+        }
+        pool->freeBytes = 0;
+        destroy = --pool->refs == 0;
+    }
+
+    memory_pool_free_list(entries);
+    if (destroy)
+        delete pool;
+    dev->memoryPool = NULL;
+}
+
+static void memory_pool_dump(wrapper_camera_device_t *dev,
+        android::String8 &out)
+{
+    memory_pool_t *pool = dev->memoryPool;
+
+    if (!pool)
+        return;
+
+    android::Mutex::Autolock lock(pool->lock);
+    out.appendFormat("   Memory pool: hits=%d misses=%d discards=%d "
+            "resident=%zuKB free=%zuKB\n", pool->hits, pool->misses,
+            pool->discards, pool->residentBytes / 1024, pool->freeBytes / 1024);
+}
+
+/* Called with dispatchLock held, returns the queue position of the oldest
+ * droppable callback of one of msg_types or -1. */
+static int dispatch_find(callback_dispatch_t *cd, int32_t msg_types)
+{
+    for (int i = 0; i < cd->count; i++) {
+        int32_t type = cd->slots[(cd->head + i) % DISPATCH_RING_SIZE].msgType;
+        if ((type & msg_types) && !(type & DISPATCH_MSG_KEEP))
+            return i;
+    }
+    return -1;
+}
+
+/* Called with dispatchLock held, drops the i-th queued callback. */
+static void dispatch_drop(callback_dispatch_t *cd, int i)
+{
+    int pos = (cd->head + i) % DISPATCH_RING_SIZE;
+
+    cd->slots[pos].mem->release(cd->slots[pos].mem);
+    for (; i < cd->count - 1; i++) {
+        int next = (pos + 1) % DISPATCH_RING_SIZE;
+        cd->slots[pos] = cd->slots[next];
+        pos = next;
+    }
+    cd->count--;
+}
+
+/* Called with dispatchLock held, makes room in a full ring for a callback
+ * of msg_type or returns false if that has to be dropped instead. The
+ * vendor's callback thread must not wait on the service for a preview
+ * frame: a newer one replaces the oldest queued, or is dropped if there is
+ * none. Other callbacks push out a queued preview frame or other droppable
+ * callback, and only DISPATCH_MSG_KEEP ones wait when there is none. */
+static bool dispatch_make_room(wrapper_camera_device_t *dev, int32_t msg_type)
+{
+    callback_dispatch_t *cd = &dev->dispatch;
+    int victim;
+
+    while (cd->count == DISPATCH_RING_SIZE && !cd->exit) {
+        victim = dispatch_find(cd, CAMERA_MSG_PREVIEW_FRAME);
+        if (victim >= 0) {
+            dispatch_drop(cd, victim);
+            if (msg_type & CAMERA_MSG_PREVIEW_FRAME)
+                cd->coalesced++;
+            else
+                cd->dropped++;
+            return true;
+        }
+        if (msg_type & CAMERA_MSG_PREVIEW_FRAME)
+            return false;
+
+        victim = dispatch_find(cd, ~0);
+        if (victim >= 0) {
+            dispatch_drop(cd, victim);
+            cd->dropped++;
+            return true;
+        }
+        if (!(msg_type & DISPATCH_MSG_KEEP))
+            return false;
+
+        cd->blocked++;
+        dev->dispatchSpaceCond.wait(dev->dispatchLock);
+    }
+    return true;
+}
+
+/* The vendor reuses its buffers once the callback returns, so the payload
+ * is copied into memory of the service's own. Returns false if the
+ * callback could not be queued and has to be delivered directly. */
+static bool dispatch_enqueue(wrapper_camera_device_t *dev, int32_t msg_type,
+        const camera_memory_t *data, unsigned int index,
+        camera_frame_metadata_t *metadata)
+{
+    callback_dispatch_t *cd = &dev->dispatch;
+    size_t bufSize = memory_registry_buf_size(dev, data);
+    camera_memory_t *mem;
+    dispatch_slot_t *slot;
+
+    if (!bufSize && index == 0)
+        bufSize = data->size;
+    if (!bufSize || (index + 1) * bufSize > data->size)
+        return false;
+
+    /* no point copying a callback that would be dropped */
+    {
+        android::Mutex::Autolock lock(dev->dispatchLock);
+        if (cd->count == DISPATCH_RING_SIZE &&
+                !(msg_type & DISPATCH_MSG_KEEP) &&
+                !dispatch_make_room(dev, msg_type)) {
+            cd->dropped++;
+            return true;
+        }
+    }
+
+    mem = memory_pool_get(dev, -1, bufSize, 1);
+    if (!mem || !mem->data) {
+        if (mem)
+            mem->release(mem);
+        return false;
+    }
+    memcpy(mem->data, (const char *)data->data + index * bufSize, bufSize);
+
+    android::Mutex::Autolock lock(dev->dispatchLock);
+
+    if (!dispatch_make_room(dev, msg_type)) {
+        mem->release(mem);
+        cd->dropped++;
+        return true;
+    }
+    if (cd->exit) {
+        mem->release(mem);
+        return true;
+    }
+
+    slot = &cd->slots[(cd->head + cd->count) % DISPATCH_RING_SIZE];
+    slot->msgType = msg_type;
+    slot->mem = mem;
+    slot->hasMetadata = metadata != NULL;
+    if (metadata) {
+        int faces = metadata->number_of_faces;
+
+        if (faces > DISPATCH_MAX_FACES)
+            faces = DISPATCH_MAX_FACES;
+        if (faces < 0 || !metadata->faces)
+            faces = 0;
+        slot->metadata.number_of_faces = faces;
+        memcpy(slot->faces, metadata->faces, faces * sizeof(camera_face_t));
+    }
+
+    cd->count++;
+    cd->queued++;
+    if (cd->count > cd->maxCount)
+        cd->maxCount = cd->count;
+    dev->dispatchCond.signal();
+    return true;
+}
+
+/* delivers a data callback to the service, directly or by the dispatcher */
+static void app_data_cb(wrapper_camera_device_t *dev, int32_t msg_type,
+        const camera_memory_t *data, unsigned int index,
+        camera_frame_metadata_t *metadata)
+{
+    if (!(msg_type & CAMERA_MSG_PREVIEW_FRAME))
+        memory_pool_taint(data);
+
+    if (dev->dispatchEnabled &&
+            dispatch_enqueue(dev, msg_type, data, index, metadata))
+        return;
+
+    if (dev->dispatchEnabled) {
+        android::Mutex::Autolock lock(dev->dispatchLock);
+        if (dev->dispatch.exit)
+            return;
+        dev->dispatch.direct++;
+    }
+    dev->data_cb(msg_type, data, index, metadata, dev->user);
+}
+
+static void *camera_dispatcher(void *data)
+{
+    wrapper_camera_device_t *dev = (wrapper_camera_device_t *)data;
+    callback_dispatch_t *cd = &dev->dispatch;
+    dispatch_slot_t slot;
+
+    dev->dispatchLock.lock();
+    while (!cd->exit) {
+        if (!cd->count) {
+            dev->dispatchCond.wait(dev->dispatchLock);
+            continue;
+        }
+        slot = cd->slots[cd->head];
+        cd->head = (cd->head + 1) % DISPATCH_RING_SIZE;
+        cd->count--;
+        dev->dispatchSpaceCond.signal();
+        dev->dispatchLock.unlock();
+
+        slot.metadata.faces = slot.faces;
+        if (!(slot.msgType & CAMERA_MSG_PREVIEW_FRAME))
+            memory_pool_taint(slot.mem);
+        dev->data_cb(slot.msgType, slot.mem, 0,
+                slot.hasMetadata ? &slot.metadata : NULL, dev->user);
+        slot.mem->release(slot.mem);
+
+        dev->dispatchLock.lock();
+    }
+    dev->dispatchLock.unlock();
+
+    return NULL;
+}
+
+/* drops the callbacks still queued, once the service no longer wants them */
+static void dispatch_discard(wrapper_camera_device_t *dev)
+{
+    android::Mutex::Autolock lock(dev->dispatchLock);
+    callback_dispatch_t *cd = &dev->dispatch;
+
+    while (cd->count) {
+        dispatch_drop(cd, 0);
+        cd->dropped++;
+    }
+    dev->dispatchSpaceCond.broadcast();
+}
+
+static int dispatch_start(wrapper_camera_device_t *dev)
+{
+    int rv;
+
+    if (!dev->dispatchEnabled)
+        return 0;
+
+    rv = pthread_create(&dev->dispatch.thread, NULL, camera_dispatcher, dev);
+    if (rv) {
+        ALOGE("failed to start callback dispatch thread: %s", strerror(rv));
+        return -rv;
+    }
+    dev->dispatch.started = true;
+    return 0;
+}
+
+/* once stopped, callbacks are dropped rather than delivered directly */
+static void dispatch_stop(wrapper_camera_device_t *dev)
+{
+    if (!dev->dispatch.started)
+        return;
+
+    {
+        android::Mutex::Autolock lock(dev->dispatchLock);
+        dev->dispatch.exit = true;
+        dev->dispatchCond.signal();
+        dev->dispatchSpaceCond.broadcast();
+    }
+    pthread_join(dev->dispatch.thread, NULL);
+    dev->dispatch.started = false;
+    dispatch_discard(dev);
+}
+
+static void dispatch_dump(wrapper_camera_device_t *dev, android::String8 &out)
+{
+    android::Mutex::Autolock lock(dev->dispatchLock);
+    callback_dispatch_t *cd = &dev->dispatch;
+
+    if (!dev->dispatchEnabled)
+        return;
+
+    out.appendFormat("   Callback dispatch: depth=%d max depth=%d queued=%d "
+            "preview frames replaced=%d dropped=%d producer waits=%d "
+            "delivered directly=%d\n", cd->count, cd->maxCount, cd->queued,
+            cd->coalesced, cd->dropped, cd->blocked, cd->direct);
+}
+
+static void preview_cb_fixup_getparams(wrapper_camera_device_t *dev,
+        android::CameraParameters *params)
+{
+    preview_cb_t *cb = &dev->previewCb;
+    char size[32], roi[64];
+
+    params->set(KEY_WRAPPER_PREVIEW_CB_FORMAT_VALUES, "yuv420sp,rgba8888");
+
+    android::Mutex::Autolock lock(dev->previewCbLock);
+    if (cb->width > 0 && cb->height > 0) {
+        snprintf(size, sizeof(size), "%dx%d", cb->width, cb->height);
+        params->set(KEY_WRAPPER_PREVIEW_CB_SIZE, size);
+    }
+    if (cb->interval > 1)
+        params->set(KEY_WRAPPER_PREVIEW_CB_INTERVAL, cb->interval);
+    if (cb->roiRight > cb->roiLeft) {
+        snprintf(roi, sizeof(roi), "%d,%d,%d,%d", cb->roiLeft, cb->roiTop,
+                cb->roiRight, cb->roiBottom);
+        params->set(KEY_WRAPPER_PREVIEW_CB_ROI, roi);
+    }
+    params->set(KEY_WRAPPER_PREVIEW_CB_FORMAT, cb->rgba ?
+            android::CameraParameters::PIXEL_FORMAT_RGBA8888 :
+            android::CameraParameters::PIXEL_FORMAT_YUV420SP);
+}
+
+static void preview_cb_fixup_setparams(wrapper_camera_device_t *dev,
+        android::CameraParameters *params)
+{
+    preview_cb_t *cb = &dev->previewCb;
+    const char *size = params->get(KEY_WRAPPER_PREVIEW_CB_SIZE);
+    const char *format = params->get(KEY_WRAPPER_PREVIEW_CB_FORMAT);
+    const char *roi = params->get(KEY_WRAPPER_PREVIEW_CB_ROI);
+    const char *previewFormat = params->getPreviewFormat();
+    int width = 0, height = 0, interval;
+    int left = 0, top = 0, right = 0, bottom = 0;
+
+    if (!size || sscanf(size, "%dx%d", &width, &height) != 2 ||
+            width < 0 || height < 0)
+        width = height = 0;
+    interval = params->getInt(KEY_WRAPPER_PREVIEW_CB_INTERVAL);
+    if (interval < 1)
+        interval = 1;
+    if (!roi || sscanf(roi, "%d,%d,%d,%d", &left, &top, &right,
+            &bottom) != 4 || left < 0 || top < 0 || right <= left ||
+            bottom <= top)
+        left = top = right = bottom = 0;
+
+    {
+        android::Mutex::Autolock lock(dev->previewCbLock);
+        cb->width = width;
+        cb->height = height;
+        cb->rgba = format && strcmp(format,
+                android::CameraParameters::PIXEL_FORMAT_RGBA8888) == 0;
+        params->getPreviewSize(&cb->srcWidth, &cb->srcHeight);
+        cb->srcNV21 = previewFormat && strcmp(previewFormat,
+                android::CameraParameters::PIXEL_FORMAT_YUV420SP) == 0;
+        if (cb->srcNV21)
+            cb->srcFormat = HAL_PIXEL_FORMAT_YCrCb_420_SP;
+        else if (previewFormat && strcmp(previewFormat,
+                android::CameraParameters::PIXEL_FORMAT_YUV420P) == 0)
+            cb->srcFormat = HAL_PIXEL_FORMAT_YV12;
+        else
+            cb->srcFormat = 0;
+        if (cb->interval != interval)
+            cb->frame = 0;
+        cb->interval = interval;
+        cb->roiLeft = left;
+        cb->roiTop = top;
+        cb->roiRight = right;
+        cb->roiBottom = bottom;
+    }
+
+    params->remove(KEY_WRAPPER_PREVIEW_CB_SIZE);
+    params->remove(KEY_WRAPPER_PREVIEW_CB_FORMAT);
+    params->remove(KEY_WRAPPER_PREVIEW_CB_FORMAT_VALUES);
+    params->remove(KEY_WRAPPER_PREVIEW_CB_INTERVAL);
+    params->remove(KEY_WRAPPER_PREVIEW_CB_ROI);
+}
+
+static void preview_cb_release_pool(preview_cb_t *cb)
+{
+    for (int i = 0; i < PREVIEW_CB_POOL_SIZE; i++) {
+        if (cb->pool[i]) {
+            cb->pool[i]->release(cb->pool[i]);
+            cb->pool[i] = NULL;
+        }
+    }
+    cb->poolBufSize = 0;
+    cb->poolNext = 0;
+}
+
+static camera_memory_t *preview_cb_get_buffer(wrapper_camera_device_t *dev,
+        size_t size)
+{
+    preview_cb_t *cb = &dev->previewCb;
+    int slot;
+
+    if (cb->poolBufSize != size) {
+        preview_cb_release_pool(cb);
+        cb->poolBufSize = size;
+    }
+
+    slot = cb->poolNext;
+    cb->poolNext = (slot + 1) % PREVIEW_CB_POOL_SIZE;
+    if (!cb->pool[slot] && dev->get_memory)
+        cb->pool[slot] = dev->get_memory(-1, size, 1, dev->user);
+    return cb->pool[slot];
+}
+
+static uint8_t *preview_cb_get_scratch(preview_cb_t *cb, size_t size)
+{
+    if (cb->scratchSize < size) {
+        uint8_t *scratch = (uint8_t *)realloc(cb->scratch, size);
+        if (!scratch)
+            return NULL;
+        cb->scratch = scratch;
+        cb->scratchSize = size;
+    }
+    return cb->scratch;
+}
+
+/* Whether the app asked for fewer preview callbacks than the vendor
+ * sends and this frame is not one of them. Frames carrying face metadata
+ * are always delivered. */
+static bool preview_cb_skip(wrapper_camera_device_t *dev, int32_t msg_type)
+{
+    preview_cb_t *cb = &dev->previewCb;
+
+    if (msg_type & CAMERA_MSG_PREVIEW_METADATA)
+        return false;
+
+    android::Mutex::Autolock lock(dev->previewCbLock);
+    if (cb->interval <= 1)
+        return false;
+    if (cb->frame++ % cb->interval == 0)
+        return false;
+    cb->decimated++;
+    return true;
+}
+
+/* Crop, downscale and/or convert a preview frame as requested through the
+ * wrapper-preview-cb-* parameters, and hand the result to the app in one
+ * of a small pool of buffers. Returns false if the frame should be
+ * delivered unmodified. */
+static bool preview_cb_deliver(wrapper_camera_device_t *dev, int32_t msg_type,
+        const camera_memory_t *data, unsigned int index,
+        camera_frame_metadata_t *metadata)
+{
+    preview_cb_t *cb = &dev->previewCb;
+    int width, height, srcWidth, srcHeight, stride, levels = 0;
+    int frameWidth, frameHeight, left, top, right, bottom;
+    size_t bufSize, outSize, scratchSize;
+    const uint8_t *y, *vu;
+    uint8_t *scratch = NULL;
+    camera_memory_t *out;
+    bool rgba, crop;
+
+    {
+        android::Mutex::Autolock lock(dev->previewCbLock);
+        if (!cb->srcNV21 || cb->srcWidth <= 0 || cb->srcHeight <= 0)
+            return false;
+        width = cb->width;
+        height = cb->height;
+        rgba = cb->rgba;
+        frameWidth = cb->srcWidth;
+        frameHeight = cb->srcHeight;
+        left = cb->roiLeft;
+        top = cb->roiTop;
+        right = cb->roiRight;
+        bottom = cb->roiBottom;
+    }
+
+    /* the crop has to stay inside the current preview size and start and
+     * end on chroma sample boundaries */
+    if (right > frameWidth)
+        right = frameWidth;
+    if (bottom > frameHeight)
+        bottom = frameHeight;
+    left &= ~1;
+    top &= ~1;
+    right &= ~1;
+    bottom &= ~1;
+    crop = right > left && bottom > top &&
+            (right - left < frameWidth || bottom - top < frameHeight);
+    if (crop) {
+        srcWidth = right - left;
+        srcHeight = bottom - top;
+    } else {
+        left = top = 0;
+        srcWidth = frameWidth;
+        srcHeight = frameHeight;
+    }
+
+    /* the largest power of two reduction that still covers the requested
+     * size, keeping every level even */
+    if (width > 0 && height > 0) {
+        while (levels < 3 &&
+                (srcWidth >> (levels + 1)) >= width &&
+                (srcHeight >> (levels + 1)) >= height &&
+                ((srcWidth >> levels) & 3) == 0 &&
+                ((srcHeight >> levels) & 3) == 0)
+            levels++;
+    }
+    if (!levels && !rgba && !crop)
+        return false;
+
+    bufSize = memory_registry_buf_size(dev, data);
+    if (!bufSize && index == 0)
+        bufSize = data->size;
+    if (bufSize < (size_t)frameWidth * frameHeight * 3 / 2 ||
+            (index + 1) * bufSize > data->size)
+        return false;
+
+    CameraStatsTimer timer(camera_stats_fixup(dev->id, CAMERA_FIXUP_PREVIEW_CB));
+
+    width = srcWidth >> levels;
+    height = srcHeight >> levels;
+    outSize = rgba ? (size_t)width * height * 4 : (size_t)width * height * 3 / 2;
+    out = preview_cb_get_buffer(dev, outSize);
+    if (!out)
+        return false;
+
+    /* intermediate levels ping-pong between two areas of the scratch
+     * buffer, the first one sized for the first level */
+    scratchSize = (size_t)srcWidth * srcHeight * 3 / 8;
+    if (levels > 1 || (levels && rgba)) {
+        scratch = preview_cb_get_scratch(cb, scratchSize + scratchSize / 4);
+        if (!scratch)
+            return false;
+    }
+
+    y = (const uint8_t *)data->data + index * bufSize;
+    vu = y + frameWidth * frameHeight + (top / 2) * frameWidth + left;
+    y += top * frameWidth + left;
+    stride = frameWidth;
+    if (!levels && !rgba)
+        preview_nv21_copy(y, vu, stride, (uint8_t *)out->data,
+                (uint8_t *)out->data + width * height, width, width, height);
+    for (int i = 0; i < levels; i++) {
+        int w = srcWidth >> (i + 1), h = srcHeight >> (i + 1);
+        uint8_t *dst;
+
+        if (i == levels - 1 && !rgba)
+            dst = (uint8_t *)out->data;
+        else
+            dst = scratch + ((i & 1) ? scratchSize : 0);
+        preview_nv21_downscale_2x(y, vu, stride, dst, dst + w * h, w, w, h);
+        y = dst;
+        vu = dst + w * h;
+        stride = w;
+    }
+    if (rgba)
+        preview_nv21_to_rgba(y, vu, stride, (uint8_t *)out->data, width * 4,
+                width, height);
+    if (crop)
+        cb->cropped++;
+
+    app_data_cb(dev, msg_type, out, 0, metadata);
+    return true;
+}
+
+static void preview_cb_dump(wrapper_camera_device_t *dev,
+        android::String8 &out)
+{
+    android::Mutex::Autolock lock(dev->previewCbLock);
+    preview_cb_t *cb = &dev->previewCb;
+
+    if (cb->interval <= 1 && cb->roiRight <= cb->roiLeft &&
+            !cb->decimated && !cb->cropped)
+        return;
+
+    out.appendFormat("   Preview callbacks: interval=%d roi=%d,%d,%d,%d "
+            "decimated=%d cropped=%d\n", cb->interval, cb->roiLeft,
+            cb->roiTop, cb->roiRight, cb->roiBottom, cb->decimated,
+            cb->cropped);
+}
+
+static void preview_cb_release(wrapper_camera_device_t *dev)
+{
+    preview_cb_release_pool(&dev->previewCb);
+    free(dev->previewCb.scratch);
+    dev->previewCb.scratch = NULL;
+    dev->previewCb.scratchSize = 0;
+}
+
+/* Copies a preview frame into the ring file, the only copy a ring reader
+ * pays for. Formats the wrapper cannot size are written whole. */
+static void preview_ring_write(wrapper_camera_device_t *dev,
+        const camera_memory_t *data, unsigned int index)
+{
+    int width, height, format, stride;
+    size_t bufSize, size;
+
+    {
+        android::Mutex::Autolock lock(dev->previewCbLock);
+        width = dev->previewCb.srcWidth;
+        height = dev->previewCb.srcHeight;
+        format = dev->previewCb.srcFormat;
+    }
+
+    bufSize = memory_registry_buf_size(dev, data);
+    if (!bufSize && index == 0)
+        bufSize = data->size;
+    if (!bufSize || (index + 1) * bufSize > data->size)
+        return;
+
+    if (width <= 0 || height <= 0)
+        format = 0;
+    stride = width;
+    size = bufSize;
+    if (format == HAL_PIXEL_FORMAT_YCrCb_420_SP) {
+        size = (size_t)width * height * 3 / 2;
+    } else if (format == HAL_PIXEL_FORMAT_YV12) {
+        stride = (width + 15) & ~15;
+        size = (size_t)stride * height +
+                (size_t)(((stride / 2) + 15) & ~15) * height;
+    }
+    if (size > bufSize) {
+        format = 0;
+        size = bufSize;
+    }
+
+    camera_preview_ring_write(dev->previewRing,
+            (const uint8_t *)data->data + index * bufSize, size, format,
+            width, height, stride, systemTime(SYSTEM_TIME_MONOTONIC));
+}
+
+static void camera_worker_post(wrapper_camera_device_t *dev, uint32_t job);
+
+/* Looks for scenes with both crushed shadows and clipped highlights in
+ * the preview, which still HDR captures better. */
+static void auto_hdr_sample(wrapper_camera_device_t *dev,
+        const camera_memory_t *data, unsigned int index)
+{
+    auto_hdr_t *ah = &dev->autoHdr;
+    preview_luma_stats_t stats;
+    size_t bufSize;
+    int width, height;
+    int32_t dark, bright;
+    bool want;
+
+    if (ah->mode == AUTO_HDR_OFF || ++ah->frame < AUTO_HDR_FRAME_INTERVAL)
+        return;
+    ah->frame = 0;
+
+    {
+        android::Mutex::Autolock lock(dev->previewCbLock);
+        if (!dev->previewCb.srcNV21)
+            return;
+        width = dev->previewCb.srcWidth;
+        height = dev->previewCb.srcHeight;
+    }
+
+    bufSize = memory_registry_buf_size(dev, data);
+    if (!bufSize && index == 0)
+        bufSize = data->size;
+    if (width <= 0 || height <= 0 || bufSize < (size_t)width * height ||
+            (index + 1) * bufSize > data->size)
+        return;
+
+    {
+        CameraStatsTimer timer(camera_stats_fixup(dev->id,
+                CAMERA_FIXUP_LUMA_STATS));
+        preview_luma_stats((const uint8_t *)data->data + index * bufSize,
+                width, width, height, AUTO_HDR_ROW_STEP, &stats);
+    }
+
+    dark = (int32_t)((uint64_t)stats.dark * 1000 / stats.samples);
+    bright = (int32_t)((uint64_t)stats.bright * 1000 / stats.samples);
+    ah->dark = dark;
+    ah->bright = bright;
+    ah->samples++;
+
+    if (ah->recommended)
+        want = dark >= AUTO_HDR_EXIT_DARK && bright >= AUTO_HDR_EXIT_BRIGHT;
+    else
+        want = dark >= AUTO_HDR_ENTER_DARK && bright >= AUTO_HDR_ENTER_BRIGHT;
+
+    if (want == (bool)ah->recommended || ++ah->streak < AUTO_HDR_STREAK) {
+        if (want == (bool)ah->recommended)
+            ah->streak = 0;
+        return;
+    }
+
+    ALOGI("%s: HDR %s (dark %d, bright %d per mille)", __FUNCTION__,
+            want ? "recommended" : "no longer recommended", dark, bright);
+    ah->streak = 0;
+    ah->changes++;
+    android_atomic_release_store(want, &ah->recommended);
+    if (ah->mode == AUTO_HDR_SWITCH)
+        camera_worker_post(dev, WORKER_JOB_AUTO_HDR);
+}
+
+/* message types the wrapper keeps enabled on the vendor for itself */
+static int32_t wrapper_msg_types(wrapper_camera_device_t *dev)
+{
+    return dev->autoHdr.mode != AUTO_HDR_OFF || dev->previewRing ?
+            CAMERA_MSG_PREVIEW_FRAME : 0;
+}
+
+static void camera_worker_post(wrapper_camera_device_t *dev, uint32_t job)
+{
+    android::Mutex::Autolock lock(dev->workerLock);
+
+    dev->workerJobs |= job;
+    dev->workerCond.signal();
+}
+
+/* delayed jobs share one deadline, the earliest asked for */
+static void camera_worker_post_delayed(wrapper_camera_device_t *dev,
+        uint32_t job, nsecs_t delay)
+{
+    android::Mutex::Autolock lock(dev->workerLock);
+    nsecs_t when = systemTime(SYSTEM_TIME_MONOTONIC) + delay;
+
+    if (!dev->workerDelayedJobs || when < dev->workerWakeAt)
+        dev->workerWakeAt = when;
+    dev->workerDelayedJobs |= job;
+    dev->workerCond.signal();
+}
+
+static void latency_record(wrapper_camera_device_t *dev, int latency,
+        nsecs_t ns)
+{
+    camera_histogram_t *hist = camera_stats_latency(dev->id, latency);
+
+    if (hist)
+        camera_histogram_record(hist, ns);
+}
+
+/* a take_picture is about to be handed to the vendor */
+static void latency_picture_start(wrapper_camera_device_t *dev)
+{
+    android::Mutex::Autolock lock(dev->latencyLock);
+
+    dev->latency.picture = systemTime(SYSTEM_TIME_MONOTONIC);
+    dev->latency.pictureSeen = 0;
+}
+
+static void latency_picture_event(wrapper_camera_device_t *dev,
+        int32_t msg_type)
+{
+    android::Mutex::Autolock lock(dev->latencyLock);
+    latency_tracker_t *lt = &dev->latency;
+    int latency;
+
+    if (!lt->picture || (lt->pictureSeen & msg_type))
+        return;
+
+    switch (msg_type) {
+    case CAMERA_MSG_SHUTTER:
+        latency = CAMERA_LATENCY_SHUTTER;
+        break;
+    case CAMERA_MSG_RAW_IMAGE:
+    case CAMERA_MSG_RAW_IMAGE_NOTIFY:
+        // only one of them is enabled at a time
+        latency = CAMERA_LATENCY_RAW;
+        msg_type = CAMERA_MSG_RAW_IMAGE | CAMERA_MSG_RAW_IMAGE_NOTIFY;
+        break;
+    case CAMERA_MSG_COMPRESSED_IMAGE:
+        latency = CAMERA_LATENCY_JPEG;
+        break;
+    default:
+        return;
+    }
+
+    latency_record(dev, latency, systemTime(SYSTEM_TIME_MONOTONIC) - lt->picture);
+    lt->pictureSeen |= msg_type;
+    if (latency == CAMERA_LATENCY_JPEG)
+        lt->picture = 0;
+}
+
+static void latency_focus_start(wrapper_camera_device_t *dev, bool start)
+{
+    android::Mutex::Autolock lock(dev->latencyLock);
+
+    dev->latency.focus = start ? systemTime(SYSTEM_TIME_MONOTONIC) : 0;
+}
+
+static void latency_focus_done(wrapper_camera_device_t *dev)
+{
+    android::Mutex::Autolock lock(dev->latencyLock);
+
+    if (!dev->latency.focus)
+        return;
+
+    latency_record(dev, CAMERA_LATENCY_FOCUS,
+            systemTime(SYSTEM_TIME_MONOTONIC) - dev->latency.focus);
+    dev->latency.focus = 0;
+}
+
+static void latency_preview_start(wrapper_camera_device_t *dev, bool start)
+{
+    android::Mutex::Autolock lock(dev->latencyLock);
+
+    dev->latency.preview = start ? systemTime(SYSTEM_TIME_MONOTONIC) : 0;
+    dev->latency.lastFrame = 0;
+    dev->latency.lastInterval = 0;
+}
+
+/* Preview frames are only seen while the service has preview callbacks
+ * enabled; jitter is the change between consecutive frame intervals. */
+static void latency_preview_frame(wrapper_camera_device_t *dev)
+{
+    android::Mutex::Autolock lock(dev->latencyLock);
+    latency_tracker_t *lt = &dev->latency;
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    if (lt->preview) {
+        latency_record(dev, CAMERA_LATENCY_FIRST_PREVIEW, now - lt->preview);
+        lt->preview = 0;
+    }
+
+    if (lt->lastFrame) {
+        nsecs_t interval = now - lt->lastFrame;
+
+        latency_record(dev, CAMERA_LATENCY_PREVIEW_INTERVAL, interval);
+        if (lt->lastInterval)
+            latency_record(dev, CAMERA_LATENCY_PREVIEW_JITTER,
+                    interval > lt->lastInterval ? interval - lt->lastInterval :
+                    lt->lastInterval - interval);
+        lt->lastInterval = interval;
+    }
+    lt->lastFrame = now;
+}
+
+/* Returns 1 if the caller should hand the take_picture to the vendor now,
+ * 0 if it has been queued behind the capture in flight and -EBUSY if the
+ * queue is full. */
+static int capture_queue_request(wrapper_camera_device_t *dev,
+        int32_t msgTypes)
+{
+    android::Mutex::Autolock lock(dev->captureLock);
+    capture_queue_t *cq = &dev->capture;
+
+    /* without a JPEG callback there is nothing to wait for */
+    if (!(msgTypes & CAMERA_MSG_COMPRESSED_IMAGE))
+        return 1;
+
+    if (!cq->inFlight) {
+        cq->inFlight = true;
+        cq->issued = systemTime(SYSTEM_TIME_MONOTONIC);
+        cq->msgTypes = msgTypes;
+        camera_worker_post_delayed(dev, WORKER_JOB_CAPTURE_TIMEOUT,
+                ms2ns(CAPTURE_TIMEOUT_MS));
+        return 1;
+    }
+
+    if (cq->pending >= CAPTURE_QUEUE_MAX) {
+        ALOGW("%s: capture queue full, refusing take_picture", __FUNCTION__);
+        cq->drops++;
+        return -EBUSY;
+    }
+
+    cq->pendingMsgTypes[(cq->pendingHead + cq->pending) % CAPTURE_QUEUE_MAX] =
+            msgTypes;
+    cq->pending++;
+    cq->queued++;
+    if (cq->pending > cq->maxPending)
+        cq->maxPending = cq->pending;
+    return 0;
+}
+
+/* the in-flight capture delivered its JPEG or failed */
+static void capture_queue_complete(wrapper_camera_device_t *dev)
+{
+    android::Mutex::Autolock lock(dev->captureLock);
+    capture_queue_t *cq = &dev->capture;
+
+    if (!cq->inFlight)
+        return;
+
+    if (cq->pending > 0) {
+        cq->msgTypes = cq->pendingMsgTypes[cq->pendingHead];
+        cq->pendingHead = (cq->pendingHead + 1) % CAPTURE_QUEUE_MAX;
+        cq->pending--;
+        cq->issued = systemTime(SYSTEM_TIME_MONOTONIC);
+        camera_worker_post(dev, WORKER_JOB_TAKE_PICTURE);
+        camera_worker_post_delayed(dev, WORKER_JOB_CAPTURE_TIMEOUT,
+                ms2ns(CAPTURE_TIMEOUT_MS));
+    } else {
+        cq->inFlight = false;
+    }
+}
+
+/* Notes whether the parameters set turn zero shutter lag on. */
+static void capture_params(wrapper_camera_device_t *dev,
+        const android::CameraParameters &params)
+{
+    const char *zsl = params.get(KEY_ZSL);
+
+    android::Mutex::Autolock lock(dev->captureLock);
+    dev->capture.zsl = zsl && strcmp(zsl, VALUE_SONY_ON) == 0;
+}
+
+static void capture_queue_clear(wrapper_camera_device_t *dev)
+{
+    android::Mutex::Autolock lock(dev->captureLock);
+
+    dev->capture.inFlight = false;
+    dev->capture.pendingHead = 0;
+    dev->capture.pending = 0;
+}
+
+/* A queued capture cannot be taken once the vendor has stopped preview
+ * for the previous one, which it does unless ZSL is on. It fails along
+ * with the requests behind it, and the service, which was told they were
+ * taken, gets an error instead of waiting for them forever. */
+static void capture_queue_fail(wrapper_camera_device_t *dev)
+{
+    int failed;
+
+    {
+        android::Mutex::Autolock lock(dev->captureLock);
+        capture_queue_t *cq = &dev->capture;
+
+        failed = 1 + cq->pending;
+        ALOGW("%s: preview stopped, failing %d queued captures",
+                __FUNCTION__, failed);
+        cq->failed += failed;
+        cq->inFlight = false;
+        cq->pendingHead = 0;
+        cq->pending = 0;
+    }
+
+    if (dev->appMsgTypes & CAMERA_MSG_ERROR)
+        dev->notify_cb(CAMERA_MSG_ERROR, CAMERA_ERROR_UNKNOWN, 0, dev->user);
+}
+
+/* runs on the worker thread */
+static void capture_queue_issue(wrapper_camera_device_t *dev)
+{
+    int32_t msgTypes;
+    bool zsl;
+
+    {
+        android::Mutex::Autolock lock(dev->captureLock);
+        if (!dev->capture.inFlight)
+            return;
+        msgTypes = dev->capture.msgTypes;
+        zsl = dev->capture.zsl;
+    }
+
+    if (!zsl && !VENDOR_CALL(dev, preview_enabled)) {
+        capture_queue_fail(dev);
+        return;
+    }
+
+    /* the service enabled these when the request was made, but may have
+     * disabled them again on receiving the previous picture */
+    VENDOR_CALL(dev, enable_msg_type, msgTypes);
+    latency_picture_start(dev);
+    if (VENDOR_CALL(dev, take_picture)) {
+        ALOGE("%s: queued take_picture failed", __FUNCTION__);
+        {
+            android::Mutex::Autolock lock(dev->captureLock);
+            dev->capture.drops++;
+        }
+        capture_queue_complete(dev);
+    }
+}
+
+/* Runs on the worker thread once the in-flight capture may have timed
+ * out. A capture the vendor has not delivered in time is given up on,
+ * and so are the requests queued behind it: handing them to a vendor that
+ * may still be busy with it would only fail, or have its late JPEG taken
+ * for theirs. The service was told they were taken, so it gets an error
+ * instead of waiting for them forever. */
+static void capture_queue_expire(wrapper_camera_device_t *dev)
+{
+    int dropped;
+
+    {
+        android::Mutex::Autolock lock(dev->captureLock);
+        capture_queue_t *cq = &dev->capture;
+        nsecs_t elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - cq->issued;
+
+        if (!cq->inFlight)
+            return;
+        /* a later capture than the one the timeout was set for */
+        if (elapsed < ms2ns(CAPTURE_TIMEOUT_MS)) {
+            camera_worker_post_delayed(dev, WORKER_JOB_CAPTURE_TIMEOUT,
+                    ms2ns(CAPTURE_TIMEOUT_MS) - elapsed);
+            return;
+        }
+
+        dropped = cq->pending;
+        ALOGW("%s: no picture for %lldms, giving up on it and %d queued",
+                __FUNCTION__, (long long)ns2ms(elapsed), dropped);
+        cq->timeouts++;
+        cq->drops += dropped;
+        cq->inFlight = false;
+        cq->pendingHead = 0;
+        cq->pending = 0;
+    }
+
+    if (dropped && (dev->appMsgTypes & CAMERA_MSG_ERROR))
+        dev->notify_cb(CAMERA_MSG_ERROR, CAMERA_ERROR_UNKNOWN, 0, dev->user);
+}
+
+static void capture_queue_dump(wrapper_camera_device_t *dev,
+        android::String8 &out)
+{
+    android::Mutex::Autolock lock(dev->captureLock);
+    capture_queue_t *cq = &dev->capture;
+
+    out.appendFormat("   Capture queue: in flight=%d depth=%d max depth=%d "
+            "queued=%d dropped=%d timed out=%d failed=%d\n", cq->inFlight,
+            cq->pending, cq->maxPending, cq->queued, cq->drops,
+            cq->timeouts, cq->failed);
+}
+
+/* Whether a running sweep can answer a new auto_focus; a sweep that was
+ * started for other focus parameters or that never finished cannot. Must
+ * be called with focusLock held. */
+static bool focus_sweep_usable(focus_tracker_t *ft, nsecs_t now)
+{
+    return ft->state == FOCUS_RUNNING && !ft->stale &&
+            now - ft->started < ms2ns(FOCUS_SWEEP_TIMEOUT_MS);
+}
+
+/* Tap to focus and focus mode toggles come as auto_focus, cancel and
+ * auto_focus again within milliseconds, each of which would restart the
+ * vendor's sweep. A request made while a usable sweep runs, even if it
+ * was cancelled in between, is answered by that sweep's result. */
+static int focus_request(wrapper_camera_device_t *dev)
+{
+    android::Mutex::Autolock callLock(dev->focusCallLock);
+    focus_tracker_t *ft = &dev->focus;
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    bool cancel;
+    int rv;
+
+    {
+        android::Mutex::Autolock lock(dev->focusLock);
+
+        ft->requests++;
+        if (focus_sweep_usable(ft, now)) {
+            if (ft->cancelPending)
+                ft->merged++;
+            else
+                ft->coalesced++;
+            ft->cancelPending = false;
+            return 0;
+        }
+
+        // the held back cancel goes first, as the service ordered them
+        cancel = ft->cancelPending;
+        ft->cancelPending = false;
+        if (cancel)
+            ft->cancelsSent++;
+        ft->state = FOCUS_RUNNING;
+        ft->started = now;
+        ft->stale = false;
+        ft->sweeps++;
+    }
+
+    if (cancel)
+        VENDOR_CALL(dev, cancel_auto_focus);
+    rv = VENDOR_CALL(dev, auto_focus);
+    if (rv) {
+        android::Mutex::Autolock lock(dev->focusLock);
+        ft->state = FOCUS_IDLE;
+    }
+    return rv;
+}
+
+/* A cancel with nothing running or locked does nothing and is dropped;
+ * one of a running sweep is held back for FOCUS_CANCEL_DEBOUNCE_MS. */
+static int focus_cancel(wrapper_camera_device_t *dev)
+{
+    android::Mutex::Autolock callLock(dev->focusCallLock);
+    focus_tracker_t *ft = &dev->focus;
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    {
+        android::Mutex::Autolock lock(dev->focusLock);
+
+        ft->cancels++;
+        if (ft->state == FOCUS_IDLE || ft->cancelPending) {
+            ft->cancelsDropped++;
+            return 0;
+        }
+        if (focus_sweep_usable(ft, now)) {
+            ft->cancelPending = true;
+            ft->cancelAt = now + ms2ns(FOCUS_CANCEL_DEBOUNCE_MS);
+            camera_worker_post_delayed(dev, WORKER_JOB_FOCUS_CANCEL,
+                    ms2ns(FOCUS_CANCEL_DEBOUNCE_MS));
+            return 0;
+        }
+        ft->state = FOCUS_IDLE;
+        ft->cancelsSent++;
+    }
+
+    return VENDOR_CALL(dev, cancel_auto_focus);
+}
+
+/* Hands a held back cancel to the vendor, now if force is set or once its
+ * debounce time has passed. */
+static void focus_cancel_send(wrapper_camera_device_t *dev, bool force)
+{
+    android::Mutex::Autolock callLock(dev->focusCallLock);
+    focus_tracker_t *ft = &dev->focus;
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+
+    {
+        android::Mutex::Autolock lock(dev->focusLock);
+
+        if (!ft->cancelPending)
+            return;
+        if (!force && now < ft->cancelAt) {
+            // an earlier deadline woke the worker, wait for this one
+            camera_worker_post_delayed(dev, WORKER_JOB_FOCUS_CANCEL,
+                    ft->cancelAt - now);
+            return;
+        }
+        ft->cancelPending = false;
+        ft->state = FOCUS_IDLE;
+        ft->cancelsSent++;
+    }
+
+    VENDOR_CALL(dev, cancel_auto_focus);
+}
+
+/* runs on the worker thread */
+static void focus_cancel_expired(wrapper_camera_device_t *dev)
+{
+    focus_cancel_send(dev, false);
+}
+
+/* called before ops the vendor must see after any cancel the service made */
+static void focus_flush(wrapper_camera_device_t *dev)
+{
+    if (dev->focusCoalesce)
+        focus_cancel_send(dev, true);
+}
+
+/* Sweeps do not outlive the preview or a vendor error; the lens may still
+ * be locked, so the next cancel goes to the vendor. */
+static void focus_reset(wrapper_camera_device_t *dev)
+{
+    android::Mutex::Autolock lock(dev->focusLock);
+
+    if (dev->focus.state == FOCUS_RUNNING)
+        dev->focus.state = FOCUS_LOCKED;
+}
+
+/* Returns whether the service should get the vendor's CAMERA_MSG_FOCUS;
+ * the result of a sweep the service has cancelled is kept from it. */
+static bool focus_done(wrapper_camera_device_t *dev)
+{
+    android::Mutex::Autolock lock(dev->focusLock);
+    focus_tracker_t *ft = &dev->focus;
+
+    if (!dev->focusCoalesce || ft->state != FOCUS_RUNNING)
+        return true;
+
+    ft->state = FOCUS_LOCKED;
+    if (ft->cancelPending) {
+        ft->swallowed++;
+        return false;
+    }
+    return true;
+}
+
+static void focus_copy(char *dst, size_t size, const char *value)
+{
+    if (!value)
+        value = "";
+    if (strlen(value) >= size)
+        // too long to compare, never matches
+        value = "?";
+    strcpy(dst, value);
+}
+
+/* Notes the focus parameters set; a sweep running with others is stale. */
+static void focus_params(wrapper_camera_device_t *dev,
+        const android::CameraParameters &params)
+{
+    const char *mode = params.get(android::CameraParameters::KEY_FOCUS_MODE);
+    const char *areas = params.get(android::CameraParameters::KEY_FOCUS_AREAS);
+    focus_tracker_t *ft = &dev->focus;
+
+    if (!dev->focusCoalesce)
+        return;
+    if (!mode)
+        mode = "";
+    if (!areas)
+        areas = "";
+
+    android::Mutex::Autolock lock(dev->focusLock);
+    if (strcmp(mode, ft->focusMode) == 0 && strcmp(areas, ft->focusAreas) == 0)
+        return;
+
+    focus_copy(ft->focusMode, sizeof(ft->focusMode), mode);
+    focus_copy(ft->focusAreas, sizeof(ft->focusAreas), areas);
+    if (ft->state == FOCUS_RUNNING)
+        ft->stale = true;
+}
+
+static void focus_dump(wrapper_camera_device_t *dev, android::String8 &out)
+{
+    android::Mutex::Autolock lock(dev->focusLock);
+    focus_tracker_t *ft = &dev->focus;
+
+    if (!dev->focusCoalesce)
+        return;
+
+    out.appendFormat("   Autofocus: requests=%d sweeps=%d coalesced=%d "
+            "merged with cancel=%d restarts avoided=%d cancels=%d "
+            "dropped=%d sent=%d results withheld=%d\n", ft->requests,
+            ft->sweeps, ft->coalesced, ft->merged,
+            ft->coalesced + ft->merged, ft->cancels, ft->cancelsDropped,
+            ft->cancelsSent, ft->swallowed);
+}
+
+static int params_apply_locked(wrapper_camera_device_t *dev,
+        const char *params)
+{
+    char *tmp = NULL;
+
+    if (dev->autoHdr.mode == AUTO_HDR_SWITCH && params != dev->lastParams) {
+        free(dev->lastParams);
+        dev->lastParams = strdup(params);
+    }
+
+    tmp = camera_fixup_setparams(dev, params);
+    if (!tmp)
+        return -ENOMEM;
+
+    int ret = VENDOR_CALL(dev, set_parameters, tmp);
+    return ret;
+}
+
+/* Apply the newest parameters submitted in async mode, if any. They stay
+ * pending, and get_parameters keeps returning them, until the vendor has
+ * been given them. */
+static int params_apply_pending(wrapper_camera_device_t *dev)
+{
+    android::Mutex::Autolock lock(dev->paramsLock);
+    char *params;
+    uint32_t gen;
+    int ret;
+
+    {
+        android::Mutex::Autolock pendingLock(dev->pendingLock);
+        if (!dev->pendingParams)
+            return 0;
+        params = strdup(dev->pendingParams);
+        gen = dev->pendingGen;
+    }
+    if (!params)
+        return -ENOMEM;
+
+    ret = params_apply_locked(dev, params);
+    free(params);
+
+    {
+        android::Mutex::Autolock pendingLock(dev->pendingLock);
+        if (dev->pendingGen == gen) {
+            free(dev->pendingParams);
+            dev->pendingParams = NULL;
+        }
+        dev->paramsApplied++;
+        if (ret) {
+            ALOGE("%s: vendor rejected parameters: %d", __FUNCTION__, ret);
+            dev->paramsFailed++;
+        }
+    }
+    return ret;
+}
+
+/* runs on the worker thread, sets the service's parameters again so that
+ * the translation picks up the new HDR recommendation */
+static void auto_hdr_apply(wrapper_camera_device_t *dev)
+{
+    android::Mutex::Autolock lock(dev->paramsLock);
+
+    if (dev->lastParams && (bool)dev->autoHdr.engaged !=
+            (bool)android_atomic_acquire_load(&dev->autoHdr.recommended))
+        params_apply_locked(dev, dev->lastParams);
+}
+
+static void auto_hdr_dump(wrapper_camera_device_t *dev, android::String8 &out)
+{
+    auto_hdr_t *ah = &dev->autoHdr;
+
+    if (ah->mode == AUTO_HDR_OFF)
+        return;
+
+    out.appendFormat("   Auto HDR: %s recommended=%d engaged=%d samples=%d "
+            "changes=%d last dark=%d bright=%d per mille\n",
+            ah->mode == AUTO_HDR_SWITCH ? "switch" : "recommend",
+            ah->recommended, ah->engaged, ah->samples, ah->changes,
+            ah->dark, ah->bright);
+}
+
+/* called before ops which depend on the parameters being in effect */
+static void params_flush(wrapper_camera_device_t *dev)
+{
+    if (dev->asyncParams)
+        params_apply_pending(dev);
+}
+
+static int params_submit(wrapper_camera_device_t *dev, const char *params)
+{
+    char *copy;
+
+    if (!params || !strchr(params, '='))
+        return -EINVAL;
+
+    copy = strdup(params);
+    if (!copy)
+        return -ENOMEM;
+
+    {
+        android::Mutex::Autolock lock(dev->pendingLock);
+        free(dev->pendingParams);
+        dev->pendingParams = copy;
+        dev->pendingGen++;
+        dev->paramsSubmitted++;
+    }
+    camera_worker_post(dev, WORKER_JOB_SET_PARAMETERS);
+    return 0;
+}
+
+/* pending parameters for read-your-writes, NULL if there are none */
+static char *params_get_pending(wrapper_camera_device_t *dev)
+{
+    android::Mutex::Autolock lock(dev->pendingLock);
+
+    return dev->pendingParams ? strdup(dev->pendingParams) : NULL;
+}
+
+static void params_dump(wrapper_camera_device_t *dev, android::String8 &out)
+{
+    android::Mutex::Autolock lock(dev->pendingLock);
+
+    if (!dev->asyncParams)
+        return;
+
+    out.appendFormat("   Async parameters: submitted=%d applied=%d "
+            "coalesced=%d failed=%d pending=%d\n", dev->paramsSubmitted,
+            dev->paramsApplied,
+            dev->paramsSubmitted - dev->paramsApplied - (dev->pendingParams ? 1 : 0),
+            dev->paramsFailed, dev->pendingParams != NULL);
+}
+
+static void *camera_worker(void *data)
+{
+    wrapper_camera_device_t *dev = (wrapper_camera_device_t *)data;
+    uint32_t jobs;
+
+    dev->workerLock.lock();
+    while (!dev->workerExit) {
+        if (dev->workerDelayedJobs) {
+            nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+            if (now >= dev->workerWakeAt) {
+                dev->workerJobs |= dev->workerDelayedJobs;
+                dev->workerDelayedJobs = 0;
+            } else if (!dev->workerJobs) {
+                dev->workerCond.waitRelative(dev->workerLock,
+                        dev->workerWakeAt - now);
+                continue;
+            }
+        }
+        if (!dev->workerJobs) {
+            dev->workerCond.wait(dev->workerLock);
+            continue;
+        }
+        jobs = dev->workerJobs;
+        dev->workerJobs = 0;
+        dev->workerLock.unlock();
+
+        {
+            android::Mutex::Autolock vendorLock(dev->vendorLock);
+            if (jobs & WORKER_JOB_SET_PARAMETERS)
+                params_apply_pending(dev);
+            if (jobs & WORKER_JOB_AUTO_HDR)
+                auto_hdr_apply(dev);
+            if (jobs & WORKER_JOB_TAKE_PICTURE)
+                capture_queue_issue(dev);
+            if (jobs & WORKER_JOB_FOCUS_CANCEL)
+                focus_cancel_expired(dev);
+        }
+        if (jobs & WORKER_JOB_CAPTURE_TIMEOUT)
+            capture_queue_expire(dev);
+
+        dev->workerLock.lock();
+    }
+    dev->workerLock.unlock();
+
+    return NULL;
+}
+
+static int camera_worker_start(wrapper_camera_device_t *dev)
+{
+    int rv = pthread_create(&dev->worker, NULL, camera_worker, dev);
+
+    if (rv) {
+        ALOGE("failed to start camera worker thread: %s", strerror(rv));
+        return -rv;
+    }
+    dev->workerStarted = true;
+    return 0;
+}
+
+static void camera_worker_stop(wrapper_camera_device_t *dev)
+{
+    if (!dev->workerStarted)
+        return;
+
+    {
+        android::Mutex::Autolock lock(dev->workerLock);
+        dev->workerExit = true;
+        dev->workerCond.signal();
+    }
+    pthread_join(dev->worker, NULL);
+    dev->workerStarted = false;
+}
+
+static void wrapper_notify_cb(int32_t msg_type, int32_t ext1, int32_t ext2,
+        void *user)
+{
+    wrapper_camera_device_t *dev = (wrapper_camera_device_t *)user;
+
+    if (msg_type == CAMERA_MSG_FOCUS) {
+        if (!focus_done(dev))
+            return;
+        latency_focus_done(dev);
+    } else {
+        latency_picture_event(dev, msg_type);
+    }
+
+    dev->notify_cb(msg_type, ext1, ext2, dev->user);
+
+    if (msg_type == CAMERA_MSG_ERROR) {
+        capture_queue_clear(dev);
+        focus_reset(dev);
+    }
+}
+
+static void wrapper_data_cb(int32_t msg_type, const camera_memory_t *data,
+        unsigned int index, camera_frame_metadata_t *metadata, void *user)
+{
+    wrapper_camera_device_t *dev = (wrapper_camera_device_t *)user;
+
+    if (msg_type & CAMERA_MSG_PREVIEW_FRAME) {
+        auto_hdr_sample(dev, data, index);
+        if (dev->previewRing)
+            preview_ring_write(dev, data, index);
+        // frames the vendor only sends for the wrapper's own use
+        if (!(dev->appMsgTypes & CAMERA_MSG_PREVIEW_FRAME))
+            return;
+        latency_preview_frame(dev);
+        // skipped before anything is copied or converted
+        if (preview_cb_skip(dev, msg_type))
+            return;
+    } else {
+        latency_picture_event(dev, msg_type & ~CAMERA_MSG_PREVIEW_METADATA);
+    }
+
+    if (!(msg_type & CAMERA_MSG_PREVIEW_FRAME) ||
+            !preview_cb_deliver(dev, msg_type, data, index, metadata))
+        app_data_cb(dev, msg_type, data, index, metadata);
+
+    if (msg_type & CAMERA_MSG_COMPRESSED_IMAGE)
+        capture_queue_complete(dev);
+}
+
+/* Warn once about every frame the service has been holding for too long;
+ * a stuck encoder starves the vendor of video buffers. */
+static void recording_check_held(wrapper_camera_device_t *dev, nsecs_t now)
+{
+    recording_tracker_t *rt = &dev->recording;
+
+    for (int i = 0; i < RECORDING_SLOTS; i++) {
+        recording_slot_t *slot = &rt->slots[i];
+        int64_t delivered = slot->delivered;
+
+        if (!slot->handle || !delivered || slot->warned ||
+                now - delivered < ms2ns(RECORDING_HOLD_WARN_MS))
+            continue;
+        if (android_atomic_cmpxchg(0, 1, &slot->warned) == 0)
+            ALOGW("%s: recording frame %p held for %lldms", __FUNCTION__,
+                    slot->handle, (long long)ns2ms(now - delivered));
+    }
+}
+
+/* The service returns video frames by the address of the buffer within
+ * the vendor's memory, so that is the handle tracked. */
+static void recording_frame_delivered(wrapper_camera_device_t *dev,
+        const camera_memory_t *data, unsigned int index)
+{
+    recording_tracker_t *rt = &dev->recording;
+    size_t bufSize = memory_registry_buf_size(dev, data);
+    nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+    const void *handle;
+    int32_t inFlight, max;
+
+    recording_check_held(dev, now);
+
+    if (!bufSize) {
+        android_atomic_inc(&rt->untracked);
+        return;
+    }
+    handle = (const char*)data->data + index * bufSize;
+
+    for (int i = 0; i < RECORDING_SLOTS; i++) {
+        recording_slot_t *slot = &rt->slots[i];
+
+        if (slot->handle ||
+                !__sync_bool_compare_and_swap(&slot->handle,
+                        (const void*)NULL, handle))
+            continue;
+
+        // the frame is not passed on before this is set, so its release
+        // always finds it
+        slot->warned = 0;
+        __sync_lock_test_and_set(&slot->delivered, now);
+
+        android_atomic_inc(&rt->delivered);
+        inFlight = android_atomic_inc(&rt->inFlight) + 1;
+        do {
+            max = rt->maxInFlight;
+        } while (inFlight > max &&
+                android_atomic_cmpxchg(max, inFlight, &rt->maxInFlight));
+        return;
+    }
+    android_atomic_inc(&rt->untracked);
+}
+
+static void recording_frame_released(wrapper_camera_device_t *dev,
+        const void *handle)
+{
+    recording_tracker_t *rt = &dev->recording;
 
-#define VENDOR_CALL(device, func, ...) ({ \
-    wrapper_camera_device_t *__wrapper_dev = (wrapper_camera_device_t*) device; \
-    __wrapper_dev->vendor->ops->func(__wrapper_dev->vendor, ##__VA_ARGS__); \
-})
+    for (int i = 0; i < RECORDING_SLOTS; i++) {
+        recording_slot_t *slot = &rt->slots[i];
+        int64_t delivered;
 
-#define CAMERA_ID(device) (((wrapper_camera_device_t *)(device))->id)
+        if (slot->handle != handle)
+            continue;
 
-static int check_vendor_module()
+        // clear the time before freeing the slot so a new owner's is kept
+        delivered = __sync_lock_test_and_set(&slot->delivered, 0);
+        if (!__sync_bool_compare_and_swap(&slot->handle, handle,
+                (const void*)NULL))
+            continue;
+
+        android_atomic_dec(&rt->inFlight);
+        if (delivered)
+            camera_histogram_record(&rt->hold,
+                    systemTime(SYSTEM_TIME_MONOTONIC) - delivered);
+        return;
+    }
+    android_atomic_inc(&rt->unknownReleases);
+}
+
+/* Forget frames the service never returned, once it can no longer do so. */
+static void recording_frames_reset(wrapper_camera_device_t *dev)
 {
-    int rv = 0;
-    ALOGV("%s", __FUNCTION__);
+    recording_tracker_t *rt = &dev->recording;
 
-    if (gVendorModule)
-        return 0;
+    for (int i = 0; i < RECORDING_SLOTS; i++) {
+        recording_slot_t *slot = &rt->slots[i];
+        const void *handle = slot->handle;
 
-    rv = hw_get_module_by_class("camera", "vendor",
-            (const hw_module_t**)&gVendorModule);
-    if (rv)
-        ALOGE("failed to open vendor camera module");
-    return rv;
+        if (!handle)
+            continue;
+
+        __sync_lock_test_and_set(&slot->delivered, 0);
+        if (!__sync_bool_compare_and_swap(&slot->handle, handle,
+                (const void*)NULL))
+            continue;
+
+        ALOGW("%s: recording frame %p was never returned", __FUNCTION__,
+                handle);
+        android_atomic_dec(&rt->inFlight);
+        android_atomic_inc(&rt->neverReturned);
+    }
 }
 
-void camera_fixup_capability(android::CameraParameters *params)
+static void recording_dump(wrapper_camera_device_t *dev,
+        android::String8 &out)
 {
-    ALOGV("%s", __FUNCTION__);
+    recording_tracker_t *rt = &dev->recording;
 
-    if (params->get(KEY_SONY_IMAGE_STABILISER_VALUES)) {
-        const char *supportedIsModes = params->get(KEY_SONY_IMAGE_STABILISER_VALUES);
+    if (!rt->delivered && !rt->untracked)
+        return;
 
-        if (strstr(supportedIsModes, VALUE_SONY_STILL_HDR) != NULL) {
-            char buffer[512];
-            const char *supportedSceneModes = params->get(android::CameraParameters::KEY_SUPPORTED_SCENE_MODES);
-            sprintf(buffer, "%s,hdr", supportedSceneModes);
-            params->set(android::CameraParameters::KEY_SUPPORTED_SCENE_MODES, buffer);
-        }
-    }
+    out.appendFormat("   Recording frames: in flight=%d max in flight=%d "
+            "delivered=%d untracked=%d unknown releases=%d "
+            "never returned=%d\n", rt->inFlight, rt->maxInFlight,
+            rt->delivered, rt->untracked, rt->unknownReleases,
+            rt->neverReturned);
+    camera_histogram_dump(&rt->hold, "recording_frame_hold", out);
 }
 
-static char *camera_fixup_getparams(int id, const char *settings)
+static void wrapper_data_cb_timestamp(nsecs_t timestamp, int32_t msg_type,
+        const camera_memory_t *data, unsigned int index, void *user)
 {
-    android::CameraParameters params;
-    params.unflatten(android::String8(settings));
+    wrapper_camera_device_t *dev = (wrapper_camera_device_t *)user;
 
-#if !LOG_NDEBUG
-    ALOGV("%s: original parameters:", __FUNCTION__);
-    params.dump();
-#endif
+    if (msg_type & CAMERA_MSG_VIDEO_FRAME)
+        recording_frame_delivered(dev, data, index);
 
-    camera_fixup_capability(&params);
+    dev->data_cb_timestamp(timestamp, msg_type, data, index, dev->user);
+}
 
-    if (params.get(KEY_SONY_ISO_AVAIL_MODES)) {
-        // fixup the iso mode list with those that are in the sony list
-        const char *isoModeList = params.get(KEY_SONY_ISO_AVAIL_MODES);
-        char buffer[255] = "ISO";
-        char bufferPos = 3;
-        for (int pos = 0; pos < strlen(isoModeList); pos++) {
-            if (isoModeList[pos] != ',') {
-                buffer[bufferPos++] = isoModeList[pos];
-            } else {
-                strcat(buffer,",ISO");
-                bufferPos += 4;
-            }
-        }
-        sprintf(buffer, "%s,auto", buffer);
-        params.set(KEY_SUPPORTED_ISO_MODES, buffer);
-    }
+static camera_memory_t *wrapper_get_memory(int fd, size_t buf_size,
+        unsigned int num_bufs, void *user)
+{
+    wrapper_camera_device_t *dev = (wrapper_camera_device_t *)user;
+    camera_memory_t *mem = memory_pool_get(dev, fd, buf_size, num_bufs);
 
-    if (params.get(KEY_SONY_IMAGE_STABILISER)) {
-        const char *sony_is = params.get(KEY_SONY_IMAGE_STABILISER);
-        if (strcmp(sony_is, VALUE_SONY_STILL_HDR) == 0) {
-            // Scene mode is HDR then (see fixup_setparams)
-            params.set(android::CameraParameters::KEY_SCENE_MODE, "hdr");
-        }
-    }
+    if (mem)
+        memory_registry_add(dev, mem, buf_size);
+    return mem;
+}
 
-    if (params.get(KEY_SONY_VIDEO_HDR) && params.get(KEY_SONY_VIDEO_HDR_VALUES)) {
-        params.set("video-hdr-values", params.get(KEY_SONY_VIDEO_HDR_VALUES));
-        params.set("video-hdr", params.get(KEY_SONY_VIDEO_HDR));
-    }
+/*******************************************************************
+ * preview window interposed between the vendor and the service
+ *******************************************************************/
 
-    if (params.get(KEY_SONY_ISO_MODE)) {
-        if (params.get(KEY_SONY_AE_MODE_VALUES)) {
-            const char *aeMode = params.get(KEY_SONY_AE_MODE);
-            if (strcmp(aeMode, "auto") == 0 ) {
-                params.set(KEY_ISO_MODE, "auto");
-                params.set("shutter-speed","auto");
-            } else if (strcmp(aeMode, "iso-prio") == 0) {
-                char *isoVal = (char*)malloc(sizeof(char)*
-                        (3 + strlen(params.get(KEY_SONY_ISO_MODE))));
-                sprintf(isoVal,"ISO%s",params.get(KEY_SONY_ISO_MODE));
-                params.set(KEY_ISO_MODE,isoVal);
-                params.set("shutter-speed","auto");
-            } else if (strcmp(aeMode, "shutter-prio") == 0) {
-                params.set(KEY_ISO_MODE, "auto");
-                const char *shutterSpeed = params.get("sony-shutter-speed");
-                if (shutterSpeed) {
-                    params.set("shutter-speed",shutterSpeed);
-                }
-            } else if (strcmp(aeMode, "manual") == 0) {
-                const char *shutterSpeed = params.get("sony-shutter-speed");
-                if (shutterSpeed) {
-                    params.set("shutter-speed",shutterSpeed);
-                }
-                char *isoVal = (char*)malloc(sizeof(char)*
-                                        (3 + strlen(params.get(KEY_SONY_ISO_MODE))));
-                sprintf(isoVal,"ISO%s",params.get(KEY_SONY_ISO_MODE));
-                params.set(KEY_ISO_MODE,isoVal);
-            } else {
-                params.set(KEY_ISO_MODE, "auto");
-                params.set("shutter-speed","auto");
-            }
-        }
+#define WINDOW_SHIM(w) ((preview_window_shim_t *)(w))
+
+static void window_shim_record(preview_window_shim_t *shim, int op,
+        nsecs_t ns)
+{
+    camera_histogram_t *hist = camera_stats_window(shim->id, op);
+
+    if (hist)
+        camera_histogram_record(hist, ns);
+}
+
+static int window_shim_dequeue_buffer(struct preview_stream_ops *w,
+        buffer_handle_t **buffer, int *stride)
+{
+    preview_window_shim_t *shim = WINDOW_SHIM(w);
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    int32_t held, max;
+    int ret;
+
+    ret = shim->window->dequeue_buffer(shim->window, buffer, stride);
+    window_shim_record(shim, CAMERA_WINDOW_DEQUEUE,
+            systemTime(SYSTEM_TIME_MONOTONIC) - start);
+
+    if (ret) {
+        android_atomic_inc(&shim->dequeueFails);
+        return ret;
     }
 
-#if !LOG_NDEBUG
-    ALOGV("%s: fixed parameters:", __FUNCTION__);
-    params.dump();
-#endif
+    held = android_atomic_inc(&shim->held) + 1;
+    do {
+        max = shim->maxHeld;
+    } while (held > max && android_atomic_cmpxchg(max, held, &shim->maxHeld));
+    return ret;
+}
 
-    android::String8 strParams = params.flatten();
-    char *ret = strdup(strParams.string());
+static int window_shim_enqueue_buffer(struct preview_stream_ops *w,
+        buffer_handle_t *buffer)
+{
+    preview_window_shim_t *shim = WINDOW_SHIM(w);
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    int64_t last;
+    int ret;
+
+    ret = shim->window->enqueue_buffer(shim->window, buffer);
+    window_shim_record(shim, CAMERA_WINDOW_ENQUEUE,
+            systemTime(SYSTEM_TIME_MONOTONIC) - start);
+    android_atomic_dec(&shim->held);
+
+    // frames are enqueued from a single vendor thread
+    last = shim->lastFrame;
+    if (last)
+        window_shim_record(shim, CAMERA_WINDOW_FRAME_INTERVAL, start - last);
+    else
+        __sync_lock_test_and_set(&shim->firstFrame, start);
+    __sync_lock_test_and_set(&shim->lastFrame, start);
+    android_atomic_inc(&shim->frames);
+    return ret;
+}
 
+static int window_shim_cancel_buffer(struct preview_stream_ops *w,
+        buffer_handle_t *buffer)
+{
+    preview_window_shim_t *shim = WINDOW_SHIM(w);
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    int ret;
+
+    ret = shim->window->cancel_buffer(shim->window, buffer);
+    window_shim_record(shim, CAMERA_WINDOW_CANCEL,
+            systemTime(SYSTEM_TIME_MONOTONIC) - start);
+    android_atomic_dec(&shim->held);
     return ret;
 }
 
-static char *camera_fixup_setparams(int id, const char *settings)
+static int window_shim_lock_buffer(struct preview_stream_ops *w,
+        buffer_handle_t *buffer)
 {
-    android::CameraParameters params;
-    params.unflatten(android::String8(settings));
+    preview_window_shim_t *shim = WINDOW_SHIM(w);
+    nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+    int ret;
 
-#if !LOG_NDEBUG
-    ALOGV("%s: original parameters:", __FUNCTION__);
-    params.dump();
-#endif
+    ret = shim->window->lock_buffer(shim->window, buffer);
+    window_shim_record(shim, CAMERA_WINDOW_LOCK,
+            systemTime(SYSTEM_TIME_MONOTONIC) - start);
+    return ret;
+}
 
-    const char *shutterSpeed = params.get("shutter-speed");
-    if (shutterSpeed) {
-        if (strcmp(shutterSpeed, "auto") != 0) {
-            params.set("sony-shutter-speed", shutterSpeed);
-            params.set(KEY_SONY_AE_MODE, "shutter-prio");
-        } else {
-            const char *aeModes = params.get(KEY_SONY_AE_MODE_VALUES);
-            if (strstr(aeModes, "auto") != NULL) {
-                params.set(KEY_SONY_AE_MODE, "auto");
-            }
-        }
-    }
+static int window_shim_set_buffer_count(struct preview_stream_ops *w,
+        int count)
+{
+    preview_stream_ops_t *window = WINDOW_SHIM(w)->window;
+    return window->set_buffer_count(window, count);
+}
 
-    if (params.get(KEY_ISO_MODE)) {
-        const char *isoMode = params.get(KEY_ISO_MODE);
-        if (strcmp(isoMode, "auto") != 0) {
-            params.set(KEY_SONY_ISO_MODE, isoMode + 3);
-        }
-        if (params.get(KEY_SONY_AE_MODE_VALUES)) {
-            const char *aeModes = params.get(KEY_SONY_AE_MODE_VALUES);
-            if (strcmp(isoMode, "auto") == 0) {
-                if ((strstr(aeModes, "auto") != NULL) &&
-                    (strcmp(params.get(KEY_SONY_AE_MODE), "shutter-prio") != 0)) {
-                    params.set(KEY_SONY_AE_MODE, "auto");
-                }
-            } else {
-                if (strstr(aeModes, "iso-prio") != NULL) {
-                    if (strcmp(params.get(KEY_SONY_AE_MODE), "shutter-prio") == 0) {
-                        params.set(KEY_SONY_AE_MODE, "manual");
-                    } else {
-                        params.set(KEY_SONY_AE_MODE, "iso-prio");
-                    }
-                }
-            }
-        }
-    }
+static int window_shim_set_buffers_geometry(struct preview_stream_ops *w,
+        int width, int height, int format)
+{
+    preview_stream_ops_t *window = WINDOW_SHIM(w)->window;
+    return window->set_buffers_geometry(window, width, height, format);
+}
 
-    if (params.get(android::CameraParameters::KEY_SCENE_MODE)) {
-        const char *sceneMode = params.get(android::CameraParameters::KEY_SCENE_MODE);
-        if (strcmp(sceneMode, "hdr") == 0) {
-            params.set(KEY_SONY_IMAGE_STABILISER, VALUE_SONY_STILL_HDR);
-            params.set(android::CameraParameters::KEY_SCENE_MODE, android::CameraParameters::SCENE_MODE_AUTO);
-        } else {
-            params.set(KEY_SONY_IMAGE_STABILISER, VALUE_SONY_ON);
-        }
-    }
+static int window_shim_set_crop(struct preview_stream_ops *w,
+        int left, int top, int right, int bottom)
+{
+    preview_stream_ops_t *window = WINDOW_SHIM(w)->window;
+    return window->set_crop(window, left, top, right, bottom);
+}
 
-    if (params.get(KEY_SONY_VIDEO_HDR) && params.get("video-hdr")) {
-        //params.set("video-hdr-values", params.get(KEY_SONY_VIDEO_HDR_VALUES));
-        params.set(KEY_SONY_VIDEO_HDR, params.get("video-hdr"));
-    }
+static int window_shim_set_usage(struct preview_stream_ops *w, int usage)
+{
+    preview_stream_ops_t *window = WINDOW_SHIM(w)->window;
+    return window->set_usage(window, usage);
+}
 
-    if (params.get(android::CameraParameters::KEY_RECORDING_HINT)) {
-        if (strcmp(params.get(android::CameraParameters::KEY_RECORDING_HINT), android::CameraParameters::TRUE) == 0) {
-            if (params.get(KEY_SONY_VIDEO_STABILISER_VALUES) && (strstr(params.get(KEY_SONY_VIDEO_STABILISER_VALUES), VALUE_SONY_INTELLIGENT_ACTIVE) != NULL) ) {
-                params.set(KEY_SONY_VIDEO_STABILISER, VALUE_SONY_INTELLIGENT_ACTIVE);
-            } else {
-                params.set(KEY_SONY_VIDEO_STABILISER, VALUE_SONY_ON);
-            }
-            params.set(KEY_SONY_IMAGE_STABILISER, VALUE_SONY_OFF);
-        }
+static int window_shim_set_swap_interval(struct preview_stream_ops *w,
+        int interval)
+{
+    preview_stream_ops_t *window = WINDOW_SHIM(w)->window;
+    return window->set_swap_interval(window, interval);
+}
+
+static int window_shim_get_min_undequeued_buffer_count(
+        const struct preview_stream_ops *w, int *count)
+{
+    const preview_stream_ops_t *window = WINDOW_SHIM(w)->window;
+    return window->get_min_undequeued_buffer_count(window, count);
+}
+
+static int window_shim_set_timestamp(struct preview_stream_ops *w,
+        int64_t timestamp)
+{
+    preview_stream_ops_t *window = WINDOW_SHIM(w)->window;
+    return window->set_timestamp(window, timestamp);
+}
+
+/* returns the window to hand to the vendor */
+static preview_stream_ops_t *window_shim_attach(wrapper_camera_device_t *dev,
+        preview_stream_ops_t *window)
+{
+    preview_window_shim_t *shim = &dev->windowShim;
+
+    if (!dev->windowStats || !window)
+        return window;
+
+    if (shim->window != window) {
+        shim->held = 0;
+        shim->frames = 0;
+        shim->firstFrame = 0;
+        shim->lastFrame = 0;
     }
 
-#if !LOG_NDEBUG
-    ALOGV("%s: fixed parameters:", __FUNCTION__);
-    params.dump();
-#endif
+    shim->ops.dequeue_buffer = window_shim_dequeue_buffer;
+    shim->ops.enqueue_buffer = window_shim_enqueue_buffer;
+    shim->ops.cancel_buffer = window_shim_cancel_buffer;
+    shim->ops.set_buffer_count = window_shim_set_buffer_count;
+    shim->ops.set_buffers_geometry = window_shim_set_buffers_geometry;
+    shim->ops.set_crop = window_shim_set_crop;
+    shim->ops.set_usage = window_shim_set_usage;
+    shim->ops.set_swap_interval = window_shim_set_swap_interval;
+    shim->ops.get_min_undequeued_buffer_count =
+            window_shim_get_min_undequeued_buffer_count;
+    shim->ops.lock_buffer = window_shim_lock_buffer;
+    shim->ops.set_timestamp = window_shim_set_timestamp;
+    shim->id = dev->id;
+    shim->window = window;
+    return &shim->ops;
+}
 
-    android::String8 strParams = params.flatten();
-    char *ret = strdup(strParams.string());
+static void window_shim_dump(wrapper_camera_device_t *dev,
+        android::String8 &out)
+{
+    preview_window_shim_t *shim = &dev->windowShim;
+    int64_t elapsed = shim->lastFrame - shim->firstFrame;
+    int32_t frames = shim->frames;
 
-    return ret;
+    if (!dev->windowStats || !shim->window)
+        return;
+
+    out.appendFormat("   Preview window: held by vendor=%d max held=%d "
+            "frames=%d fps=%.1f dequeue failures=%d\n", shim->held,
+            shim->maxHeld, frames,
+            frames > 1 && elapsed > 0 ? (frames - 1) * 1e9 / elapsed : 0.0,
+            shim->dequeueFails);
 }
 
 /*******************************************************************
@@ -310,11 +3211,16 @@ static int camera_set_preview_window(struct camera_device *device,
 {
     ALOGV("%s->%08X->%08X", __FUNCTION__, (uintptr_t)device,
             (uintptr_t)(((wrapper_camera_device_t*)device)->vendor));
+    WRAPPER_TRACE_CALL();
 
     if (!device)
         return -EINVAL;
 
-    return VENDOR_CALL(device, set_preview_window, window);
+    OPLOG_SCOPE(device, set_preview_window, window != NULL);
+    android::Mutex::Autolock vendorLock(((wrapper_camera_device_t*)device)->vendorLock);
+
+    return VENDOR_CALL(device, set_preview_window,
+            window_shim_attach((wrapper_camera_device_t*)device, window));
 }
 
 static void camera_set_callbacks(struct camera_device *device,
@@ -326,12 +3232,29 @@ static void camera_set_callbacks(struct camera_device *device,
 {
     ALOGV("%s->%08X->%08X", __FUNCTION__, (uintptr_t)device,
             (uintptr_t)(((wrapper_camera_device_t*)device)->vendor));
+    WRAPPER_TRACE_CALL();
 
     if (!device)
         return;
 
-    VENDOR_CALL(device, set_callbacks, notify_cb, data_cb, data_cb_timestamp,
-            get_memory, user);
+    OPLOG_SCOPE(device, set_callbacks, (notify_cb != NULL) |
+            (data_cb != NULL) << 1 | (data_cb_timestamp != NULL) << 2 |
+            (get_memory != NULL) << 3);
+    android::Mutex::Autolock vendorLock(((wrapper_camera_device_t*)device)->vendorLock);
+
+    wrapper_camera_device_t *dev = (wrapper_camera_device_t*)device;
+    dev->notify_cb = notify_cb;
+    dev->data_cb = data_cb;
+    dev->data_cb_timestamp = data_cb_timestamp;
+    dev->get_memory = get_memory;
+    dev->user = user;
+
+    VENDOR_CALL(device, set_callbacks,
+            notify_cb ? wrapper_notify_cb : NULL,
+            data_cb ? wrapper_data_cb : NULL,
+            data_cb_timestamp ? wrapper_data_cb_timestamp : NULL,
+            get_memory ? wrapper_get_memory : NULL,
+            dev);
 }
 
 static void camera_enable_msg_type(struct camera_device *device,
@@ -339,10 +3262,14 @@ static void camera_enable_msg_type(struct camera_device *device,
 {
     ALOGV("%s->%08X->%08X", __FUNCTION__, (uintptr_t)device,
             (uintptr_t)(((wrapper_camera_device_t*)device)->vendor));
+    WRAPPER_TRACE_CALL();
 
     if (!device)
         return;
 
+    OPLOG_SCOPE(device, enable_msg_type, msg_type);
+
+    android_atomic_or(msg_type, &((wrapper_camera_device_t*)device)->appMsgTypes);
     VENDOR_CALL(device, enable_msg_type, msg_type);
 }
 
@@ -351,11 +3278,18 @@ static void camera_disable_msg_type(struct camera_device *device,
 {
     ALOGV("%s->%08X->%08X", __FUNCTION__, (uintptr_t)device,
             (uintptr_t)(((wrapper_camera_device_t*)device)->vendor));
+    WRAPPER_TRACE_CALL();
 
     if (!device)
         return;
 
-    VENDOR_CALL(device, disable_msg_type, msg_type);
+    OPLOG_SCOPE(device, disable_msg_type, msg_type);
+
+    wrapper_camera_device_t *dev = (wrapper_camera_device_t*)device;
+    android_atomic_and(~msg_type, &dev->appMsgTypes);
+    msg_type &= ~wrapper_msg_types(dev);
+    if (msg_type)
+        VENDOR_CALL(device, disable_msg_type, msg_type);
 }
 
 static int camera_msg_type_enabled(struct camera_device *device,
@@ -363,10 +3297,17 @@ static int camera_msg_type_enabled(struct camera_device *device,
 {
     ALOGV("%s->%08X->%08X", __FUNCTION__, (uintptr_t)device,
             (uintptr_t)(((wrapper_camera_device_t*)device)->vendor));
+    WRAPPER_TRACE_CALL();
 
     if (!device)
         return 0;
 
+    OPLOG_SCOPE(device, msg_type_enabled, msg_type);
+
+    wrapper_camera_device_t *dev = (wrapper_camera_device_t*)device;
+    if (msg_type & wrapper_msg_types(dev))
+        return dev->appMsgTypes & msg_type;
+
     return VENDOR_CALL(device, msg_type_enabled, msg_type);
 }
 
@@ -374,10 +3315,21 @@ static int camera_start_preview(struct camera_device *device)
 {
     ALOGV("%s->%08X->%08X", __FUNCTION__, (uintptr_t)device,
             (uintptr_t)(((wrapper_camera_device_t*)device)->vendor));
+    WRAPPER_TRACE_CALL();
 
     if (!device)
         return -EINVAL;
 
+    OPLOG_SCOPE(device, start_preview);
+
+    wrapper_camera_device_t *dev = (wrapper_camera_device_t*)device;
+    android::Mutex::Autolock vendorLock(dev->vendorLock);
+    int32_t msgTypes = wrapper_msg_types(dev);
+
+    params_flush(dev);
+    latency_preview_start(dev, true);
+    if (msgTypes)
+        VENDOR_CALL(device, enable_msg_type, msgTypes);
     return VENDOR_CALL(device, start_preview);
 }
 
@@ -385,21 +3337,33 @@ static void camera_stop_preview(struct camera_device *device)
 {
     ALOGV("%s->%08X->%08X", __FUNCTION__, (uintptr_t)device,
             (uintptr_t)(((wrapper_camera_device_t*)device)->vendor));
+    WRAPPER_TRACE_CALL();
 
     if (!device)
         return;
 
+    OPLOG_SCOPE(device, stop_preview);
+    android::Mutex::Autolock vendorLock(((wrapper_camera_device_t*)device)->vendorLock);
+
+    capture_queue_clear((wrapper_camera_device_t*)device);
+    latency_preview_start((wrapper_camera_device_t*)device, false);
+    focus_flush((wrapper_camera_device_t*)device);
     VENDOR_CALL(device, stop_preview);
+    focus_reset((wrapper_camera_device_t*)device);
 }
 
 static int camera_preview_enabled(struct camera_device *device)
 {
     ALOGV("%s->%08X->%08X", __FUNCTION__, (uintptr_t)device,
             (uintptr_t)(((wrapper_camera_device_t*)device)->vendor));
+    WRAPPER_TRACE_CALL();
 
     if (!device)
         return -EINVAL;
 
+    OPLOG_SCOPE(device, preview_enabled);
+    android::Mutex::Autolock vendorLock(((wrapper_camera_device_t*)device)->vendorLock);
+
     return VENDOR_CALL(device, preview_enabled);
 }
 
@@ -408,10 +3372,14 @@ static int camera_store_meta_data_in_buffers(struct camera_device *device,
 {
     ALOGV("%s->%08X->%08X", __FUNCTION__, (uintptr_t)device,
             (uintptr_t)(((wrapper_camera_device_t*)device)->vendor));
+    WRAPPER_TRACE_CALL();
 
     if (!device)
         return -EINVAL;
 
+    OPLOG_SCOPE(device, store_meta_data_in_buffers, enable);
+    android::Mutex::Autolock vendorLock(((wrapper_camera_device_t*)device)->vendorLock);
+
     return VENDOR_CALL(device, store_meta_data_in_buffers, enable);
 }
 
@@ -419,10 +3387,17 @@ static int camera_start_recording(struct camera_device *device)
 {
     ALOGV("%s->%08X->%08X", __FUNCTION__, (uintptr_t)device,
             (uintptr_t)(((wrapper_camera_device_t*)device)->vendor));
+    WRAPPER_TRACE_CALL();
 
     if (!device)
         return EINVAL;
 
+    OPLOG_SCOPE(device, start_recording);
+    android::Mutex::Autolock vendorLock(((wrapper_camera_device_t*)device)->vendorLock);
+
+    params_flush((wrapper_camera_device_t*)device);
+    focus_flush((wrapper_camera_device_t*)device);
+    recording_frames_reset((wrapper_camera_device_t*)device);
     return VENDOR_CALL(device, start_recording);
 }
 
@@ -430,10 +3405,14 @@ static void camera_stop_recording(struct camera_device *device)
 {
     ALOGV("%s->%08X->%08X", __FUNCTION__, (uintptr_t)device,
             (uintptr_t)(((wrapper_camera_device_t*)device)->vendor));
+    WRAPPER_TRACE_CALL();
 
     if (!device)
         return;
 
+    OPLOG_SCOPE(device, stop_recording);
+    android::Mutex::Autolock vendorLock(((wrapper_camera_device_t*)device)->vendorLock);
+
     VENDOR_CALL(device, stop_recording);
 }
 
@@ -441,10 +3420,14 @@ static int camera_recording_enabled(struct camera_device *device)
 {
     ALOGV("%s->%08X->%08X", __FUNCTION__, (uintptr_t)device,
             (uintptr_t)(((wrapper_camera_device_t*)device)->vendor));
+    WRAPPER_TRACE_CALL();
 
     if (!device)
         return -EINVAL;
 
+    OPLOG_SCOPE(device, recording_enabled);
+    android::Mutex::Autolock vendorLock(((wrapper_camera_device_t*)device)->vendorLock);
+
     return VENDOR_CALL(device, recording_enabled);
 }
 
@@ -453,10 +3436,14 @@ static void camera_release_recording_frame(struct camera_device *device,
 {
     ALOGV("%s->%08X->%08X", __FUNCTION__, (uintptr_t)device,
             (uintptr_t)(((wrapper_camera_device_t*)device)->vendor));
+    WRAPPER_TRACE_CALL();
 
     if (!device)
         return;
 
+    OPLOG_SCOPE(device, release_recording_frame, (int32_t)(uintptr_t)opaque);
+
+    recording_frame_released((wrapper_camera_device_t*)device, opaque);
     VENDOR_CALL(device, release_recording_frame, opaque);
 }
 
@@ -464,11 +3451,20 @@ static int camera_auto_focus(struct camera_device *device)
 {
     ALOGV("%s->%08X->%08X", __FUNCTION__, (uintptr_t)device,
             (uintptr_t)(((wrapper_camera_device_t*)device)->vendor));
+    WRAPPER_TRACE_CALL();
 
     if (!device)
         return -EINVAL;
 
+    OPLOG_SCOPE(device, auto_focus);
+
+    wrapper_camera_device_t *dev = (wrapper_camera_device_t*)device;
+    android::Mutex::Autolock vendorLock(dev->vendorLock);
 
+    params_flush(dev);
+    latency_focus_start(dev, true);
+    if (dev->focusCoalesce)
+        return focus_request(dev);
     return VENDOR_CALL(device, auto_focus);
 }
 
@@ -476,10 +3472,19 @@ static int camera_cancel_auto_focus(struct camera_device *device)
 {
     ALOGV("%s->%08X->%08X", __FUNCTION__, (uintptr_t)device,
             (uintptr_t)(((wrapper_camera_device_t*)device)->vendor));
+    WRAPPER_TRACE_CALL();
 
     if (!device)
         return -EINVAL;
 
+    OPLOG_SCOPE(device, cancel_auto_focus);
+
+    wrapper_camera_device_t *dev = (wrapper_camera_device_t*)device;
+    android::Mutex::Autolock vendorLock(dev->vendorLock);
+
+    latency_focus_start(dev, false);
+    if (dev->focusCoalesce)
+        return focus_cancel(dev);
     return VENDOR_CALL(device, cancel_auto_focus);
 }
 
@@ -487,15 +3492,34 @@ static int camera_take_picture(struct camera_device *device)
 {
     ALOGV("%s->%08X->%08X", __FUNCTION__, (uintptr_t)device,
             (uintptr_t)(((wrapper_camera_device_t*)device)->vendor));
+    WRAPPER_TRACE_CALL();
 
     if (!device)
         return -EINVAL;
 
-    // We safely avoid returning the exact result of VENDOR_CALL here. If ZSL
-    // really bumps fast, take_picture will be called while a picture is already being
-    // taken, leading to "picture already running" error, crashing Gallery app. Afaik,
+    OPLOG_SCOPE(device, take_picture);
+
+    wrapper_camera_device_t *dev = (wrapper_camera_device_t*)device;
+    int32_t msgTypes = dev->appMsgTypes & CAPTURE_MSG_TYPES;
+    int rv;
+
+    // If ZSL really bumps fast, take_picture will be called while a picture
+    // is already being taken, leading to "picture already running" error,
+    // crashing Gallery app. Such requests are queued and handed to the
+    // vendor once the JPEG of the previous one has been delivered.
+    rv = capture_queue_request(dev, msgTypes);
+    if (rv <= 0)
+        return rv;
+
+    android::Mutex::Autolock vendorLock(dev->vendorLock);
+    params_flush(dev);
+    focus_flush(dev);
+    latency_picture_start(dev);
+
+    // We safely avoid returning the exact result of VENDOR_CALL here. Afaik,
     // there is no issue doing 0 (error appears in logcat anyway if needed).
-    VENDOR_CALL(device, take_picture);
+    if (VENDOR_CALL(device, take_picture))
+        capture_queue_complete(dev);
 
     return 0;
 }
@@ -504,10 +3528,15 @@ static int camera_cancel_picture(struct camera_device *device)
 {
     ALOGV("%s->%08X->%08X", __FUNCTION__, (uintptr_t)device,
             (uintptr_t)(((wrapper_camera_device_t*)device)->vendor));
+    WRAPPER_TRACE_CALL();
 
     if (!device)
         return -EINVAL;
 
+    OPLOG_SCOPE(device, cancel_picture);
+    android::Mutex::Autolock vendorLock(((wrapper_camera_device_t*)device)->vendorLock);
+
+    capture_queue_clear((wrapper_camera_device_t*)device);
     return VENDOR_CALL(device, cancel_picture);
 }
 
@@ -516,28 +3545,45 @@ static int camera_set_parameters(struct camera_device *device,
 {
     ALOGV("%s->%08X->%08X", __FUNCTION__, (uintptr_t)device,
             (uintptr_t)(((wrapper_camera_device_t*)device)->vendor));
+    WRAPPER_TRACE_CALL();
 
     if (!device)
         return -EINVAL;
 
-    char *tmp = NULL;
-    tmp = camera_fixup_setparams(CAMERA_ID(device), params);
+    OPLOG_SCOPE(device, set_parameters, 0, 0, 0, params);
 
-    int ret = VENDOR_CALL(device, set_parameters, tmp);
-    return ret;
+    wrapper_camera_device_t *dev = (wrapper_camera_device_t*)device;
+
+    // Apps pushing parameters on every slider move would otherwise wait
+    // for the vendor to reconfigure each time; in async mode only the
+    // newest set is applied, off the caller's thread.
+    if (dev->asyncParams)
+        return params_submit(dev, params);
+
+    android::Mutex::Autolock vendorLock(dev->vendorLock);
+    android::Mutex::Autolock lock(dev->paramsLock);
+    return params_apply_locked(dev, params);
 }
 
 static char *camera_get_parameters(struct camera_device *device)
 {
     ALOGV("%s->%08X->%08X", __FUNCTION__, (uintptr_t)device,
             (uintptr_t)(((wrapper_camera_device_t*)device)->vendor));
+    WRAPPER_TRACE_CALL();
 
     if (!device)
         return NULL;
 
-    char *params = VENDOR_CALL(device, get_parameters);
+    OPLOG_SCOPE(device, get_parameters);
+
+    char *params = params_get_pending((wrapper_camera_device_t*)device);
+    if (params)
+        return params;
+
+    android::Mutex::Autolock vendorLock(((wrapper_camera_device_t*)device)->vendorLock);
+    params = VENDOR_CALL(device, get_parameters);
 
-    char *tmp = camera_fixup_getparams(CAMERA_ID(device), params);
+    char *tmp = camera_fixup_getparams((wrapper_camera_device_t*)device, params);
     VENDOR_CALL(device, put_parameters, params);
     params = tmp;
 
@@ -548,6 +3594,7 @@ static void camera_put_parameters(struct camera_device *device, char *params)
 {
     ALOGV("%s->%08X->%08X", __FUNCTION__, (uintptr_t)device,
             (uintptr_t)(((wrapper_camera_device_t*)device)->vendor));
+    WRAPPER_TRACE_CALL();
 
     if (params)
         free(params);
@@ -558,10 +3605,19 @@ static int camera_send_command(struct camera_device *device,
 {
     ALOGV("%s->%08X->%08X", __FUNCTION__, (uintptr_t)device,
             (uintptr_t)(((wrapper_camera_device_t*)device)->vendor));
+    WRAPPER_TRACE_CALL();
 
     if (!device)
         return -EINVAL;
 
+    OPLOG_SCOPE(device, send_command, cmd, arg1, arg2);
+    android::Mutex::Autolock vendorLock(((wrapper_camera_device_t*)device)->vendorLock);
+
+    if (cmd == CAMERA_CMD_WRAPPER_RESET_STATS) {
+        camera_stats_reset(CAMERA_ID(device));
+        return 0;
+    }
+
     return VENDOR_CALL(device, send_command, cmd, arg1, arg2);
 }
 
@@ -569,24 +3625,88 @@ static void camera_release(struct camera_device *device)
 {
     ALOGV("%s->%08X->%08X", __FUNCTION__, (uintptr_t)device,
             (uintptr_t)(((wrapper_camera_device_t*)device)->vendor));
+    WRAPPER_TRACE_CALL();
 
     if (!device)
         return;
 
+    OPLOG_SCOPE(device, release);
+    android::Mutex::Autolock vendorLock(((wrapper_camera_device_t*)device)->vendorLock);
+
+    capture_queue_clear((wrapper_camera_device_t*)device);
+    focus_flush((wrapper_camera_device_t*)device);
     VENDOR_CALL(device, release);
+    focus_reset((wrapper_camera_device_t*)device);
+    // nothing may reach the service once it has released the camera,
+    // whatever the vendor still calls back with is dropped
+    dispatch_stop((wrapper_camera_device_t*)device);
+    recording_frames_reset((wrapper_camera_device_t*)device);
 }
 
 static int camera_dump(struct camera_device *device, int fd)
 {
     ALOGV("%s->%08X->%08X", __FUNCTION__, (uintptr_t)device,
             (uintptr_t)(((wrapper_camera_device_t*)device)->vendor));
+    WRAPPER_TRACE_CALL();
 
     if (!device)
         return -EINVAL;
 
+    OPLOG_SCOPE(device, dump, fd);
+
+    android::String8 out;
+
+    camera_stats_dump(CAMERA_ID(device), fd);
+    capture_queue_dump((wrapper_camera_device_t*)device, out);
+    params_dump((wrapper_camera_device_t*)device, out);
+    recording_dump((wrapper_camera_device_t*)device, out);
+    window_shim_dump((wrapper_camera_device_t*)device, out);
+    dispatch_dump((wrapper_camera_device_t*)device, out);
+    auto_hdr_dump((wrapper_camera_device_t*)device, out);
+    preview_cb_dump((wrapper_camera_device_t*)device, out);
+    capability_index_dump((wrapper_camera_device_t*)device, out);
+    focus_dump((wrapper_camera_device_t*)device, out);
+    memory_pool_dump((wrapper_camera_device_t*)device, out);
+    camera_oplog_dump(((wrapper_camera_device_t*)device)->oplog, out);
+    camera_preview_ring_dump(((wrapper_camera_device_t*)device)->previewRing,
+            out);
+    camera_watchdog_dump(((wrapper_camera_device_t*)device)->watchdog, out);
+    camera_stats_write(fd, out);
+
     return VENDOR_CALL(device, dump, fd);
 }
 
+/* release_recording_frame in pass-through mode, made for every video
+ * frame: the recording frame tracker still sees the release and the vendor
+ * still gets its own device, only the trace, the stats timer and the
+ * ALOGV are left out */
+static void camera_release_recording_frame_direct(struct camera_device *device,
+        const void *opaque)
+{
+    wrapper_camera_device_t *dev = (wrapper_camera_device_t*)device;
+
+    recording_frame_released(dev, opaque);
+    dev->vendor->ops->release_recording_frame(dev->vendor, opaque);
+}
+
+/* Installs the thin forwarders for the per-frame ops. The vendor's own
+ * functions are not handed out: they would be called with the wrapper's
+ * device, and nothing says the vendor only looks at its priv. Ops that
+ * are logged are kept in the wrapper. */
+static void passthrough_install(wrapper_camera_device_t *dev,
+        camera_device_ops_t *ops)
+{
+    if (!dev->passthrough)
+        return;
+    if (dev->oplog) {
+        ALOGW("%s: op log enabled, not passing ops through", __FUNCTION__);
+        dev->passthrough = false;
+        return;
+    }
+
+    ops->release_recording_frame = camera_release_recording_frame_direct;
+}
+
 extern "C" void heaptracker_free_leaked_memory(void);
 
 static int camera_device_close(hw_device_t *device)
@@ -595,21 +3715,33 @@ static int camera_device_close(hw_device_t *device)
     wrapper_camera_device_t *wrapper_dev = NULL;
 
     ALOGV("%s", __FUNCTION__);
+    WRAPPER_TRACE_CALL();
 
-    android::Mutex::Autolock lock(gCameraWrapperLock);
-
-    if (!device) {
-        ret = -EINVAL;
-        goto done;
-    }
+    if (!device)
+        return -EINVAL;
 
     wrapper_dev = (wrapper_camera_device_t*) device;
+    android::Mutex::Autolock lock(camera_lock(wrapper_dev->id));
 
+    camera_worker_stop(wrapper_dev);
+    dispatch_stop(wrapper_dev);
     wrapper_dev->vendor->common.close((hw_device_t*)wrapper_dev->vendor);
+    camera_oplog_close(wrapper_dev->oplog);
+    camera_preview_ring_close(wrapper_dev->previewRing);
+    camera_watchdog_close(wrapper_dev->watchdog);
+    memory_pool_close(wrapper_dev);
+    preview_cb_release(wrapper_dev);
+    free(wrapper_dev->pendingParams);
+    free(wrapper_dev->lastParams);
+    capability_index_release(wrapper_dev);
+    fixup_arena_release(&wrapper_dev->setArena);
+    fixup_arena_release(&wrapper_dev->getArena);
     if (wrapper_dev->base.ops)
         free(wrapper_dev->base.ops);
-    free(wrapper_dev);
-done:
+    // the camera is only free again once the vendor has closed it
+    if (wrapper_dev->id < CAMERA_STATS_MAX_CAMERAS)
+        gCameraDevices[wrapper_dev->id] = NULL;
+    delete wrapper_dev;
 #ifdef HEAPTRACKER
     heaptracker_free_leaked_memory();
 #endif
@@ -634,34 +3766,62 @@ static int camera_device_open(const hw_module_t *module, const char *name,
     int cameraid;
     wrapper_camera_device_t *camera_device = NULL;
     camera_device_ops_t *camera_ops = NULL;
-
-    android::Mutex::Autolock lock(gCameraWrapperLock);
+    android::Mutex *lock = NULL;
 
     ALOGV("%s", __FUNCTION__);
+    WRAPPER_TRACE_CALL();
 
     if (name != NULL) {
         if (check_vendor_module())
             return -EINVAL;
 
         cameraid = atoi(name);
-        num_cameras = gVendorModule->get_number_of_cameras();
+        num_cameras = gNumCameras;
 
-        if (cameraid > num_cameras) {
+        if (cameraid < 0 || cameraid >= num_cameras) {
             ALOGE("camera service provided cameraid out of bounds, "
                     "cameraid = %d, num supported = %d",
                     cameraid, num_cameras);
-            rv = -EINVAL;
+            *device = NULL;
+            return -EINVAL;
+        }
+
+        lock = &camera_lock(cameraid);
+        lock->lock();
+
+        if (cameraid < CAMERA_STATS_MAX_CAMERAS && gCameraDevices[cameraid]) {
+            ALOGE("camera %d is already open", cameraid);
+            rv = -EBUSY;
             goto fail;
         }
 
-        camera_device = (wrapper_camera_device_t*)malloc(sizeof(*camera_device));
+        camera_device = new (std::nothrow) wrapper_camera_device_t();
         if (!camera_device) {
             ALOGE("camera_device allocation fail");
             rv = -ENOMEM;
             goto fail;
         }
-        memset(camera_device, 0, sizeof(*camera_device));
         camera_device->id = cameraid;
+        camera_device->asyncParams =
+                property_get_bool("persist.camera.wrapper.async_params");
+        camera_device->windowStats =
+                property_get_bool("persist.camera.wrapper.window_stats");
+        camera_device->autoHdr.mode = auto_hdr_mode();
+        camera_device->dispatchEnabled =
+                property_get_bool("persist.camera.wrapper.dispatch");
+        camera_device->passthrough =
+                property_get_bool("persist.camera.wrapper.passthrough");
+        camera_device->focusCoalesce =
+                property_get_bool("persist.camera.wrapper.af_coalesce");
+        fixup_arena_init(&camera_device->setArena, FIXUP_ARENA_SIZE);
+        fixup_arena_init(&camera_device->getArena, FIXUP_ARENA_SIZE);
+        rv = memory_pool_open(camera_device);
+        if (rv)
+            goto fail;
+        oplog_open(camera_device);
+        preview_ring_open(camera_device);
+        if (property_get_bool("persist.camera.wrapper.watchdog"))
+            camera_device->watchdog = camera_watchdog_open(cameraid);
 
         rv = gVendorModule->common.methods->open(
                 (const hw_module_t*)gVendorModule, name,
@@ -711,21 +3871,44 @@ static int camera_device_open(const hw_module_t *module, const char *name,
         camera_ops->send_command = camera_send_command;
         camera_ops->release = camera_release;
         camera_ops->dump = camera_dump;
+        passthrough_install(camera_device, camera_ops);
 
+        rv = camera_worker_start(camera_device);
+        if (rv)
+            goto fail;
+        rv = dispatch_start(camera_device);
+        if (rv)
+            goto fail;
+
+        if (cameraid < CAMERA_STATS_MAX_CAMERAS)
+            gCameraDevices[cameraid] = camera_device;
         *device = &camera_device->base.common;
+        lock->unlock();
     }
 
     return rv;
 
 fail:
     if (camera_device) {
-        free(camera_device);
+        camera_worker_stop(camera_device);
+        if (camera_device->vendor)
+            camera_device->vendor->common.close(
+                    (hw_device_t*)camera_device->vendor);
+        fixup_arena_release(&camera_device->setArena);
+        fixup_arena_release(&camera_device->getArena);
+        memory_pool_close(camera_device);
+        camera_oplog_close(camera_device->oplog);
+        camera_preview_ring_close(camera_device->previewRing);
+        camera_watchdog_close(camera_device->watchdog);
+        delete camera_device;
         camera_device = NULL;
     }
     if (camera_ops) {
         free(camera_ops);
         camera_ops = NULL;
     }
+    if (lock)
+        lock->unlock();
     *device = NULL;
     return rv;
 }
@@ -735,7 +3918,8 @@ static int camera_get_number_of_cameras(void)
     ALOGV("%s", __FUNCTION__);
     if (check_vendor_module())
         return 0;
-    return gVendorModule->get_number_of_cameras();
+    android_atomic_inc(&camera_stats_module()->count_hits);
+    return gNumCameras;
 }
 
 static int camera_get_camera_info(int camera_id, struct camera_info *info)
@@ -743,5 +3927,11 @@ static int camera_get_camera_info(int camera_id, struct camera_info *info)
     ALOGV("%s", __FUNCTION__);
     if (check_vendor_module())
         return 0;
+    if (camera_id >= 0 && camera_id < gCachedCameras) {
+        android_atomic_inc(&camera_stats_module()->info_hits);
+        *info = gCameraInfo[camera_id];
+        return gCameraInfoStatus[camera_id];
+    }
+    android_atomic_inc(&camera_stats_module()->info_misses);
     return gVendorModule->get_camera_info(camera_id, info);
 }
@@ -0,0 +1,1207 @@
+/*
+ * Copyright (C) 2014, The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file CameraWrapperBench.cpp
+*
+* Host benchmark of what the wrapper adds on top of the vendor HAL.
+*
+* The wrapper is linked with the mock vendor HAL. Every camera_device_ops
+* entry is timed through the wrapper (camera 0) and straight on a mock
+* device (camera 1), and the difference is reported together with the
+* heap allocations and bytes the wrapper makes per call. The parameter
+* fixups are then timed again with the canned parameters of each device,
+* and release_recording_frame with persist.camera.wrapper.passthrough.
+* Preview frames are sent through the preview callback decimation, crop
+* and downscale.
+* Last, two checks make the bench fail: autofocus sequences must reach the
+* vendor coalesced as persist.camera.wrapper.af_coalesce promises, and
+* parameter get/set cycles must not grow the wrapper's heap use.
+*
+* With -s only the latency of opening camera 1 is measured, while another
+* thread keeps camera 0 in a slow vendor open or close.
+*
+* Allocations are counted by interposing the glibc allocator, so threads
+* the wrapper or the mock run during a call are counted too.
+*
+*/
+
+#define LOG_TAG "CameraWrapperBench"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <cutils/atomic.h>
+#include <utils/String8.h>
+#include <utils/threads.h>
+#include <hardware/hardware.h>
+#include <hardware/camera.h>
+
+#include "CameraMockParams.h"
+#include "CameraMockVendor.h"
+#include "CameraStats.h"
+
+#define BENCH_ITERATIONS 2000
+#define BENCH_HEAP_CYCLES 100000
+/* 1080p preview frames sent through the preview callback path */
+#define BENCH_PREVIEW_FRAMES 600
+#define BENCH_PREVIEW_WIDTH 1920
+#define BENCH_PREVIEW_HEIGHT 1080
+/* focus sweep of the mock in the autofocus check, it is well past the
+ * wrapper's 50ms cancel debounce */
+#define BENCH_FOCUS_SWEEP_US 150000
+/* camera 1 opens timed while camera 0 is held in a slow open or close */
+#define BENCH_SWITCH_OPENS 40
+#define BENCH_SWITCH_SPACING_US 37000
+/* how long to wait for a callback the mock owes before going on */
+#define BENCH_CALLBACK_TIMEOUT_NS ms2ns(1000)
+
+extern "C" void *__libc_malloc(size_t size);
+extern "C" void *__libc_calloc(size_t count, size_t size);
+extern "C" void *__libc_realloc(void *ptr, size_t size);
+extern "C" void __libc_free(void *ptr);
+
+static volatile int64_t gAllocs;
+static volatile int64_t gAllocBytes;
+
+static void count_alloc(size_t size)
+{
+    __sync_fetch_and_add(&gAllocs, 1);
+    __sync_fetch_and_add(&gAllocBytes, size);
+}
+
+/* While the heap check runs every block allocated is kept by address with
+ * the size asked for, so that live bytes do not move with the allocator's
+ * rounding. Blocks from before are not tracked and their frees ignored. */
+#define HEAP_TRACK_SLOTS (1 << 16)
+
+typedef struct heap_block {
+    void *ptr;
+    size_t size;
+} heap_block_t;
+
+static heap_block_t gHeapBlocks[HEAP_TRACK_SLOTS];
+static volatile int32_t gHeapTracking;
+static volatile int32_t gHeapLock;
+static int64_t gLive;
+static int64_t gLiveBytes;
+static bool gHeapOverflow;
+
+static size_t heap_slot(const void *ptr)
+{
+    return (size_t)(((uintptr_t)ptr >> 4) * 2654435761u) &
+            (HEAP_TRACK_SLOTS - 1);
+}
+
+static void heap_lock(void)
+{
+    while (__sync_lock_test_and_set(&gHeapLock, 1))
+        ;
+}
+
+static void heap_unlock(void)
+{
+    __sync_lock_release(&gHeapLock);
+}
+
+static void heap_track(void *ptr, size_t size)
+{
+    size_t slot;
+    int probes;
+
+    if (!ptr || !gHeapTracking)
+        return;
+
+    heap_lock();
+    slot = heap_slot(ptr);
+    for (probes = 0; probes < HEAP_TRACK_SLOTS && gHeapBlocks[slot].ptr;
+            probes++)
+        slot = (slot + 1) & (HEAP_TRACK_SLOTS - 1);
+    if (probes == HEAP_TRACK_SLOTS) {
+        gHeapOverflow = true;
+    } else {
+        gHeapBlocks[slot].ptr = ptr;
+        gHeapBlocks[slot].size = size;
+        gLive++;
+        gLiveBytes += size;
+    }
+    heap_unlock();
+}
+
+/* forgets a block, with the size it was tracked with or -1 */
+static ssize_t heap_untrack(void *ptr)
+{
+    size_t slot, next, home;
+    ssize_t size = -1;
+
+    if (!ptr || !gHeapTracking)
+        return -1;
+
+    heap_lock();
+    for (slot = heap_slot(ptr); gHeapBlocks[slot].ptr;
+            slot = (slot + 1) & (HEAP_TRACK_SLOTS - 1)) {
+        if (gHeapBlocks[slot].ptr == ptr)
+            break;
+    }
+    if (gHeapBlocks[slot].ptr) {
+        size = gHeapBlocks[slot].size;
+        gLive--;
+        gLiveBytes -= size;
+        /* pull later entries of the probe chain back over the hole */
+        for (next = (slot + 1) & (HEAP_TRACK_SLOTS - 1);
+                gHeapBlocks[next].ptr;
+                next = (next + 1) & (HEAP_TRACK_SLOTS - 1)) {
+            home = heap_slot(gHeapBlocks[next].ptr);
+            if (((next - home) & (HEAP_TRACK_SLOTS - 1)) >=
+                    ((next - slot) & (HEAP_TRACK_SLOTS - 1))) {
+                gHeapBlocks[slot] = gHeapBlocks[next];
+                slot = next;
+            }
+        }
+        gHeapBlocks[slot].ptr = NULL;
+    }
+    heap_unlock();
+    return size;
+}
+
+static void heap_track_start(void)
+{
+    heap_lock();
+    memset(gHeapBlocks, 0, sizeof(gHeapBlocks));
+    gLive = gLiveBytes = 0;
+    gHeapOverflow = false;
+    gHeapTracking = 1;
+    heap_unlock();
+}
+
+static void heap_track_stop(void)
+{
+    heap_lock();
+    gHeapTracking = 0;
+    heap_unlock();
+}
+
+extern "C" void *malloc(size_t size)
+{
+    void *ptr;
+
+    count_alloc(size);
+    ptr = __libc_malloc(size);
+    heap_track(ptr, size);
+    return ptr;
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    void *ptr;
+
+    count_alloc(count * size);
+    ptr = __libc_calloc(count, size);
+    heap_track(ptr, count * size);
+    return ptr;
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    ssize_t oldSize;
+    void *ret;
+
+    count_alloc(size);
+    /* forgotten first, another thread may get the address once it is
+     * freed */
+    oldSize = heap_untrack(ptr);
+    ret = __libc_realloc(ptr, size);
+    if (ret)
+        heap_track(ret, size);
+    else if (size && oldSize >= 0)
+        heap_track(ptr, oldSize);
+    return ret;
+}
+
+extern "C" void free(void *ptr)
+{
+    heap_untrack(ptr);
+    __libc_free(ptr);
+}
+
+static const char *op_names[CAMERA_OP_COUNT] = {
+#define CAMERA_OP_NAME(op) #op,
+    CAMERA_OP_LIST(CAMERA_OP_NAME)
+#undef CAMERA_OP_NAME
+};
+
+typedef struct bench_memory {
+    camera_memory_t mem;
+    size_t bufSize;
+} bench_memory_t;
+
+/* the device under test and what its callbacks delivered */
+typedef struct bench_ctx {
+    camera_device_t *dev;
+    int cameraId;
+    int nullFd;
+
+    android::Mutex lock;
+    android::Condition cond;
+    int32_t focused;
+    int32_t pictures;
+    const void *frame;
+
+    /* preview callbacks are copied here, as the service does for the app */
+    uint8_t *previewSink;
+    size_t previewSinkSize;
+    int32_t previewFrames;
+    int64_t previewBytes;
+
+    int32_t focusRequests;
+    int32_t pictureRequests;
+    char *params;
+    char *got;
+    const void *release;
+} bench_ctx_t;
+
+typedef struct bench_result {
+    nsecs_t ns;
+    int64_t allocs;
+    int64_t bytes;
+    int calls;
+} bench_result_t;
+
+typedef struct bench_case {
+    int op;
+    /* untimed, around each timed call; ops without either are timed in
+     * one batch */
+    void (*prepare)(bench_ctx_t *ctx);
+    void (*run)(bench_ctx_t *ctx);
+    void (*cleanup)(bench_ctx_t *ctx);
+    /* ops that start or stop something run iterations / divisor times */
+    int divisor;
+} bench_case_t;
+
+static void bench_memory_release(camera_memory_t *mem)
+{
+    free(mem->data);
+    free(mem);
+}
+
+static camera_memory_t *bench_get_memory(int fd, size_t buf_size,
+        unsigned int num_bufs, void *user)
+{
+    bench_memory_t *memory;
+
+    (void)fd;
+    (void)user;
+    memory = (bench_memory_t *)calloc(1, sizeof(*memory));
+    if (!memory)
+        return NULL;
+    memory->mem.data = calloc(num_bufs ? num_bufs : 1, buf_size);
+    if (!memory->mem.data) {
+        free(memory);
+        return NULL;
+    }
+    memory->bufSize = buf_size;
+    memory->mem.size = buf_size * num_bufs;
+    memory->mem.handle = memory;
+    memory->mem.release = bench_memory_release;
+    return &memory->mem;
+}
+
+static void bench_notify_cb(int32_t msg_type, int32_t ext1, int32_t ext2,
+        void *user)
+{
+    bench_ctx_t *ctx = (bench_ctx_t *)user;
+
+    (void)ext1;
+    (void)ext2;
+    if (msg_type != CAMERA_MSG_FOCUS)
+        return;
+    android::Mutex::Autolock lock(ctx->lock);
+    ctx->focused++;
+    ctx->cond.broadcast();
+}
+
+static void bench_data_cb(int32_t msg_type, const camera_memory_t *data,
+        unsigned int index, camera_frame_metadata_t *metadata, void *user)
+{
+    bench_ctx_t *ctx = (bench_ctx_t *)user;
+
+    (void)metadata;
+    if ((msg_type & CAMERA_MSG_PREVIEW_FRAME) && ctx->previewSink) {
+        const bench_memory_t *memory = (const bench_memory_t *)data->handle;
+        size_t size = memory->bufSize < ctx->previewSinkSize ?
+                memory->bufSize : ctx->previewSinkSize;
+
+        memcpy(ctx->previewSink,
+                (const char *)memory->mem.data + index * memory->bufSize,
+                size);
+        ctx->previewFrames++;
+        ctx->previewBytes += size;
+        return;
+    }
+    if (msg_type != CAMERA_MSG_COMPRESSED_IMAGE)
+        return;
+    android::Mutex::Autolock lock(ctx->lock);
+    ctx->pictures++;
+    ctx->cond.broadcast();
+}
+
+static void bench_data_cb_timestamp(nsecs_t timestamp, int32_t msg_type,
+        const camera_memory_t *data, unsigned int index, void *user)
+{
+    bench_ctx_t *ctx = (bench_ctx_t *)user;
+    const bench_memory_t *memory = (const bench_memory_t *)data->handle;
+
+    (void)timestamp;
+    (void)msg_type;
+    android::Mutex::Autolock lock(ctx->lock);
+    ctx->frame = (const char *)memory->mem.data + index * memory->bufSize;
+    ctx->cond.broadcast();
+}
+
+/* waits until *counter reaches target, false on timeout */
+static bool bench_wait(bench_ctx_t *ctx, int32_t *counter, int32_t target)
+{
+    android::Mutex::Autolock lock(ctx->lock);
+    nsecs_t deadline = systemTime(SYSTEM_TIME_MONOTONIC) +
+            BENCH_CALLBACK_TIMEOUT_NS;
+
+    while (*counter < target) {
+        nsecs_t left = deadline - systemTime(SYSTEM_TIME_MONOTONIC);
+        if (left <= 0)
+            return false;
+        ctx->cond.waitRelative(ctx->lock, left);
+    }
+    return true;
+}
+
+static void run_set_preview_window(bench_ctx_t *ctx)
+{
+    ctx->dev->ops->set_preview_window(ctx->dev, NULL);
+}
+
+static void run_set_callbacks(bench_ctx_t *ctx)
+{
+    ctx->dev->ops->set_callbacks(ctx->dev, bench_notify_cb, bench_data_cb,
+            bench_data_cb_timestamp, bench_get_memory, ctx);
+}
+
+static void run_enable_msg_type(bench_ctx_t *ctx)
+{
+    ctx->dev->ops->enable_msg_type(ctx->dev, CAMERA_MSG_ZOOM);
+}
+
+static void run_disable_msg_type(bench_ctx_t *ctx)
+{
+    ctx->dev->ops->disable_msg_type(ctx->dev, CAMERA_MSG_ZOOM);
+}
+
+static void run_msg_type_enabled(bench_ctx_t *ctx)
+{
+    ctx->dev->ops->msg_type_enabled(ctx->dev, CAMERA_MSG_SHUTTER);
+}
+
+static void run_start_preview(bench_ctx_t *ctx)
+{
+    ctx->dev->ops->start_preview(ctx->dev);
+}
+
+static void run_stop_preview(bench_ctx_t *ctx)
+{
+    ctx->dev->ops->stop_preview(ctx->dev);
+}
+
+static void run_preview_enabled(bench_ctx_t *ctx)
+{
+    ctx->dev->ops->preview_enabled(ctx->dev);
+}
+
+static void run_store_meta_data_in_buffers(bench_ctx_t *ctx)
+{
+    ctx->dev->ops->store_meta_data_in_buffers(ctx->dev, 0);
+}
+
+static void prepare_start_recording(bench_ctx_t *ctx)
+{
+    if (!ctx->dev->ops->preview_enabled(ctx->dev))
+        ctx->dev->ops->start_preview(ctx->dev);
+    ctx->dev->ops->stop_recording(ctx->dev);
+}
+
+static void run_start_recording(bench_ctx_t *ctx)
+{
+    ctx->dev->ops->start_recording(ctx->dev);
+}
+
+static void prepare_stop_recording(bench_ctx_t *ctx)
+{
+    if (!ctx->dev->ops->preview_enabled(ctx->dev))
+        ctx->dev->ops->start_preview(ctx->dev);
+    ctx->dev->ops->start_recording(ctx->dev);
+}
+
+static void run_stop_recording(bench_ctx_t *ctx)
+{
+    ctx->dev->ops->stop_recording(ctx->dev);
+}
+
+static void run_recording_enabled(bench_ctx_t *ctx)
+{
+    ctx->dev->ops->recording_enabled(ctx->dev);
+}
+
+static void prepare_release_recording_frame(bench_ctx_t *ctx)
+{
+    if (!ctx->dev->ops->recording_enabled(ctx->dev))
+        prepare_stop_recording(ctx);
+
+    {
+        android::Mutex::Autolock lock(ctx->lock);
+        ctx->frame = NULL;
+    }
+    camera_mock_send_frame(ctx->cameraId, CAMERA_MSG_VIDEO_FRAME);
+
+    android::Mutex::Autolock lock(ctx->lock);
+    nsecs_t deadline = systemTime(SYSTEM_TIME_MONOTONIC) +
+            BENCH_CALLBACK_TIMEOUT_NS;
+    while (!ctx->frame && deadline > systemTime(SYSTEM_TIME_MONOTONIC))
+        ctx->cond.waitRelative(ctx->lock,
+                deadline - systemTime(SYSTEM_TIME_MONOTONIC));
+    ctx->release = ctx->frame;
+}
+
+static void run_release_recording_frame(bench_ctx_t *ctx)
+{
+    if (ctx->release)
+        ctx->dev->ops->release_recording_frame(ctx->dev, ctx->release);
+}
+
+static void prepare_auto_focus(bench_ctx_t *ctx)
+{
+    bench_wait(ctx, &ctx->focused, ctx->focusRequests);
+}
+
+static void run_auto_focus(bench_ctx_t *ctx)
+{
+    ctx->dev->ops->auto_focus(ctx->dev);
+    ctx->focusRequests++;
+}
+
+static void run_cancel_auto_focus(bench_ctx_t *ctx)
+{
+    ctx->dev->ops->cancel_auto_focus(ctx->dev);
+}
+
+static void prepare_take_picture(bench_ctx_t *ctx)
+{
+    bench_wait(ctx, &ctx->pictures, ctx->pictureRequests);
+}
+
+static void run_take_picture(bench_ctx_t *ctx)
+{
+    ctx->dev->ops->take_picture(ctx->dev);
+    ctx->pictureRequests++;
+}
+
+static void run_cancel_picture(bench_ctx_t *ctx)
+{
+    ctx->dev->ops->cancel_picture(ctx->dev);
+}
+
+static void run_set_parameters(bench_ctx_t *ctx)
+{
+    ctx->dev->ops->set_parameters(ctx->dev, ctx->params);
+}
+
+static void run_get_parameters(bench_ctx_t *ctx)
+{
+    ctx->got = ctx->dev->ops->get_parameters(ctx->dev);
+}
+
+static void cleanup_get_parameters(bench_ctx_t *ctx)
+{
+    ctx->dev->ops->put_parameters(ctx->dev, ctx->got);
+    ctx->got = NULL;
+}
+
+static void run_put_parameters(bench_ctx_t *ctx)
+{
+    cleanup_get_parameters(ctx);
+}
+
+static void run_send_command(bench_ctx_t *ctx)
+{
+    ctx->dev->ops->send_command(ctx->dev, CAMERA_CMD_PING, 0, 0);
+}
+
+static void run_release(bench_ctx_t *ctx)
+{
+    ctx->dev->ops->release(ctx->dev);
+}
+
+static void run_dump(bench_ctx_t *ctx)
+{
+    ctx->dev->ops->dump(ctx->dev, ctx->nullFd);
+}
+
+static const bench_case_t bench_cases[] = {
+    { CAMERA_OP_set_preview_window, NULL, run_set_preview_window, NULL, 1 },
+    { CAMERA_OP_set_callbacks, NULL, run_set_callbacks, NULL, 1 },
+    { CAMERA_OP_enable_msg_type, NULL, run_enable_msg_type, NULL, 1 },
+    { CAMERA_OP_disable_msg_type, NULL, run_disable_msg_type, NULL, 1 },
+    { CAMERA_OP_msg_type_enabled, NULL, run_msg_type_enabled, NULL, 1 },
+    { CAMERA_OP_start_preview, run_stop_preview, run_start_preview, NULL,
+      10 },
+    { CAMERA_OP_stop_preview, run_start_preview, run_stop_preview, NULL,
+      10 },
+    { CAMERA_OP_preview_enabled, NULL, run_preview_enabled, NULL, 1 },
+    { CAMERA_OP_store_meta_data_in_buffers, NULL,
+      run_store_meta_data_in_buffers, NULL, 1 },
+    { CAMERA_OP_start_recording, prepare_start_recording,
+      run_start_recording, NULL, 10 },
+    { CAMERA_OP_stop_recording, prepare_stop_recording, run_stop_recording,
+      NULL, 10 },
+    { CAMERA_OP_recording_enabled, NULL, run_recording_enabled, NULL, 1 },
+    { CAMERA_OP_release_recording_frame, prepare_release_recording_frame,
+      run_release_recording_frame, NULL, 1 },
+    { CAMERA_OP_auto_focus, prepare_auto_focus, run_auto_focus, NULL, 10 },
+    { CAMERA_OP_cancel_auto_focus, NULL, run_cancel_auto_focus, NULL, 1 },
+    { CAMERA_OP_take_picture, prepare_take_picture, run_take_picture, NULL,
+      10 },
+    { CAMERA_OP_cancel_picture, NULL, run_cancel_picture, NULL, 1 },
+    { CAMERA_OP_set_parameters, NULL, run_set_parameters, NULL, 1 },
+    { CAMERA_OP_get_parameters, NULL, run_get_parameters,
+      cleanup_get_parameters, 1 },
+    { CAMERA_OP_put_parameters, run_get_parameters, run_put_parameters,
+      NULL, 1 },
+    { CAMERA_OP_send_command, NULL, run_send_command, NULL, 1 },
+    { CAMERA_OP_dump, NULL, run_dump, NULL, 1 },
+    { CAMERA_OP_release, NULL, run_release, NULL, 1 },
+};
+
+#define BENCH_CASE_COUNT (sizeof(bench_cases) / sizeof(bench_cases[0]))
+
+static void bench_run(bench_ctx_t *ctx, const bench_case_t *bench,
+        int iterations, bench_result_t *result)
+{
+    int64_t allocs, bytes;
+    nsecs_t start;
+
+    memset(result, 0, sizeof(*result));
+    result->calls = iterations / bench->divisor;
+    if (result->calls < 1)
+        result->calls = 1;
+
+    if (!bench->prepare && !bench->cleanup) {
+        allocs = gAllocs;
+        bytes = gAllocBytes;
+        start = systemTime(SYSTEM_TIME_MONOTONIC);
+        for (int i = 0; i < result->calls; i++)
+            bench->run(ctx);
+        result->ns = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+        result->allocs = gAllocs - allocs;
+        result->bytes = gAllocBytes - bytes;
+        return;
+    }
+
+    for (int i = 0; i < result->calls; i++) {
+        if (bench->prepare)
+            bench->prepare(ctx);
+        allocs = gAllocs;
+        bytes = gAllocBytes;
+        start = systemTime(SYSTEM_TIME_MONOTONIC);
+        bench->run(ctx);
+        result->ns += systemTime(SYSTEM_TIME_MONOTONIC) - start;
+        result->allocs += gAllocs - allocs;
+        result->bytes += gAllocBytes - bytes;
+        if (bench->cleanup)
+            bench->cleanup(ctx);
+    }
+}
+
+static int bench_open(bench_ctx_t *ctx, const hw_module_t *module,
+        int camera_id)
+{
+    char name[16];
+    int rv;
+
+    ctx->cameraId = camera_id;
+    ctx->focused = ctx->focusRequests = 0;
+    ctx->pictures = ctx->pictureRequests = 0;
+    ctx->frame = ctx->release = NULL;
+    ctx->got = NULL;
+    ctx->previewSink = NULL;
+
+    snprintf(name, sizeof(name), "%d", camera_id);
+    rv = module->methods->open(module, name, (hw_device_t **)&ctx->dev);
+    if (rv) {
+        fprintf(stderr, "cannot open %s camera %d: %d\n", module->name,
+                camera_id, rv);
+        return rv;
+    }
+
+    run_set_callbacks(ctx);
+    ctx->dev->ops->enable_msg_type(ctx->dev, CAMERA_MSG_ALL_MSGS &
+            ~CAMERA_MSG_PREVIEW_FRAME);
+    ctx->params = ctx->dev->ops->get_parameters(ctx->dev);
+    return 0;
+}
+
+static void bench_close(bench_ctx_t *ctx)
+{
+    /* callbacks the mock still owes land before the device goes */
+    bench_wait(ctx, &ctx->focused, ctx->focusRequests);
+    bench_wait(ctx, &ctx->pictures, ctx->pictureRequests);
+    ctx->dev->ops->put_parameters(ctx->dev, ctx->params);
+    ctx->dev->ops->release(ctx->dev);
+    ctx->dev->common.close(&ctx->dev->common);
+    ctx->dev = NULL;
+}
+
+static void print_row(const char *name, const bench_result_t *wrapped,
+        const bench_result_t *vendor)
+{
+    double wrappedNs = (double)wrapped->ns / wrapped->calls;
+    double vendorNs = (double)vendor->ns / vendor->calls;
+
+    printf("    %-27s %10.0f %10.0f %10.0f %8.1f %10.0f\n", name, wrappedNs,
+            vendorNs, wrappedNs - vendorNs,
+            (double)wrapped->allocs / wrapped->calls -
+                    (double)vendor->allocs / vendor->calls,
+            (double)wrapped->bytes / wrapped->calls -
+                    (double)vendor->bytes / vendor->calls);
+}
+
+static void print_header(const char *title)
+{
+    printf("   %s:\n", title);
+    printf("    %-27s %10s %10s %10s %8s %10s\n", "", "wrapper", "vendor",
+            "added", "allocs", "bytes");
+}
+
+static int bench_ops(const hw_module_t *wrapper, const hw_module_t *vendor,
+        int iterations)
+{
+    bench_ctx_t wrapped, mock;
+    bench_result_t wrappedResult, vendorResult;
+
+    wrapped.nullFd = mock.nullFd = open("/dev/null", O_WRONLY);
+    if (bench_open(&wrapped, wrapper, 0))
+        return 1;
+    if (bench_open(&mock, vendor, 1)) {
+        bench_close(&wrapped);
+        return 1;
+    }
+
+    print_header("Per op, ns and added allocations per call");
+    for (size_t i = 0; i < BENCH_CASE_COUNT; i++) {
+        bench_run(&wrapped, &bench_cases[i], iterations, &wrappedResult);
+        bench_run(&mock, &bench_cases[i], iterations, &vendorResult);
+        print_row(op_names[bench_cases[i].op], &wrappedResult,
+                &vendorResult);
+    }
+
+    bench_close(&wrapped);
+    bench_close(&mock);
+    close(wrapped.nullFd);
+    return 0;
+}
+
+static int bench_params(const hw_module_t *wrapper,
+        const hw_module_t *vendor, int iterations)
+{
+    static const bench_case_t cases[] = {
+        { CAMERA_OP_get_parameters, NULL, run_get_parameters,
+          cleanup_get_parameters, 1 },
+        { CAMERA_OP_set_parameters, NULL, run_set_parameters, NULL, 1 },
+    };
+    bench_ctx_t wrapped, mock;
+    bench_result_t wrappedResult, vendorResult;
+    char name[64];
+
+    print_header("Parameters, ns and added allocations per call");
+    for (size_t p = 0; p < CAMERA_MOCK_PARAMS_COUNT; p++) {
+        camera_mock_set_params(camera_mock_params[p].params);
+        wrapped.nullFd = mock.nullFd = -1;
+        if (bench_open(&wrapped, wrapper, 0))
+            return 1;
+        if (bench_open(&mock, vendor, 1)) {
+            bench_close(&wrapped);
+            return 1;
+        }
+
+        for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+            bench_run(&wrapped, &cases[i], iterations, &wrappedResult);
+            bench_run(&mock, &cases[i], iterations, &vendorResult);
+            snprintf(name, sizeof(name), "%s %s", camera_mock_params[p].device,
+                    op_names[cases[i].op]);
+            print_row(name, &wrappedResult, &vendorResult);
+        }
+
+        bench_close(&wrapped);
+        bench_close(&mock);
+    }
+    camera_mock_set_params(NULL);
+    return 0;
+}
+
+/* Runs get_parameters/set_parameters/put_parameters cycles on a canned
+ * device in the AE modes whose translation used to leak the ISO value and
+ * the translated parameter string, 1 if the heap grew after the first */
+static int bench_heap(const hw_module_t *wrapper, int cycles)
+{
+    static const char *modes[] = {
+        "sony-ae-mode=iso-prio;sony-iso=200",
+        "sony-ae-mode=manual;sony-iso=400;sony-shutter-speed=1/60",
+    };
+    bench_ctx_t ctx;
+    int grew = 0;
+
+    printf("   Heap over %d parameter cycles, live blocks and bytes:\n",
+            cycles);
+    printf("    %-27s %10s %10s %10s %10s\n", "", "first", "bytes",
+            "last", "bytes");
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        android::String8 params(camera_mock_params[0].params);
+        int64_t live = 0, liveBytes = 0;
+        char name[64];
+
+        /* later keys win when the mock unflattens them */
+        params.appendFormat(";%s", modes[m]);
+        camera_mock_set_params(params.string());
+        ctx.nullFd = -1;
+        if (bench_open(&ctx, wrapper, 0))
+            return 1;
+
+        /* one untracked cycle has the vendor take the translated
+         * parameters, values the wrapper caches then stop changing */
+        for (int i = -1; i < cycles; i++) {
+            if (i == 0)
+                heap_track_start();
+            run_get_parameters(&ctx);
+            ctx.dev->ops->set_parameters(ctx.dev, ctx.got);
+            cleanup_get_parameters(&ctx);
+            if (i == 0) {
+                live = gLive;
+                liveBytes = gLiveBytes;
+            }
+        }
+
+        heap_track_stop();
+
+        snprintf(name, sizeof(name), "%s %.*s", camera_mock_params[0].device,
+                (int)strcspn(modes[m], ";"), modes[m]);
+        printf("    %-27s %10lld %10lld %10lld %10lld%s\n", name,
+                (long long)live, (long long)liveBytes, (long long)gLive,
+                (long long)gLiveBytes, gHeapOverflow ? "  OVERFLOW" :
+                gLive > live || gLiveBytes > liveBytes ? "  GREW" : "");
+        if (gHeapOverflow || gLive > live || gLiveBytes > liveBytes)
+            grew = 1;
+
+        bench_close(&ctx);
+    }
+    camera_mock_set_params(NULL);
+    return grew;
+}
+
+/* release_recording_frame with and without
+ * persist.camera.wrapper.passthrough, opened afresh for each */
+static int bench_passthrough(const hw_module_t *wrapper,
+        const hw_module_t *vendor, int iterations)
+{
+    static const bench_case_t release = {
+        CAMERA_OP_release_recording_frame, prepare_release_recording_frame,
+        run_release_recording_frame, NULL, 1
+    };
+    bench_ctx_t wrapped, mock;
+    bench_result_t wrappedResult, vendorResult;
+
+    print_header("Pass-through, ns and added allocations per call");
+    for (int on = 0; on < 2; on++) {
+        camera_mock_set_property("persist.camera.wrapper.passthrough",
+                on ? "1" : NULL);
+        wrapped.nullFd = mock.nullFd = -1;
+        if (bench_open(&wrapped, wrapper, 0))
+            return 1;
+        if (bench_open(&mock, vendor, 1)) {
+            bench_close(&wrapped);
+            return 1;
+        }
+
+        bench_run(&wrapped, &release, iterations, &wrappedResult);
+        bench_run(&mock, &release, iterations, &vendorResult);
+        print_row(on ? "release_recording_frame pt" :
+                "release_recording_frame", &wrappedResult, &vendorResult);
+
+        bench_close(&wrapped);
+        bench_close(&mock);
+    }
+    camera_mock_set_property("persist.camera.wrapper.passthrough", NULL);
+    return 0;
+}
+
+/* Sends 1080p preview frames through the wrapper's preview callback path
+ * with the decimation, crop and downscale settings the app may ask for. */
+static int bench_preview_cb(const hw_module_t *wrapper)
+{
+    static const struct {
+        const char *name;
+        const char *params;
+    } configs[] = {
+        { "none", "" },
+        { "interval 3", "wrapper-preview-cb-interval=3" },
+        { "roi 640x480", "wrapper-preview-cb-roi=640,300,1280,780" },
+        { "interval 3, roi 640x480", "wrapper-preview-cb-interval=3;"
+          "wrapper-preview-cb-roi=640,300,1280,780" },
+        { "size 480x270", "wrapper-preview-cb-size=480x270" },
+        { "roi 640x480, size 320x240", "wrapper-preview-cb-size=320x240;"
+          "wrapper-preview-cb-roi=640,300,1280,780" },
+    };
+    android::String8 params(camera_mock_params[0].params);
+    bench_ctx_t ctx;
+    nsecs_t start, elapsed;
+    int rv = 0;
+
+    params.appendFormat(";preview-size=%dx%d;preview-format=yuv420sp",
+            BENCH_PREVIEW_WIDTH, BENCH_PREVIEW_HEIGHT);
+    camera_mock_set_params(params.string());
+    ctx.nullFd = -1;
+    if (bench_open(&ctx, wrapper, 0)) {
+        camera_mock_set_params(NULL);
+        return 1;
+    }
+    ctx.previewSinkSize = (size_t)BENCH_PREVIEW_WIDTH * BENCH_PREVIEW_HEIGHT *
+            3 / 2;
+    ctx.previewSink = (uint8_t *)malloc(ctx.previewSinkSize);
+    if (!ctx.previewSink) {
+        rv = 1;
+        goto out;
+    }
+    ctx.dev->ops->enable_msg_type(ctx.dev, CAMERA_MSG_PREVIEW_FRAME);
+    ctx.dev->ops->start_preview(ctx.dev);
+
+    printf("   Preview callbacks, %dx%d NV21, %d frames copied by the app:\n",
+            BENCH_PREVIEW_WIDTH, BENCH_PREVIEW_HEIGHT, BENCH_PREVIEW_FRAMES);
+    printf("    %-27s %10s %10s %10s\n", "", "delivered", "B/frame",
+            "us/frame");
+    for (size_t i = 0; i < sizeof(configs) / sizeof(configs[0]); i++) {
+        android::String8 set(ctx.params);
+
+        if (configs[i].params[0])
+            set.appendFormat(";%s", configs[i].params);
+        ctx.dev->ops->set_parameters(ctx.dev, set.string());
+        ctx.previewFrames = 0;
+        ctx.previewBytes = 0;
+
+        start = systemTime(SYSTEM_TIME_MONOTONIC);
+        for (int f = 0; f < BENCH_PREVIEW_FRAMES; f++)
+            camera_mock_send_frame(0, CAMERA_MSG_PREVIEW_FRAME);
+        elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+
+        printf("    %-27s %10d %10lld %10.0f\n", configs[i].name,
+                ctx.previewFrames,
+                (long long)(ctx.previewBytes / BENCH_PREVIEW_FRAMES),
+                elapsed / 1e3 / BENCH_PREVIEW_FRAMES);
+    }
+
+    ctx.dev->ops->stop_preview(ctx.dev);
+    ctx.dev->ops->disable_msg_type(ctx.dev, CAMERA_MSG_PREVIEW_FRAME);
+out:
+    bench_close(&ctx);
+    free(ctx.previewSink);
+    camera_mock_set_params(NULL);
+    return rv;
+}
+
+typedef struct focus_step {
+    const char *name;
+    /* 'a' auto_focus, 'c' cancel_auto_focus, digits sleep that many ms */
+    const char *ops;
+    /* vendor calls made and focus results the service got, counted once
+     * the mock's sweep is over */
+    int autoFocus;
+    int cancels;
+    int results;
+    /* vendor cancels expected right after the ops, -1 to not check */
+    int cancelsEarly;
+} focus_step_t;
+
+static int64_t focus_vendor_count(int op)
+{
+    return camera_stats_vendor(0, op)->count;
+}
+
+/* Runs the autofocus sequences persist.camera.wrapper.af_coalesce is for
+ * against the mock's slow sweep; 1 if the vendor or the service saw
+ * something other than expected. */
+static int bench_focus(const hw_module_t *wrapper)
+{
+    static const focus_step_t steps[] = {
+        { "duplicate auto_focus", "a10a", 1, 0, 1, 0 },
+        { "cancel, debounced", "a10c", 1, 1, 0, 0 },
+        { "cancel then auto_focus", "a10c10a", 1, 0, 1, 0 },
+    };
+    bench_ctx_t ctx;
+    int failed = 0;
+
+    camera_mock_set_property("persist.camera.wrapper.af_coalesce", "1");
+    camera_mock_set_focus_time(BENCH_FOCUS_SWEEP_US);
+    ctx.nullFd = -1;
+    if (bench_open(&ctx, wrapper, 0)) {
+        failed = 1;
+        goto out;
+    }
+    ctx.dev->ops->start_preview(ctx.dev);
+
+    printf("   Autofocus coalescing, vendor calls and results:\n");
+    printf("    %-27s %10s %10s %10s\n", "", "auto_focus", "cancel",
+            "results");
+    for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+        const focus_step_t *step = &steps[i];
+        int64_t autoFocus = focus_vendor_count(CAMERA_OP_auto_focus);
+        int64_t cancels = focus_vendor_count(CAMERA_OP_cancel_auto_focus);
+        int32_t results, early;
+        bool ok;
+
+        {
+            android::Mutex::Autolock lock(ctx.lock);
+            results = ctx.focused;
+        }
+        for (const char *op = step->ops; *op; ) {
+            if (*op == 'a') {
+                ctx.dev->ops->auto_focus(ctx.dev);
+                op++;
+            } else if (*op == 'c') {
+                ctx.dev->ops->cancel_auto_focus(ctx.dev);
+                op++;
+            } else {
+                char *end;
+
+                usleep(strtoul(op, &end, 10) * 1000);
+                op = end;
+            }
+        }
+        early = focus_vendor_count(CAMERA_OP_cancel_auto_focus) - cancels;
+        usleep(2 * BENCH_FOCUS_SWEEP_US);
+
+        autoFocus = focus_vendor_count(CAMERA_OP_auto_focus) - autoFocus;
+        cancels = focus_vendor_count(CAMERA_OP_cancel_auto_focus) - cancels;
+        {
+            android::Mutex::Autolock lock(ctx.lock);
+            results = ctx.focused - results;
+        }
+        ok = autoFocus == step->autoFocus && cancels == step->cancels &&
+                results == step->results &&
+                (step->cancelsEarly < 0 || early == step->cancelsEarly);
+        printf("    %-27s %10lld %10lld %10d%s\n", step->name,
+                (long long)autoFocus, (long long)cancels, results,
+                ok ? "" : "  UNEXPECTED");
+        if (!ok)
+            failed = 1;
+
+        /* unlocks the lens for the next sequence */
+        ctx.dev->ops->cancel_auto_focus(ctx.dev);
+    }
+
+    ctx.focusRequests = ctx.focused;
+    ctx.dev->ops->stop_preview(ctx.dev);
+    bench_close(&ctx);
+out:
+    camera_mock_set_focus_time(0);
+    camera_mock_set_property("persist.camera.wrapper.af_coalesce", NULL);
+    return failed;
+}
+
+typedef struct switch_ctx {
+    const hw_module_t *wrapper;
+    volatile int32_t stop;
+    int32_t cycles;
+} switch_ctx_t;
+
+/* opens and closes camera 0 back to back, the mock making both slow */
+static void *switch_hold_thread(void *arg)
+{
+    switch_ctx_t *ctx = (switch_ctx_t *)arg;
+    hw_device_t *dev;
+
+    while (!android_atomic_acquire_load(&ctx->stop)) {
+        if (ctx->wrapper->methods->open(ctx->wrapper, "0", &dev))
+            break;
+        dev->close(dev);
+        ctx->cycles++;
+    }
+    return NULL;
+}
+
+/* times opens of camera 1, the average and worst in *avg and *max */
+static int switch_open_camera1(const hw_module_t *wrapper, nsecs_t *avg,
+        nsecs_t *max)
+{
+    nsecs_t total = 0, start, elapsed;
+    hw_device_t *dev;
+
+    *max = 0;
+    for (int i = 0; i < BENCH_SWITCH_OPENS; i++) {
+        usleep(BENCH_SWITCH_SPACING_US);
+        start = systemTime(SYSTEM_TIME_MONOTONIC);
+        if (wrapper->methods->open(wrapper, "1", &dev)) {
+            fprintf(stderr, "cannot open camera 1\n");
+            return 1;
+        }
+        elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+        dev->close(dev);
+        total += elapsed;
+        if (elapsed > *max)
+            *max = elapsed;
+    }
+    *avg = total / BENCH_SWITCH_OPENS;
+    return 0;
+}
+
+/* Front/back switch: camera 1 is opened and closed while another thread
+ * keeps camera 0 in a vendor open or close taking delay_us each. */
+static int bench_switch(const hw_module_t *wrapper, uint32_t delay_us)
+{
+    switch_ctx_t ctx;
+    pthread_t thread;
+    nsecs_t avg, max;
+
+    printf("   Camera 1 open, camera 0 open and close taking %uus:\n",
+            delay_us);
+    if (switch_open_camera1(wrapper, &avg, &max))
+        return 1;
+    printf("    %-27s avg %8.2fms max %8.2fms\n", "camera 0 closed",
+            avg / 1e6, max / 1e6);
+
+    camera_mock_set_open_delay(0, delay_us, delay_us);
+    ctx.wrapper = wrapper;
+    ctx.stop = 0;
+    ctx.cycles = 0;
+    if (pthread_create(&thread, NULL, switch_hold_thread, &ctx)) {
+        camera_mock_set_open_delay(0, 0, 0);
+        return 1;
+    }
+    int rv = switch_open_camera1(wrapper, &avg, &max);
+    android_atomic_release_store(1, &ctx.stop);
+    pthread_join(thread, NULL);
+    camera_mock_set_open_delay(0, 0, 0);
+    if (rv)
+        return 1;
+    printf("    %-27s avg %8.2fms max %8.2fms (%d camera 0 cycles)\n",
+            "camera 0 opening/closing", avg / 1e6, max / 1e6, ctx.cycles);
+    return 0;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [-n iterations] [-c cycles] [-d op=us]... [-s us]\n"
+            "  -n  calls per op (%d), ops that start or stop something "
+            "make a tenth\n"
+            "  -c  parameter cycles of the heap check (%d)\n"
+            "  -d  have the mock vendor take this long in an op\n"
+            "  -s  only time camera 1 opens while camera 0 takes this long\n"
+            "      to open and close\n",
+            argv0, BENCH_ITERATIONS, BENCH_HEAP_CYCLES);
+}
+
+int main(int argc, char **argv)
+{
+    const hw_module_t *wrapper, *vendor;
+    int iterations = BENCH_ITERATIONS;
+    int cycles = BENCH_HEAP_CYCLES;
+    uint32_t switchUs = 0;
+    bool delayed = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:c:d:s:")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = atoi(optarg);
+            if (iterations <= 0) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'c':
+            cycles = atoi(optarg);
+            if (cycles <= 0) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'd': {
+            const char *eq = strchr(optarg, '=');
+            int op;
+
+            for (op = 0; eq && op < CAMERA_OP_COUNT; op++) {
+                if (strlen(op_names[op]) == (size_t)(eq - optarg) &&
+                        strncmp(optarg, op_names[op], eq - optarg) == 0)
+                    break;
+            }
+            if (!eq || op == CAMERA_OP_COUNT) {
+                usage(argv[0]);
+                return 2;
+            }
+            camera_mock_set_delay(op, strtoul(eq + 1, NULL, 0));
+            delayed = true;
+            break;
+        }
+        case 's':
+            switchUs = strtoul(optarg, NULL, 0);
+            if (!switchUs) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (hw_get_module(CAMERA_HARDWARE_MODULE_ID, &wrapper) ||
+            hw_get_module_by_class(CAMERA_HARDWARE_MODULE_ID, "mock",
+                    &vendor)) {
+        fprintf(stderr, "cannot load the camera modules\n");
+        return 1;
+    }
+
+    if (switchUs)
+        return bench_switch(wrapper, switchUs);
+
+    printf("  Camera wrapper benchmark, %d iterations, vendor delays %s\n",
+            iterations, delayed ? "as given" : "none");
+    if (bench_ops(wrapper, vendor, iterations))
+        return 1;
+    if (bench_params(wrapper, vendor, iterations))
+        return 1;
+    if (bench_passthrough(wrapper, vendor, iterations))
+        return 1;
+    if (bench_preview_cb(wrapper))
+        return 1;
+    if (bench_focus(wrapper))
+        return 1;
+    return bench_heap(wrapper, cycles);
+}
@@ -0,0 +1,140 @@
+/*
+ * Copyright (C) 2014, The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file FixupArena.cpp
+*
+* Bump allocator backing the scratch strings of the parameter fixups.
+*
+*/
+
+#define LOG_TAG "CameraWrapper"
+#include <cutils/log.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "FixupArena.h"
+
+#define FIXUP_ARENA_ALIGN 8
+
+struct fixup_arena_block {
+    fixup_arena_block_t *next;
+};
+
+void fixup_arena_init(fixup_arena_t *arena, size_t size)
+{
+    memset(arena, 0, sizeof(*arena));
+    arena->base = (char*)malloc(size);
+    if (arena->base)
+        arena->size = size;
+}
+
+static void fixup_arena_free_overflow(fixup_arena_t *arena)
+{
+    fixup_arena_block_t *block = arena->overflow;
+
+    while (block) {
+        fixup_arena_block_t *next = block->next;
+        free(block);
+        block = next;
+    }
+    arena->overflow = NULL;
+    arena->overflowBytes = 0;
+}
+
+void fixup_arena_release(fixup_arena_t *arena)
+{
+    fixup_arena_free_overflow(arena);
+    free(arena->base);
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
+
+void fixup_arena_reset(fixup_arena_t *arena)
+{
+    if (arena->overflow) {
+        // size the arena for what the last call needed, with some headroom
+        size_t size = (arena->used + arena->overflowBytes) * 3 / 2;
+        char *base = (char*)malloc(size);
+
+        fixup_arena_free_overflow(arena);
+        if (base) {
+            free(arena->base);
+            arena->base = base;
+            arena->size = size;
+            arena->grows++;
+        }
+    }
+    arena->used = 0;
+}
+
+void *fixup_arena_alloc(fixup_arena_t *arena, size_t size)
+{
+    size_t aligned = (size + FIXUP_ARENA_ALIGN - 1) & ~(FIXUP_ARENA_ALIGN - 1);
+    fixup_arena_block_t *block;
+
+    if (aligned <= arena->size - arena->used) {
+        void *ptr = arena->base + arena->used;
+        arena->used += aligned;
+        return ptr;
+    }
+
+    block = (fixup_arena_block_t*)malloc(sizeof(*block) + aligned);
+    if (!block) {
+        ALOGE("%s: out of memory allocating %zu bytes", __FUNCTION__, size);
+        return NULL;
+    }
+    block->next = arena->overflow;
+    arena->overflow = block;
+    arena->overflowBytes += aligned;
+    return block + 1;
+}
+
+char *fixup_arena_strdup(fixup_arena_t *arena, const char *str)
+{
+    size_t len = strlen(str) + 1;
+    char *copy = (char*)fixup_arena_alloc(arena, len);
+
+    if (copy)
+        memcpy(copy, str, len);
+    return copy;
+}
+
+char *fixup_arena_printf(fixup_arena_t *arena, const char *fmt, ...)
+{
+    va_list args;
+    char *str;
+    int len;
+
+    va_start(args, fmt);
+    len = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    if (len < 0)
+        return NULL;
+
+    str = (char*)fixup_arena_alloc(arena, len + 1);
+    if (!str)
+        return NULL;
+
+    va_start(args, fmt);
+    vsnprintf(str, len + 1, fmt, args);
+    va_end(args);
+    return str;
+}
@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2014, The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file FixupArena.h
+*
+* Bump allocator backing the scratch strings of the parameter fixups.
+*
+* Everything allocated from an arena is released at once by the next
+* fixup_arena_reset(). When a call needs more than the arena holds, the
+* excess comes from the heap and the arena is grown at the next reset, so
+* once the parameter set stops growing the fixups no longer touch the heap.
+*
+*/
+
+#ifndef FIXUP_ARENA_H
+#define FIXUP_ARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct fixup_arena_block fixup_arena_block_t;
+
+typedef struct fixup_arena {
+    char *base;
+    size_t size;
+    size_t used;
+    /* heap blocks taken since the last reset because base was full */
+    fixup_arena_block_t *overflow;
+    size_t overflowBytes;
+    int32_t grows;
+} fixup_arena_t;
+
+void fixup_arena_init(fixup_arena_t *arena, size_t size);
+void fixup_arena_release(fixup_arena_t *arena);
+void fixup_arena_reset(fixup_arena_t *arena);
+
+void *fixup_arena_alloc(fixup_arena_t *arena, size_t size);
+char *fixup_arena_strdup(fixup_arena_t *arena, const char *str);
+char *fixup_arena_printf(fixup_arena_t *arena, const char *fmt, ...)
+        __attribute__((format(printf, 2, 3)));
+
+#endif /* FIXUP_ARENA_H */
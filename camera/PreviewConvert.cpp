@@ -0,0 +1,422 @@
+/*
+ * Copyright (C) 2014, The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file PreviewConvert.cpp
+*
+* Preview frame kernels used by the camera wrapper's preview callback stage.
+*
+* The vector paths use the same fixed point arithmetic as the scalar ones
+* and produce bit-identical output; they only handle whole vectors and leave
+* the remainder of each row to the scalar code.
+*
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include "PreviewConvert.h"
+
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*******************************************************************
+ * 2x2 box downscale
+ *******************************************************************/
+
+static void downscale_row_y_c(const uint8_t *r0, const uint8_t *r1,
+        uint8_t *dst, int x, int width)
+{
+    for (; x < width; x++)
+        dst[x] = (r0[2 * x] + r0[2 * x + 1] +
+                r1[2 * x] + r1[2 * x + 1] + 2) >> 2;
+}
+
+static void downscale_row_vu_c(const uint8_t *r0, const uint8_t *r1,
+        uint8_t *dst, int pair, int pairs)
+{
+    for (; pair < pairs; pair++) {
+        for (int c = 0; c < 2; c++) {
+            int i = 4 * pair + c;
+            dst[2 * pair + c] = (r0[i] + r0[i + 2] + r1[i] + r1[i + 2] + 2) >> 2;
+        }
+    }
+}
+
+static int downscale_row_y(const uint8_t *r0, const uint8_t *r1,
+        uint8_t *dst, int width)
+{
+    int x = 0;
+#if defined(__ARM_NEON__)
+    for (; x + 8 <= width; x += 8) {
+        uint16x8_t sum = vpaddlq_u8(vld1q_u8(r0 + 2 * x));
+        sum = vpadalq_u8(sum, vld1q_u8(r1 + 2 * x));
+        vst1_u8(dst + x, vrshrn_n_u16(sum, 2));
+    }
+#elif defined(__SSE2__)
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+    const __m128i two = _mm_set1_epi16(2);
+    for (; x + 8 <= width; x += 8) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(r0 + 2 * x));
+        __m128i b = _mm_loadu_si128((const __m128i *)(r1 + 2 * x));
+        __m128i sum = _mm_add_epi16(
+                _mm_add_epi16(_mm_and_si128(a, mask), _mm_srli_epi16(a, 8)),
+                _mm_add_epi16(_mm_and_si128(b, mask), _mm_srli_epi16(b, 8)));
+        sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+        _mm_storel_epi64((__m128i *)(dst + x), _mm_packus_epi16(sum, sum));
+    }
+#endif
+    return x;
+}
+
+static int downscale_row_vu(const uint8_t *r0, const uint8_t *r1,
+        uint8_t *dst, int pairs)
+{
+    int pair = 0;
+#if defined(__ARM_NEON__)
+    for (; pair + 8 <= pairs; pair += 8) {
+        uint8x16x2_t a = vld2q_u8(r0 + 4 * pair);
+        uint8x16x2_t b = vld2q_u8(r1 + 4 * pair);
+        uint16x8_t v = vpadalq_u8(vpaddlq_u8(a.val[0]), b.val[0]);
+        uint16x8_t u = vpadalq_u8(vpaddlq_u8(a.val[1]), b.val[1]);
+        uint8x8x2_t out;
+        out.val[0] = vrshrn_n_u16(v, 2);
+        out.val[1] = vrshrn_n_u16(u, 2);
+        vst2_u8(dst + 2 * pair, out);
+    }
+#elif defined(__SSE2__)
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+    const __m128i ones = _mm_set1_epi16(1);
+    const __m128i two = _mm_set1_epi32(2);
+    for (; pair + 4 <= pairs; pair += 4) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(r0 + 4 * pair));
+        __m128i b = _mm_loadu_si128((const __m128i *)(r1 + 4 * pair));
+        /* one 16 bit lane per source pair, summed over both rows */
+        __m128i v = _mm_add_epi16(_mm_and_si128(a, mask), _mm_and_si128(b, mask));
+        __m128i u = _mm_add_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+        /* add horizontally adjacent pairs */
+        v = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(v, ones), two), 2);
+        u = _mm_srli_epi32(_mm_add_epi32(_mm_madd_epi16(u, ones), two), 2);
+        __m128i vu = _mm_packus_epi16(_mm_packs_epi32(v, u), ones);
+        _mm_storel_epi64((__m128i *)(dst + 2 * pair),
+                _mm_unpacklo_epi8(vu, _mm_srli_si128(vu, 4)));
+    }
+#endif
+    return pair;
+}
+
+void preview_nv21_downscale_2x_c(const uint8_t *src_y, const uint8_t *src_vu,
+        int src_stride, uint8_t *dst_y, uint8_t *dst_vu, int dst_stride,
+        int width, int height)
+{
+    for (int y = 0; y < height; y++)
+        downscale_row_y_c(src_y + 2 * y * src_stride,
+                src_y + (2 * y + 1) * src_stride, dst_y + y * dst_stride,
+                0, width);
+
+    for (int y = 0; y < height / 2; y++)
+        downscale_row_vu_c(src_vu + 2 * y * src_stride,
+                src_vu + (2 * y + 1) * src_stride, dst_vu + y * dst_stride,
+                0, width / 2);
+}
+
+void preview_nv21_downscale_2x(const uint8_t *src_y, const uint8_t *src_vu,
+        int src_stride, uint8_t *dst_y, uint8_t *dst_vu, int dst_stride,
+        int width, int height)
+{
+    for (int y = 0; y < height; y++) {
+        const uint8_t *r0 = src_y + 2 * y * src_stride;
+        const uint8_t *r1 = r0 + src_stride;
+        uint8_t *dst = dst_y + y * dst_stride;
+
+        downscale_row_y_c(r0, r1, dst, downscale_row_y(r0, r1, dst, width),
+                width);
+    }
+
+    for (int y = 0; y < height / 2; y++) {
+        const uint8_t *r0 = src_vu + 2 * y * src_stride;
+        const uint8_t *r1 = r0 + src_stride;
+        uint8_t *dst = dst_vu + y * dst_stride;
+
+        downscale_row_vu_c(r0, r1, dst,
+                downscale_row_vu(r0, r1, dst, width / 2), width / 2);
+    }
+}
+
+/*******************************************************************
+ * Copy
+ *******************************************************************/
+
+void preview_nv21_copy(const uint8_t *src_y, const uint8_t *src_vu,
+        int src_stride, uint8_t *dst_y, uint8_t *dst_vu, int dst_stride,
+        int width, int height)
+{
+    for (int y = 0; y < height; y++)
+        memcpy(dst_y + y * dst_stride, src_y + y * src_stride, width);
+    for (int y = 0; y < height / 2; y++)
+        memcpy(dst_vu + y * dst_stride, src_vu + y * src_stride, width);
+}
+
+/*******************************************************************
+ * NV21 to RGBA8888
+ *
+ * R = (74 * (Y - 16) + 102 * V + 32) >> 6
+ * G = (74 * (Y - 16) - 25 * U - 52 * V + 32) >> 6
+ * B = (74 * (Y - 16) + 129 * U + 32) >> 6
+ *
+ * with U and V centered on zero and Y - 16 clamped at zero. Every
+ * intermediate fits in 16 bits except the blue sum for very bright pixels,
+ * which the vector code saturates; that only happens when the result
+ * clamps to 255 anyway.
+ *******************************************************************/
+
+static inline uint8_t clamp_u8(int v)
+{
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+static void rgba_row_c(const uint8_t *y_row, const uint8_t *vu_row,
+        uint8_t *dst, int x, int width)
+{
+    for (; x < width; x++) {
+        int luma = (y_row[x] > 16 ? y_row[x] - 16 : 0) * 74 + 32;
+        int v = vu_row[x & ~1] - 128;
+        int u = vu_row[(x & ~1) + 1] - 128;
+
+        dst[4 * x + 0] = clamp_u8((luma + 102 * v) >> 6);
+        dst[4 * x + 1] = clamp_u8((luma - 25 * u - 52 * v) >> 6);
+        dst[4 * x + 2] = clamp_u8((luma + 129 * u) >> 6);
+        dst[4 * x + 3] = 0xff;
+    }
+}
+
+static int rgba_row(const uint8_t *y_row, const uint8_t *vu_row,
+        uint8_t *dst, int width)
+{
+    int x = 0;
+#if defined(__ARM_NEON__)
+    const uint8x8_t y_offset = vdup_n_u8(16);
+    const uint8x8_t y_scale = vdup_n_u8(74);
+    const int16x8_t rounding = vdupq_n_s16(32);
+    const int16x8_t uv_offset = vdupq_n_s16(128);
+    uint8x8x4_t lo, hi;
+
+    lo.val[3] = hi.val[3] = vdup_n_u8(0xff);
+    for (; x + 16 <= width; x += 16) {
+        /* even and odd pixels share the chroma of their pair */
+        uint8x8x2_t luma = vld2_u8(y_row + x);
+        uint8x8x2_t vu = vld2_u8(vu_row + x);
+        int16x8_t v = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vu.val[0])), uv_offset);
+        int16x8_t u = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vu.val[1])), uv_offset);
+        int16x8_t r_uv = vmulq_n_s16(v, 102);
+        int16x8_t g_uv = vmlaq_n_s16(vmulq_n_s16(u, -25), v, -52);
+        int16x8_t b_uv = vmulq_n_s16(u, 129);
+        uint8x8_t r[2], g[2], b[2];
+
+        for (int i = 0; i < 2; i++) {
+            int16x8_t l = vaddq_s16(vreinterpretq_s16_u16(
+                    vmull_u8(vqsub_u8(luma.val[i], y_offset), y_scale)), rounding);
+            r[i] = vqshrun_n_s16(vqaddq_s16(l, r_uv), 6);
+            g[i] = vqshrun_n_s16(vqaddq_s16(l, g_uv), 6);
+            b[i] = vqshrun_n_s16(vqaddq_s16(l, b_uv), 6);
+        }
+
+        uint8x8x2_t rr = vzip_u8(r[0], r[1]);
+        uint8x8x2_t gg = vzip_u8(g[0], g[1]);
+        uint8x8x2_t bb = vzip_u8(b[0], b[1]);
+        lo.val[0] = rr.val[0]; hi.val[0] = rr.val[1];
+        lo.val[1] = gg.val[0]; hi.val[1] = gg.val[1];
+        lo.val[2] = bb.val[0]; hi.val[2] = bb.val[1];
+        vst4_u8(dst + 4 * x, lo);
+        vst4_u8(dst + 4 * x + 32, hi);
+    }
+#elif defined(__SSE2__)
+    const __m128i mask = _mm_set1_epi16(0x00ff);
+    const __m128i y_offset = _mm_set1_epi16(16);
+    const __m128i y_scale = _mm_set1_epi16(74);
+    const __m128i rounding = _mm_set1_epi16(32);
+    const __m128i uv_offset = _mm_set1_epi16(128);
+    const __m128i alpha = _mm_set1_epi8((char)0xff);
+    for (; x + 16 <= width; x += 16) {
+        __m128i luma = _mm_loadu_si128((const __m128i *)(y_row + x));
+        __m128i vu = _mm_loadu_si128((const __m128i *)(vu_row + x));
+        __m128i v = _mm_sub_epi16(_mm_and_si128(vu, mask), uv_offset);
+        __m128i u = _mm_sub_epi16(_mm_srli_epi16(vu, 8), uv_offset);
+        __m128i r_uv = _mm_mullo_epi16(v, _mm_set1_epi16(102));
+        __m128i g_uv = _mm_add_epi16(_mm_mullo_epi16(u, _mm_set1_epi16(-25)),
+                _mm_mullo_epi16(v, _mm_set1_epi16(-52)));
+        __m128i b_uv = _mm_mullo_epi16(u, _mm_set1_epi16(129));
+        __m128i l[2] = { _mm_and_si128(luma, mask), _mm_srli_epi16(luma, 8) };
+        __m128i r[2], g[2], b[2];
+
+        for (int i = 0; i < 2; i++) {
+            l[i] = _mm_add_epi16(_mm_mullo_epi16(
+                    _mm_subs_epu16(l[i], y_offset), y_scale), rounding);
+            r[i] = _mm_srai_epi16(_mm_adds_epi16(l[i], r_uv), 6);
+            g[i] = _mm_srai_epi16(_mm_adds_epi16(l[i], g_uv), 6);
+            b[i] = _mm_srai_epi16(_mm_adds_epi16(l[i], b_uv), 6);
+            r[i] = _mm_packus_epi16(r[i], r[i]);
+            g[i] = _mm_packus_epi16(g[i], g[i]);
+            b[i] = _mm_packus_epi16(b[i], b[i]);
+        }
+
+        __m128i rr = _mm_unpacklo_epi8(r[0], r[1]);
+        __m128i gg = _mm_unpacklo_epi8(g[0], g[1]);
+        __m128i bb = _mm_unpacklo_epi8(b[0], b[1]);
+        __m128i rg_lo = _mm_unpacklo_epi8(rr, gg);
+        __m128i rg_hi = _mm_unpackhi_epi8(rr, gg);
+        __m128i ba_lo = _mm_unpacklo_epi8(bb, alpha);
+        __m128i ba_hi = _mm_unpackhi_epi8(bb, alpha);
+        __m128i *out = (__m128i *)(dst + 4 * x);
+        _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(rg_lo, ba_lo));
+        _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(rg_lo, ba_lo));
+        _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(rg_hi, ba_hi));
+        _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(rg_hi, ba_hi));
+    }
+#endif
+    return x;
+}
+
+void preview_nv21_to_rgba_c(const uint8_t *src_y, const uint8_t *src_vu,
+        int src_stride, uint8_t *dst, int dst_stride, int width, int height)
+{
+    for (int y = 0; y < height; y++)
+        rgba_row_c(src_y + y * src_stride, src_vu + (y / 2) * src_stride,
+                dst + y * dst_stride, 0, width);
+}
+
+void preview_nv21_to_rgba(const uint8_t *src_y, const uint8_t *src_vu,
+        int src_stride, uint8_t *dst, int dst_stride, int width, int height)
+{
+    for (int y = 0; y < height; y++) {
+        const uint8_t *y_row = src_y + y * src_stride;
+        const uint8_t *vu_row = src_vu + (y / 2) * src_stride;
+        uint8_t *out = dst + y * dst_stride;
+
+        rgba_row_c(y_row, vu_row, out, rgba_row(y_row, vu_row, out, width),
+                width);
+    }
+}
+
+/*******************************************************************
+ * luma statistics
+ *******************************************************************/
+
+typedef struct luma_row_stats {
+    uint32_t sum;
+    uint32_t dark;
+    uint32_t bright;
+} luma_row_stats_t;
+
+static void luma_row_c(const uint8_t *row, int x, int width,
+        luma_row_stats_t *stats)
+{
+    for (; x < width; x++) {
+        stats->sum += row[x];
+        stats->dark += row[x] < PREVIEW_LUMA_DARK;
+        stats->bright += row[x] >= PREVIEW_LUMA_BRIGHT;
+    }
+}
+
+static int luma_row(const uint8_t *row, int width, luma_row_stats_t *stats)
+{
+    int x = 0;
+#if defined(__ARM_NEON__)
+    const uint8x16_t dark = vdupq_n_u8(PREVIEW_LUMA_DARK);
+    const uint8x16_t bright = vdupq_n_u8(PREVIEW_LUMA_BRIGHT);
+    uint32x4_t sum = vdupq_n_u32(0);
+    uint16x8_t darks = vdupq_n_u16(0), brights = vdupq_n_u16(0);
+    uint64x2_t total;
+
+    /* the 16 bit counters gain at most 2 per lane and iteration */
+    for (; x + 16 <= width; x += 16) {
+        uint8x16_t luma = vld1q_u8(row + x);
+        sum = vpadalq_u16(sum, vpaddlq_u8(luma));
+        darks = vpadalq_u8(darks, vshrq_n_u8(vcltq_u8(luma, dark), 7));
+        brights = vpadalq_u8(brights, vshrq_n_u8(vcgeq_u8(luma, bright), 7));
+    }
+    total = vpaddlq_u32(sum);
+    stats->sum += vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1);
+    total = vpaddlq_u32(vpaddlq_u16(darks));
+    stats->dark += vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1);
+    total = vpaddlq_u32(vpaddlq_u16(brights));
+    stats->bright += vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1);
+#elif defined(__SSE2__)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    const __m128i dark_max = _mm_set1_epi8((char)(PREVIEW_LUMA_DARK - 1));
+    const __m128i bright = _mm_set1_epi8((char)PREVIEW_LUMA_BRIGHT);
+    __m128i sum = zero, darks = zero, brights = zero;
+
+    for (; x + 16 <= width; x += 16) {
+        __m128i luma = _mm_loadu_si128((const __m128i *)(row + x));
+        /* unsigned compares: luma <= dark - 1 and luma >= bright */
+        __m128i is_dark = _mm_cmpeq_epi8(_mm_max_epu8(luma, dark_max), dark_max);
+        __m128i is_bright = _mm_cmpeq_epi8(_mm_max_epu8(luma, bright), luma);
+        sum = _mm_add_epi64(sum, _mm_sad_epu8(luma, zero));
+        darks = _mm_add_epi64(darks, _mm_sad_epu8(_mm_and_si128(is_dark, one), zero));
+        brights = _mm_add_epi64(brights, _mm_sad_epu8(_mm_and_si128(is_bright, one), zero));
+    }
+    stats->sum += _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+    stats->dark += _mm_cvtsi128_si32(darks) + _mm_cvtsi128_si32(_mm_srli_si128(darks, 8));
+    stats->bright += _mm_cvtsi128_si32(brights) + _mm_cvtsi128_si32(_mm_srli_si128(brights, 8));
+#endif
+    return x;
+}
+
+static void luma_histogram_row(const uint8_t *row, int width,
+        preview_luma_stats_t *stats)
+{
+    for (int x = 0; x < width; x += 4)
+        stats->histogram[row[x] >> 4]++;
+}
+
+void preview_luma_stats_c(const uint8_t *src_y, int src_stride, int width,
+        int height, int row_step, preview_luma_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    for (int y = 0; y < height; y += row_step) {
+        const uint8_t *row = src_y + y * src_stride;
+        luma_row_stats_t row_stats = { 0, 0, 0 };
+
+        luma_row_c(row, 0, width, &row_stats);
+        luma_histogram_row(row, width, stats);
+        stats->samples += width;
+        stats->sum += row_stats.sum;
+        stats->dark += row_stats.dark;
+        stats->bright += row_stats.bright;
+    }
+}
+
+void preview_luma_stats(const uint8_t *src_y, int src_stride, int width,
+        int height, int row_step, preview_luma_stats_t *stats)
+{
+    memset(stats, 0, sizeof(*stats));
+    for (int y = 0; y < height; y += row_step) {
+        const uint8_t *row = src_y + y * src_stride;
+        luma_row_stats_t row_stats = { 0, 0, 0 };
+
+        luma_row_c(row, luma_row(row, width, &row_stats), width, &row_stats);
+        luma_histogram_row(row, width, stats);
+        stats->samples += width;
+        stats->sum += row_stats.sum;
+        stats->dark += row_stats.dark;
+        stats->bright += row_stats.bright;
+    }
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright (C) 2014, The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file PreviewConvert.h
+*
+* Preview frame kernels used by the camera wrapper's preview callback stage
+* and its automatic HDR scene detection.
+*
+* All images are NV21: a luma plane followed by an interleaved V/U plane at
+* half resolution, both using the same row stride. Widths and heights must
+* be even. NEON or SSE2 is used when the target has it, the _c variants are
+* the portable reference implementations that camera_preview_convert_test
+* checks them against.
+*
+*/
+
+#ifndef PREVIEW_CONVERT_H
+#define PREVIEW_CONVERT_H
+
+#include <stdint.h>
+
+/* halve an NV21 image in both directions with a 2x2 box filter, width and
+ * height are those of the destination */
+void preview_nv21_downscale_2x(const uint8_t *src_y, const uint8_t *src_vu,
+        int src_stride, uint8_t *dst_y, uint8_t *dst_vu, int dst_stride,
+        int width, int height);
+void preview_nv21_downscale_2x_c(const uint8_t *src_y, const uint8_t *src_vu,
+        int src_stride, uint8_t *dst_y, uint8_t *dst_vu, int dst_stride,
+        int width, int height);
+
+/* copy an NV21 image, typically a crop of a larger one */
+void preview_nv21_copy(const uint8_t *src_y, const uint8_t *src_vu,
+        int src_stride, uint8_t *dst_y, uint8_t *dst_vu, int dst_stride,
+        int width, int height);
+
+/* convert NV21 to RGBA8888 using BT.601 video range coefficients */
+void preview_nv21_to_rgba(const uint8_t *src_y, const uint8_t *src_vu,
+        int src_stride, uint8_t *dst, int dst_stride, int width, int height);
+void preview_nv21_to_rgba_c(const uint8_t *src_y, const uint8_t *src_vu,
+        int src_stride, uint8_t *dst, int dst_stride, int width, int height);
+
+/* luma below dark or at or above bright counts as clipped */
+#define PREVIEW_LUMA_DARK 32
+#define PREVIEW_LUMA_BRIGHT 235
+#define PREVIEW_LUMA_BINS 16
+
+typedef struct preview_luma_stats {
+    /* over every pixel of the sampled rows */
+    uint32_t samples;
+    uint64_t sum;
+    uint32_t dark;
+    uint32_t bright;
+    /* over every 4th pixel of the sampled rows, by luma / 16 */
+    uint32_t histogram[PREVIEW_LUMA_BINS];
+} preview_luma_stats_t;
+
+/* luma statistics over every row_step'th row of a luma plane */
+void preview_luma_stats(const uint8_t *src_y, int src_stride, int width,
+        int height, int row_step, preview_luma_stats_t *stats);
+void preview_luma_stats_c(const uint8_t *src_y, int src_stride, int width,
+        int height, int row_step, preview_luma_stats_t *stats);
+
+#endif /* PREVIEW_CONVERT_H */
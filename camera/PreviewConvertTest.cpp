@@ -0,0 +1,423 @@
+/*
+ * Copyright (C) 2014, The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file PreviewConvertTest.cpp
+*
+* Checks the NEON or SSE2 preview kernels against their _c references and
+* measures both in frames/s, and what automatic HDR costs a preview frame.
+*
+* Images are random or clipped to the extremes, their widths are not
+* multiples of the vector length, strides are odd and rows start at any
+* alignment. Destinations are compared with a guard band around them, so a
+* kernel writing past a row's end is caught too. The RGBA conversion is
+* also checked over the whole Y/U/V range.
+*
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <utils/Timers.h>
+
+#include "PreviewConvert.h"
+
+#define TEST_ROUNDS 300
+/* bytes before and after every destination that must stay untouched */
+#define TEST_GUARD 64
+#define TEST_GUARD_BYTE 0xa5
+/* as the wrapper's automatic HDR: every 10th frame, every 4th row */
+#define HDR_FRAME_INTERVAL 10
+#define HDR_ROW_STEP 4
+/* preview callback buffers the vendor cycles through */
+#define HDR_VENDOR_BUFFERS 4
+
+static uint32_t gSeed = 1;
+static int gFailures;
+
+static uint32_t test_rand(void)
+{
+    gSeed ^= gSeed << 13;
+    gSeed ^= gSeed >> 17;
+    gSeed ^= gSeed << 5;
+    return gSeed;
+}
+
+/* every third image only has 0 and 255, the clamping edge cases */
+static void test_fill(uint8_t *buf, size_t size, int round)
+{
+    for (size_t i = 0; i < size; i++)
+        buf[i] = round % 3 == 0 ? (test_rand() & 1 ? 255 : 0) : test_rand();
+}
+
+typedef struct test_buf {
+    uint8_t *alloc;
+    uint8_t *data;
+    size_t size;
+} test_buf_t;
+
+/* size bytes at a random misalignment, surrounded by guard bytes */
+static void test_buf_init(test_buf_t *buf, size_t size)
+{
+    size_t offset = TEST_GUARD + test_rand() % 16;
+
+    buf->alloc = (uint8_t *)malloc(size + offset + TEST_GUARD);
+    if (!buf->alloc) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    memset(buf->alloc, TEST_GUARD_BYTE, size + offset + TEST_GUARD);
+    buf->data = buf->alloc + offset;
+    buf->size = size;
+}
+
+static bool test_buf_equal(const test_buf_t *a, const test_buf_t *b)
+{
+    return memcmp(a->data - TEST_GUARD, b->data - TEST_GUARD,
+            a->size + 2 * TEST_GUARD) == 0;
+}
+
+static void test_buf_free(test_buf_t *buf)
+{
+    free(buf->alloc);
+}
+
+static void test_fail(const char *kernel, int round, int width, int height,
+        int src_stride, int dst_stride)
+{
+    printf("  FAIL %s: round %d, %dx%d, strides %d/%d\n", kernel, round,
+            width, height, src_stride, dst_stride);
+    gFailures++;
+}
+
+/* width and height of the destination */
+static void test_downscale(int round, int width, int height)
+{
+    int srcStride = 2 * width + test_rand() % 8;
+    int dstStride = width + test_rand() % 8;
+    size_t srcSize = (size_t)srcStride * height * 3;
+    size_t dstSize = (size_t)dstStride * height * 3 / 2;
+    test_buf_t src, vec, ref;
+
+    test_buf_init(&src, srcSize);
+    test_buf_init(&vec, dstSize);
+    test_buf_init(&ref, dstSize);
+    test_fill(src.data, srcSize, round);
+    /* untouched stride padding must stay the same on both sides */
+    memset(vec.data, 0, dstSize);
+    memset(ref.data, 0, dstSize);
+
+    preview_nv21_downscale_2x(src.data, src.data + srcStride * height * 2,
+            srcStride, vec.data, vec.data + dstStride * height, dstStride,
+            width, height);
+    preview_nv21_downscale_2x_c(src.data, src.data + srcStride * height * 2,
+            srcStride, ref.data, ref.data + dstStride * height, dstStride,
+            width, height);
+    if (!test_buf_equal(&vec, &ref))
+        test_fail("nv21_downscale_2x", round, width, height, srcStride,
+                dstStride);
+
+    test_buf_free(&src);
+    test_buf_free(&vec);
+    test_buf_free(&ref);
+}
+
+static void test_rgba(int round, int width, int height)
+{
+    int srcStride = width + test_rand() % 8;
+    int dstStride = width * 4 + test_rand() % 8;
+    size_t srcSize = (size_t)srcStride * height * 3 / 2;
+    size_t dstSize = (size_t)dstStride * height;
+    test_buf_t src, vec, ref;
+
+    test_buf_init(&src, srcSize);
+    test_buf_init(&vec, dstSize);
+    test_buf_init(&ref, dstSize);
+    test_fill(src.data, srcSize, round);
+    memset(vec.data, 0, dstSize);
+    memset(ref.data, 0, dstSize);
+
+    preview_nv21_to_rgba(src.data, src.data + srcStride * height, srcStride,
+            vec.data, dstStride, width, height);
+    preview_nv21_to_rgba_c(src.data, src.data + srcStride * height,
+            srcStride, ref.data, dstStride, width, height);
+    if (!test_buf_equal(&vec, &ref))
+        test_fail("nv21_to_rgba", round, width, height, srcStride,
+                dstStride);
+
+    test_buf_free(&src);
+    test_buf_free(&vec);
+    test_buf_free(&ref);
+}
+
+/* the luma plane alone has no even size constraint */
+static void test_luma_stats(int round, int width, int height)
+{
+    int stride = width + test_rand() % 8;
+    int rowStep = 1 + test_rand() % 5;
+    preview_luma_stats_t vec, ref;
+    test_buf_t src;
+
+    test_buf_init(&src, (size_t)stride * height);
+    test_fill(src.data, src.size, round);
+    memset(&vec, 0xff, sizeof(vec));
+    memset(&ref, 0, sizeof(ref));
+
+    preview_luma_stats(src.data, stride, width, height, rowStep, &vec);
+    preview_luma_stats_c(src.data, stride, width, height, rowStep, &ref);
+    if (memcmp(&vec, &ref, sizeof(vec)))
+        test_fail("luma_stats", round, width, height, stride, rowStep);
+
+    test_buf_free(&src);
+}
+
+static void test_copy(int round, int width, int height)
+{
+    int srcStride = width + test_rand() % 8;
+    int dstStride = width + test_rand() % 8;
+    test_buf_t src, dst;
+    bool ok = true;
+
+    test_buf_init(&src, (size_t)srcStride * height * 3 / 2);
+    test_buf_init(&dst, (size_t)dstStride * height * 3 / 2);
+    test_fill(src.data, src.size, round);
+
+    preview_nv21_copy(src.data, src.data + srcStride * height, srcStride,
+            dst.data, dst.data + dstStride * height, dstStride, width,
+            height);
+    for (int y = 0; y < height * 3 / 2; y++)
+        ok &= memcmp(dst.data + y * dstStride, src.data + y * srcStride,
+                width) == 0;
+    ok &= dst.data[-1] == TEST_GUARD_BYTE &&
+            dst.data[dst.size] == TEST_GUARD_BYTE;
+    if (!ok)
+        test_fail("nv21_copy", round, width, height, srcStride, dstStride);
+
+    test_buf_free(&src);
+    test_buf_free(&dst);
+}
+
+/* a row of every V and U for each Y, 256 pixels wide */
+static void test_rgba_range(void)
+{
+    uint8_t y[256], vu[256], vec[1024], ref[1024];
+    int mismatched = 0;
+
+    for (int luma = 0; luma < 256; luma++) {
+        for (int v = 0; v < 256; v++) {
+            memset(y, luma, sizeof(y));
+            for (int u = 0; u < 128; u++) {
+                vu[2 * u] = v;
+                vu[2 * u + 1] = u * 2 + (luma & 1);
+            }
+            preview_nv21_to_rgba(y, vu, sizeof(y), vec, sizeof(vec), 256, 1);
+            preview_nv21_to_rgba_c(y, vu, sizeof(y), ref, sizeof(ref), 256,
+                    1);
+            if (memcmp(vec, ref, sizeof(vec)))
+                mismatched++;
+        }
+    }
+    if (mismatched) {
+        printf("  FAIL nv21_to_rgba: %d of 65536 Y/V rows differ\n",
+                mismatched);
+        gFailures++;
+    }
+}
+
+static void run_tests(void)
+{
+    for (int round = 0; round < TEST_ROUNDS; round++) {
+        /* mostly small images, so that the row remainders vary a lot */
+        int width = 2 * (1 + test_rand() % (round % 10 ? 40 : 400));
+        int height = 2 * (1 + test_rand() % 16);
+
+        test_downscale(round, width, height);
+        test_rgba(round, width, height);
+        test_copy(round, width, height);
+        test_luma_stats(round, 1 + test_rand() % 700, 1 + test_rand() % 40);
+    }
+    test_rgba_range();
+}
+
+typedef struct bench_frame {
+    int width;
+    int height;
+} bench_frame_t;
+
+static void print_fps(const char *kernel, int width, int height,
+        int frames, nsecs_t vec, nsecs_t ref)
+{
+    printf("    %-18s %4dx%-4d %10.1f %10.1f %8.2fx\n", kernel, width, height,
+            frames * 1e9 / vec, frames * 1e9 / ref, (double)ref / vec);
+}
+
+static void run_benchmark(int frames)
+{
+    static const bench_frame_t sizes[] = {
+        { 1280, 720 },
+        { 1920, 1080 },
+    };
+    preview_luma_stats_t stats;
+    nsecs_t start, vec, ref;
+
+    printf("  Preview kernels, frames/s over %d frames:\n", frames);
+    printf("    %-18s %9s %10s %10s %9s\n", "", "", "vector", "scalar",
+            "speedup");
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        int width = sizes[i].width, height = sizes[i].height;
+        size_t size = (size_t)width * height * 3 / 2;
+        uint8_t *src = (uint8_t *)malloc(size);
+        uint8_t *dst = (uint8_t *)malloc((size_t)width * height * 4);
+
+        if (!src || !dst) {
+            free(src);
+            free(dst);
+            return;
+        }
+        test_fill(src, size, 1);
+
+        start = systemTime(SYSTEM_TIME_MONOTONIC);
+        for (int f = 0; f < frames; f++)
+            preview_nv21_downscale_2x(src, src + width * height, width, dst,
+                    dst + width * height / 4, width / 2, width / 2,
+                    height / 2);
+        vec = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+        start = systemTime(SYSTEM_TIME_MONOTONIC);
+        for (int f = 0; f < frames; f++)
+            preview_nv21_downscale_2x_c(src, src + width * height, width,
+                    dst, dst + width * height / 4, width / 2, width / 2,
+                    height / 2);
+        ref = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+        print_fps("nv21_downscale_2x", width, height, frames, vec, ref);
+
+        start = systemTime(SYSTEM_TIME_MONOTONIC);
+        for (int f = 0; f < frames; f++)
+            preview_nv21_to_rgba(src, src + width * height, width, dst,
+                    width * 4, width, height);
+        vec = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+        start = systemTime(SYSTEM_TIME_MONOTONIC);
+        for (int f = 0; f < frames; f++)
+            preview_nv21_to_rgba_c(src, src + width * height, width, dst,
+                    width * 4, width, height);
+        ref = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+        print_fps("nv21_to_rgba", width, height, frames, vec, ref);
+
+        /* every 4th row, as the automatic HDR detection samples */
+        start = systemTime(SYSTEM_TIME_MONOTONIC);
+        for (int f = 0; f < frames; f++)
+            preview_luma_stats(src, width, width, height, 4, &stats);
+        vec = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+        start = systemTime(SYSTEM_TIME_MONOTONIC);
+        for (int f = 0; f < frames; f++)
+            preview_luma_stats_c(src, width, width, height, 4, &stats);
+        ref = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+        print_fps("luma_stats", width, height, frames, vec, ref);
+
+        free(src);
+        free(dst);
+    }
+}
+
+/* What automatic HDR costs each 720p preview frame. It keeps
+ * CAMERA_MSG_PREVIEW_FRAME enabled, so the vendor copies every frame into
+ * a preview callback buffer, and analyses one frame in ten. */
+static void run_hdr_budget(int frames)
+{
+    const int width = 1280, height = 720;
+    size_t size = (size_t)width * height * 3 / 2;
+    uint8_t *src = (uint8_t *)malloc(size);
+    uint8_t *heap = (uint8_t *)malloc(size * HDR_VENDOR_BUFFERS);
+    preview_luma_stats_t stats;
+    nsecs_t start;
+    double copyUs, vecUs, refUs;
+
+    if (!src || !heap) {
+        free(src);
+        free(heap);
+        return;
+    }
+    test_fill(src, size, 1);
+    memset(heap, 0, size * HDR_VENDOR_BUFFERS);
+
+    start = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int f = 0; f < frames; f++)
+        memcpy(heap + (f % HDR_VENDOR_BUFFERS) * size, src, size);
+    copyUs = (systemTime(SYSTEM_TIME_MONOTONIC) - start) / 1e3 / frames;
+    start = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int f = 0; f < frames; f++)
+        preview_luma_stats(src, width, width, height, HDR_ROW_STEP, &stats);
+    vecUs = (systemTime(SYSTEM_TIME_MONOTONIC) - start) / 1e3 / frames;
+    start = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (int f = 0; f < frames; f++)
+        preview_luma_stats_c(src, width, width, height, HDR_ROW_STEP, &stats);
+    refUs = (systemTime(SYSTEM_TIME_MONOTONIC) - start) / 1e3 / frames;
+
+    printf("  Automatic HDR, us per %dx%d preview frame:\n", width, height);
+    printf("    %-30s %8s %8s\n", "", "vector", "scalar");
+    printf("    %-30s %8.1f %8.1f\n", "vendor preview frame copy", copyUs,
+            copyUs);
+    printf("    %-30s %8.1f %8.1f\n", "luma_stats of an analysed frame",
+            vecUs, refUs);
+    printf("    %-30s %8.1f %8.1f\n", "per frame, 1 in 10 analysed",
+            copyUs + vecUs / HDR_FRAME_INTERVAL,
+            copyUs + refUs / HDR_FRAME_INTERVAL);
+    printf("    %-30s %7.2f%% %7.2f%%\n", "of a frame at 30 fps",
+            (copyUs + vecUs / HDR_FRAME_INTERVAL) / 333.33,
+            (copyUs + refUs / HDR_FRAME_INTERVAL) / 333.33);
+
+    free(src);
+    free(heap);
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [-b frames]\n"
+            "  -b  also measure each kernel over this many frames\n",
+            argv0);
+}
+
+int main(int argc, char **argv)
+{
+    int frames = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "b:")) != -1) {
+        switch (opt) {
+        case 'b':
+            frames = atoi(optarg);
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc || frames < 0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    run_tests();
+    printf("  Preview kernels: %s, %d failures\n",
+            gFailures ? "FAILED" : "passed", gFailures);
+    if (frames) {
+        run_benchmark(frames);
+        run_hdr_budget(frames);
+    }
+    return gFailures ? 1 : 0;
+}
@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2014, The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file PreviewRing.cpp
+*
+* Writer side of the preview frame ring file.
+*
+* The file is built under a temporary name and renamed into place, so a
+* reader still mapping the ring of a previous camera session never sees it
+* shrink under it. Every page is touched when the ring is created so frames
+* do not fault in file pages on the preview callback thread.
+*
+*/
+
+#define LOG_TAG "CameraWrapper"
+#include <cutils/log.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <new>
+
+#include "PreviewRing.h"
+
+/* keeps a mistyped property from eating the data partition */
+#define PREVIEW_RING_MAX_BYTES (256 * 1024 * 1024)
+
+struct camera_preview_ring {
+    int fd;
+    uint8_t *map;
+    size_t mapSize;
+    camera_preview_ring_header_t *header;
+    size_t frameSize;
+    /* only touched from the preview callback thread */
+    uint32_t written;
+    uint32_t dropped;
+    uint64_t bytes;
+};
+
+static size_t preview_ring_align(size_t size)
+{
+    return (size + CAMERA_PREVIEW_RING_ALIGN - 1) &
+            ~(size_t)(CAMERA_PREVIEW_RING_ALIGN - 1);
+}
+
+camera_preview_ring_t *camera_preview_ring_open(const char *path,
+        int camera_id, uint32_t slot_count, size_t frame_size)
+{
+    camera_preview_ring_header_t *header;
+    camera_preview_ring_t *ring;
+    char tmp[PATH_MAX];
+    uint64_t slotSize, total;
+
+    slotSize = preview_ring_align(CAMERA_PREVIEW_RING_SLOT_DATA +
+            (uint64_t)frame_size);
+    total = CAMERA_PREVIEW_RING_ALIGN + slot_count * slotSize;
+    if (slot_count < 2 || !frame_size || total > PREVIEW_RING_MAX_BYTES) {
+        ALOGE("%s: bad ring geometry, %u slots of %zu bytes", __FUNCTION__,
+                slot_count, frame_size);
+        return NULL;
+    }
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+        return NULL;
+
+    ring = new (std::nothrow) camera_preview_ring_t();
+    if (!ring)
+        return NULL;
+
+    ring->fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (ring->fd < 0) {
+        ALOGE("%s: cannot create %s: %s", __FUNCTION__, tmp, strerror(errno));
+        delete ring;
+        return NULL;
+    }
+    if (ftruncate(ring->fd, total)) {
+        ALOGE("%s: cannot size %s: %s", __FUNCTION__, tmp, strerror(errno));
+        goto fail;
+    }
+    ring->map = (uint8_t *)mmap(NULL, total, PROT_READ | PROT_WRITE,
+            MAP_SHARED, ring->fd, 0);
+    if (ring->map == MAP_FAILED) {
+        ALOGE("%s: cannot map %s: %s", __FUNCTION__, tmp, strerror(errno));
+        ring->map = NULL;
+        goto fail;
+    }
+    ring->mapSize = total;
+    memset(ring->map, 0, total);
+
+    header = (camera_preview_ring_header_t *)ring->map;
+    header->magic = CAMERA_PREVIEW_RING_MAGIC;
+    header->version = CAMERA_PREVIEW_RING_VERSION;
+    header->header_size = sizeof(*header);
+    header->camera_id = camera_id;
+    header->slot_count = slot_count;
+    header->slot_size = slotSize;
+    header->data_offset = CAMERA_PREVIEW_RING_ALIGN;
+    header->head = 1;
+    header->open = 1;
+    ring->header = header;
+    ring->frameSize = slotSize - CAMERA_PREVIEW_RING_SLOT_DATA;
+
+    if (rename(tmp, path)) {
+        ALOGE("%s: cannot rename %s: %s", __FUNCTION__, tmp, strerror(errno));
+        goto fail;
+    }
+    ALOGI("%s: writing camera %d preview frames to %s, %u slots of %zu "
+            "bytes", __FUNCTION__, camera_id, path, slot_count,
+            ring->frameSize);
+    return ring;
+
+fail:
+    if (ring->map)
+        munmap(ring->map, ring->mapSize);
+    close(ring->fd);
+    unlink(tmp);
+    delete ring;
+    return NULL;
+}
+
+void camera_preview_ring_close(camera_preview_ring_t *ring)
+{
+    if (!ring)
+        return;
+
+    __sync_synchronize();
+    ring->header->open = 0;
+    if (ring->dropped)
+        ALOGW("%s: %u frames larger than %zu bytes dropped", __FUNCTION__,
+                ring->dropped, ring->frameSize);
+    munmap(ring->map, ring->mapSize);
+    close(ring->fd);
+    delete ring;
+}
+
+bool camera_preview_ring_write(camera_preview_ring_t *ring,
+        const void *data, size_t size, uint32_t format, uint32_t width,
+        uint32_t height, uint32_t stride, nsecs_t timestamp)
+{
+    camera_preview_ring_header_t *header = ring->header;
+    camera_preview_ring_slot_t *slot;
+    uint32_t sequence = header->head;
+
+    if (size > ring->frameSize) {
+        ring->dropped++;
+        return false;
+    }
+
+    slot = (camera_preview_ring_slot_t *)(ring->map + header->data_offset +
+            (size_t)(sequence % header->slot_count) * header->slot_size);
+
+    /* readers of the frame that was in the slot see it go away before any
+     * of its data changes */
+    slot->sequence = 0;
+    __sync_synchronize();
+    slot->format = format;
+    slot->width = width;
+    slot->height = height;
+    slot->stride = stride;
+    slot->size = size;
+    slot->timestamp_ns = timestamp;
+    memcpy((uint8_t *)slot + CAMERA_PREVIEW_RING_SLOT_DATA, data, size);
+    __sync_synchronize();
+    slot->sequence = sequence;
+    __sync_synchronize();
+    /* 0 marks a slot being written, skip it when the count wraps */
+    header->head = sequence + 1 ? sequence + 1 : 1;
+
+    ring->written++;
+    ring->bytes += size;
+    return true;
+}
+
+void camera_preview_ring_dump(camera_preview_ring_t *ring,
+        android::String8 &out)
+{
+    if (!ring)
+        return;
+
+    out.appendFormat("   Preview ring: slots=%u slot bytes=%zu frames=%u "
+            "bytes=%llu too large=%u\n", ring->header->slot_count,
+            ring->frameSize, ring->written, (unsigned long long)ring->bytes,
+            ring->dropped);
+}
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2014, The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file PreviewRing.h
+*
+* Ring of preview frames in a memory mapped file, written by the camera
+* wrapper and read in place by other processes through the
+* libcamera_preview_ring reader.
+*
+* The file is a camera_preview_ring_header_t followed, from data_offset, by
+* slot_count slots of slot_size bytes. Each slot is a
+* camera_preview_ring_slot_t followed, from CAMERA_PREVIEW_RING_SLOT_DATA,
+* by the frame. Frames are numbered from 1 and frame n goes to slot
+* n % slot_count. The slot's sequence is 0 while the writer fills it, so a
+* reader that finds the same sequence before and after using a frame knows
+* it was not overwritten meanwhile. Everything is in the byte order of the
+* device that wrote it.
+*
+*/
+
+#ifndef PREVIEW_RING_H
+#define PREVIEW_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <utils/String8.h>
+#include <utils/Timers.h>
+
+#define CAMERA_PREVIEW_RING_MAGIC 0x52505743 /* "CWPR" */
+#define CAMERA_PREVIEW_RING_VERSION 1
+/* slots start on page boundaries, frame data on cache line boundaries */
+#define CAMERA_PREVIEW_RING_ALIGN 4096
+#define CAMERA_PREVIEW_RING_SLOT_DATA 64
+
+typedef struct camera_preview_ring_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;
+    int32_t camera_id;
+    uint32_t slot_count;
+    uint32_t slot_size;
+    uint32_t data_offset;
+    /* number of the next frame to be written */
+    volatile uint32_t head;
+    /* cleared when the writer closes the ring; a reopened camera writes a
+     * new file under the same name */
+    volatile uint32_t open;
+} camera_preview_ring_header_t;
+
+typedef struct camera_preview_ring_slot {
+    volatile uint32_t sequence;
+    /* HAL_PIXEL_FORMAT_*, 0 if the preview format is not known */
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t size;
+    /* CLOCK_MONOTONIC when the wrapper received the frame */
+    int64_t timestamp_ns;
+} camera_preview_ring_slot_t;
+
+/*
+ * Writer, used by the camera wrapper from its preview callback thread
+ */
+
+typedef struct camera_preview_ring camera_preview_ring_t;
+
+/* creates path with slot_count slots of up to frame_size bytes, all
+ * allocated up front, NULL on failure */
+camera_preview_ring_t *camera_preview_ring_open(const char *path,
+        int camera_id, uint32_t slot_count, size_t frame_size);
+void camera_preview_ring_close(camera_preview_ring_t *ring);
+/* false, and the frame is counted as dropped, if it does not fit a slot */
+bool camera_preview_ring_write(camera_preview_ring_t *ring,
+        const void *data, size_t size, uint32_t format, uint32_t width,
+        uint32_t height, uint32_t stride, nsecs_t timestamp);
+void camera_preview_ring_dump(camera_preview_ring_t *ring,
+        android::String8 &out);
+
+/*
+ * Reader, in libcamera_preview_ring
+ */
+
+typedef struct camera_preview_ring_reader camera_preview_ring_reader_t;
+
+typedef struct camera_preview_frame {
+    uint32_t sequence;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+    uint32_t size;
+    int64_t timestamp_ns;
+    /* points into the mapping, valid until the writer reuses the slot */
+    const uint8_t *data;
+} camera_preview_frame_t;
+
+/* maps path read only and starts after the newest frame, NULL on failure */
+camera_preview_ring_reader_t *camera_preview_ring_reader_open(
+        const char *path);
+void camera_preview_ring_reader_close(camera_preview_ring_reader_t *reader);
+/* 1 and the oldest frame not read yet that is still in the ring, 0 if
+ * there is none, -EPIPE if there is none and the writer has closed the
+ * ring. Frames overwritten before they could be read are added to
+ * *missed. */
+int camera_preview_ring_reader_next(camera_preview_ring_reader_t *reader,
+        camera_preview_frame_t *frame, uint32_t *missed);
+/* whether the frame's data is still what next() returned it with; call
+ * after using the data in place, and discard the results if not */
+bool camera_preview_ring_reader_valid(camera_preview_ring_reader_t *reader,
+        const camera_preview_frame_t *frame);
+
+#endif /* PREVIEW_RING_H */
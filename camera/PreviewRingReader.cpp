@@ -0,0 +1,171 @@
+/*
+ * Copyright (C) 2014, The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file PreviewRingReader.cpp
+*
+* Reader side of the preview frame ring file, built as the
+* libcamera_preview_ring static library for tools that want the wrapper's
+* preview frames without going through the camera service.
+*
+* The reader never writes to the ring, so any number of them can follow
+* the same camera, each at its own pace. One that falls more than the ring
+* behind loses the frames in between and is told how many.
+*
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <new>
+
+#include "PreviewRing.h"
+
+struct camera_preview_ring_reader {
+    const uint8_t *map;
+    size_t mapSize;
+    const camera_preview_ring_header_t *header;
+    uint32_t next;
+};
+
+static const camera_preview_ring_slot_t *preview_ring_slot(
+        const camera_preview_ring_reader_t *reader, uint32_t sequence)
+{
+    const camera_preview_ring_header_t *header = reader->header;
+
+    return (const camera_preview_ring_slot_t *)(reader->map +
+            header->data_offset +
+            (size_t)(sequence % header->slot_count) * header->slot_size);
+}
+
+camera_preview_ring_reader_t *camera_preview_ring_reader_open(
+        const char *path)
+{
+    const camera_preview_ring_header_t *header;
+    camera_preview_ring_reader_t *reader;
+    struct stat st;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return NULL;
+    if (fstat(fd, &st) || (size_t)st.st_size < sizeof(*header)) {
+        close(fd);
+        return NULL;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    /* the mapping keeps the file alive */
+    close(fd);
+    if (map == MAP_FAILED)
+        return NULL;
+
+    header = (const camera_preview_ring_header_t *)map;
+    if (header->magic != CAMERA_PREVIEW_RING_MAGIC ||
+            header->version != CAMERA_PREVIEW_RING_VERSION ||
+            header->slot_count < 2 ||
+            header->slot_size <= CAMERA_PREVIEW_RING_SLOT_DATA ||
+            header->data_offset < sizeof(*header) ||
+            header->data_offset + (uint64_t)header->slot_count *
+                    header->slot_size > (uint64_t)st.st_size) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    reader = new (std::nothrow) camera_preview_ring_reader_t();
+    if (!reader) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    reader->map = (const uint8_t *)map;
+    reader->mapSize = st.st_size;
+    reader->header = header;
+    reader->next = header->head;
+    return reader;
+}
+
+void camera_preview_ring_reader_close(camera_preview_ring_reader_t *reader)
+{
+    if (!reader)
+        return;
+
+    munmap((void *)reader->map, reader->mapSize);
+    delete reader;
+}
+
+int camera_preview_ring_reader_next(camera_preview_ring_reader_t *reader,
+        camera_preview_frame_t *frame, uint32_t *missed)
+{
+    const camera_preview_ring_header_t *header = reader->header;
+    const camera_preview_ring_slot_t *slot;
+    uint32_t open, head, oldest, sequence;
+    uint32_t lost = 0;
+    int ret = 0;
+
+    /* a ring closed after this has no frames past head */
+    open = header->open;
+    __sync_synchronize();
+    head = header->head;
+    __sync_synchronize();
+
+    while ((int32_t)(head - reader->next) > 0) {
+        oldest = head - header->slot_count + 1;
+        if ((int32_t)(oldest - reader->next) > 0) {
+            lost += oldest - reader->next;
+            reader->next = oldest;
+        }
+
+        sequence = reader->next++;
+        slot = preview_ring_slot(reader, sequence);
+        if (slot->sequence != sequence) {
+            lost++;
+            continue;
+        }
+        __sync_synchronize();
+
+        frame->sequence = sequence;
+        frame->format = slot->format;
+        frame->width = slot->width;
+        frame->height = slot->height;
+        frame->stride = slot->stride;
+        frame->size = slot->size;
+        frame->timestamp_ns = slot->timestamp_ns;
+        frame->data = (const uint8_t *)slot + CAMERA_PREVIEW_RING_SLOT_DATA;
+        /* a torn header would point the caller outside the slot */
+        if (frame->size > header->slot_size - CAMERA_PREVIEW_RING_SLOT_DATA)
+            frame->size = 0;
+        ret = 1;
+        break;
+    }
+
+    if (missed)
+        *missed += lost;
+    if (!ret && !open)
+        return -EPIPE;
+    return ret;
+}
+
+bool camera_preview_ring_reader_valid(camera_preview_ring_reader_t *reader,
+        const camera_preview_frame_t *frame)
+{
+    __sync_synchronize();
+    return preview_ring_slot(reader, frame->sequence)->sequence ==
+            frame->sequence;
+}
@@ -0,0 +1,314 @@
+/*
+ * Copyright (C) 2014, The CyanogenMod Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/**
+* @file PreviewRingTool.cpp
+*
+* Follows and benchmarks the preview frame rings written by the camera
+* wrapper.
+*
+* "read" follows the ring of a running camera and reports the frame rate,
+* throughput and frames lost or overwritten while being read. Frames are
+* read in place, or copied out with -c.
+*
+* "bench" creates a ring of synthetic NV21 frames and has a reader thread
+* follow it while they are written, as fast as possible or at a camera's
+* frame rate with -r, measuring both sides without a camera.
+*
+*/
+
+#define LOG_TAG "CameraPreviewRing"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <system/graphics.h>
+
+#include "PreviewRing.h"
+
+/* how long a reader sleeps when it has caught up with the writer */
+#define RING_POLL_US 1000
+
+typedef struct ring_follow {
+    const char *path;
+    uint32_t maxFrames;
+    bool copy;
+    uint32_t frames;
+    uint32_t missed;
+    uint32_t torn;
+    uint64_t bytes;
+    int64_t firstTimestamp;
+    int64_t lastTimestamp;
+    nsecs_t busy;
+    /* keeps the in place reads from being optimised out */
+    uint32_t checksum;
+} ring_follow_t;
+
+static uint32_t frame_checksum(const uint8_t *data, size_t size)
+{
+    const uint32_t *words = (const uint32_t *)data;
+    uint32_t sum = 0;
+
+    for (size_t i = 0; i < size / 4; i++)
+        sum += words[i];
+    return sum;
+}
+
+/* reads frames until maxFrames, or until the writer closes the ring */
+static int ring_follow_run(ring_follow_t *follow,
+        camera_preview_ring_reader_t *reader)
+{
+    camera_preview_frame_t frame;
+    uint8_t *buf = NULL;
+    size_t bufSize = 0;
+    nsecs_t start;
+    int ret;
+
+    while (!follow->maxFrames || follow->frames < follow->maxFrames) {
+        ret = camera_preview_ring_reader_next(reader, &frame,
+                &follow->missed);
+        if (ret < 0)
+            break;
+        if (!ret) {
+            usleep(RING_POLL_US);
+            continue;
+        }
+
+        start = systemTime(SYSTEM_TIME_MONOTONIC);
+        if (follow->copy) {
+            if (bufSize < frame.size) {
+                free(buf);
+                buf = (uint8_t *)malloc(frame.size);
+                bufSize = buf ? frame.size : 0;
+                if (!buf)
+                    return -ENOMEM;
+            }
+            memcpy(buf, frame.data, frame.size);
+        } else {
+            follow->checksum += frame_checksum(frame.data, frame.size);
+        }
+        if (!camera_preview_ring_reader_valid(reader, &frame)) {
+            follow->torn++;
+            continue;
+        }
+        if (follow->copy)
+            follow->checksum += frame_checksum(buf, frame.size);
+        follow->busy += systemTime(SYSTEM_TIME_MONOTONIC) - start;
+
+        if (!follow->frames)
+            follow->firstTimestamp = frame.timestamp_ns;
+        follow->lastTimestamp = frame.timestamp_ns;
+        follow->frames++;
+        follow->bytes += frame.size;
+    }
+
+    free(buf);
+    return 0;
+}
+
+static void ring_follow_print(const ring_follow_t *follow)
+{
+    double span = (follow->lastTimestamp - follow->firstTimestamp) / 1e9;
+
+    printf("  reader: frames=%u missed=%u torn=%u bytes=%llu\n",
+            follow->frames, follow->missed, follow->torn,
+            (unsigned long long)follow->bytes);
+    if (follow->frames > 1 && span > 0)
+        printf("          %.1f frames/s, %.1f MB/s delivered\n",
+                (follow->frames - 1) / span, follow->bytes / span / 1e6);
+    if (follow->frames && follow->busy > 0)
+        printf("          %.1fus per frame %s, %.1f MB/s\n",
+                follow->busy / 1000.0 / follow->frames,
+                follow->copy ? "copied" : "read in place",
+                follow->bytes * 1e3 / follow->busy);
+}
+
+static int ring_read(const char *path, uint32_t maxFrames, bool copy)
+{
+    camera_preview_ring_reader_t *reader;
+    ring_follow_t follow;
+
+    reader = camera_preview_ring_reader_open(path);
+    if (!reader) {
+        fprintf(stderr, "%s: not a preview ring\n", path);
+        return 1;
+    }
+
+    memset(&follow, 0, sizeof(follow));
+    follow.path = path;
+    follow.maxFrames = maxFrames;
+    follow.copy = copy;
+    if (ring_follow_run(&follow, reader)) {
+        camera_preview_ring_reader_close(reader);
+        return 1;
+    }
+    camera_preview_ring_reader_close(reader);
+
+    printf("  Preview ring %s:\n", path);
+    ring_follow_print(&follow);
+    return 0;
+}
+
+static void *ring_bench_reader(void *arg)
+{
+    ring_follow_t *follow = (ring_follow_t *)arg;
+    camera_preview_ring_reader_t *reader;
+
+    reader = camera_preview_ring_reader_open(follow->path);
+    if (!reader)
+        return NULL;
+    ring_follow_run(follow, reader);
+    camera_preview_ring_reader_close(reader);
+    return NULL;
+}
+
+static int ring_bench(const char *path, uint32_t frames, int width,
+        int height, uint32_t slots, uint32_t rate, bool copy)
+{
+    size_t size = (size_t)width * height * 3 / 2;
+    camera_preview_ring_t *ring;
+    ring_follow_t follow;
+    pthread_t thread;
+    nsecs_t start, elapsed, busy = 0, now;
+    uint8_t *src;
+
+    src = (uint8_t *)malloc(size);
+    if (!src)
+        return 1;
+    for (size_t i = 0; i < size; i++)
+        src[i] = i * 7 + (i >> 12);
+
+    ring = camera_preview_ring_open(path, 0, slots, size);
+    if (!ring) {
+        fprintf(stderr, "%s: cannot create ring\n", path);
+        free(src);
+        return 1;
+    }
+
+    memset(&follow, 0, sizeof(follow));
+    follow.path = path;
+    follow.copy = copy;
+    if (pthread_create(&thread, NULL, ring_bench_reader, &follow)) {
+        camera_preview_ring_close(ring);
+        free(src);
+        return 1;
+    }
+    /* let the reader map the ring before the first frame */
+    usleep(10000);
+
+    start = systemTime(SYSTEM_TIME_MONOTONIC);
+    for (uint32_t i = 0; i < frames; i++) {
+        if (rate) {
+            nsecs_t due = start + (nsecs_t)i * 1000000000 / rate;
+
+            now = systemTime(SYSTEM_TIME_MONOTONIC);
+            if (due > now)
+                usleep((due - now) / 1000);
+        }
+        src[0] = i;
+        now = systemTime(SYSTEM_TIME_MONOTONIC);
+        camera_preview_ring_write(ring, src, size,
+                HAL_PIXEL_FORMAT_YCrCb_420_SP, width, height, width, now);
+        busy += systemTime(SYSTEM_TIME_MONOTONIC) - now;
+    }
+    elapsed = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+    camera_preview_ring_close(ring);
+    pthread_join(thread, NULL);
+    free(src);
+
+    printf("  Preview ring benchmark, %u %dx%d NV21 frames, %u slots:\n",
+            frames, width, height, slots);
+    printf("  writer: %.1fus per frame, %.1f frames/s, %.1f MB/s\n",
+            busy / 1000.0 / frames, frames * 1e9 / elapsed,
+            (double)size * frames * 1e3 / busy);
+    ring_follow_print(&follow);
+    unlink(path);
+    return 0;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s read [-n frames] [-c] <ring>\n"
+            "       %s bench [-n frames] [-s WxH] [-k slots] [-r fps] [-c] "
+            "<ring>\n"
+            "  -n  stop after this many frames (bench: 1000)\n"
+            "  -c  copy frames out instead of reading them in place\n"
+            "  -s  frame size (1920x1080)\n"
+            "  -k  ring slots (4)\n"
+            "  -r  frames written per second (as fast as possible)\n",
+            argv0, argv0);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t frames = 0, slots = 4, rate = 0;
+    int width = 1920, height = 1080;
+    bool copy = false;
+    const char *cmd;
+    int opt;
+
+    if (argc < 2) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    cmd = argv[1];
+    optind = 2;
+    while ((opt = getopt(argc, argv, "n:cs:k:r:")) != -1) {
+        switch (opt) {
+        case 'n':
+            frames = strtoul(optarg, NULL, 0);
+            break;
+        case 'c':
+            copy = true;
+            break;
+        case 's':
+            if (sscanf(optarg, "%dx%d", &width, &height) != 2 ||
+                    width <= 0 || height <= 0 || (width | height) & 1) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'k':
+            slots = strtoul(optarg, NULL, 0);
+            break;
+        case 'r':
+            rate = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    if (strcmp(cmd, "read") == 0)
+        return ring_read(argv[optind], frames, copy);
+    if (strcmp(cmd, "bench") == 0)
+        return ring_bench(argv[optind], frames ? frames : 1000, width,
+                height, slots, rate, copy);
+
+    usage(argv[0]);
+    return 2;
+}
@@ -2,7 +2,10 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
@@ -31,23 +34,99 @@ do { \
 	} \
 } while(0)
 
+/* whether NV_OUT already holds exactly these bytes */
+static int nv_out_matches(const char *buf, size_t size)
+{
+	struct stat statbuf;
+	void *out;
+	int fd, ret;
+
+	fd = open(NV_OUT, O_RDONLY);
+	if (fd < 0)
+		return 0;
+	if (fstat(fd, &statbuf) || statbuf.st_size != (off_t)size) {
+		close(fd);
+		return 0;
+	}
+	out = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (out == MAP_FAILED)
+		return 0;
+	ret = memcmp(out, buf, size) == 0;
+	munmap(out, size);
+	return ret;
+}
+
+/* replace NV_OUT so that it is either the old or the new file, even if
+ * power is lost half way */
+static int write_nv_out(const char *buf, size_t size)
+{
+	struct stat statbuf;
+	size_t done = 0;
+	ssize_t n;
+	int fd;
+
+	fd = open(NV_TMP, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0) {
+		perror("Failed to open " NV_TMP);
+		return -1;
+	}
+	/* the new file takes the old one's owner and mode */
+	if (!stat(NV_OUT, &statbuf)) {
+		if (fchown(fd, statbuf.st_uid, statbuf.st_gid))
+			perror("Warning. Failed to chown " NV_TMP);
+		if (fchmod(fd, statbuf.st_mode & 07777))
+			perror("Warning. Failed to chmod " NV_TMP);
+	}
+	while (done < size) {
+		n = write(fd, buf + done, size - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			perror("Failed to write to nv");
+			close(fd);
+			unlink(NV_TMP);
+			return -1;
+		}
+		done += n;
+	}
+	if (fdatasync(fd)) {
+		perror("Failed to sync " NV_TMP);
+		close(fd);
+		unlink(NV_TMP);
+		return -1;
+	}
+	close(fd);
+
+	if (rename(NV_TMP, NV_OUT)) {
+		perror("Failed to rename " NV_TMP);
+		unlink(NV_TMP);
+		return -1;
+	}
+
+	/* make the rename itself durable */
+	fd = open(NV_OUT_DIR, O_RDONLY | O_DIRECTORY);
+	if (fd >= 0) {
+		if (fsync(fd))
+			perror("Warning. Failed to sync " NV_OUT_DIR);
+		close(fd);
+	}
+	return 0;
+}
 
 int main(int argc, char **argv)
 {
 	char *buf;
 	struct stat statbuf;
-	int ret;
-	size_t actual;
-	FILE *f;
+	int fd;
 
-	ret = stat(NV_IN, &statbuf);
-	if (ret) {
-		perror("Failed to stat " NV_IN);
+	fd = open(NV_IN, O_RDONLY);
+	if (fd < 0) {
+		perror("Failed to open " NV_IN);
 		exit(EINVAL);
 	}
-	f = fopen(NV_IN, "r");
-	if (!f) {
-		perror("Failed to open " NV_IN);
+	if (fstat(fd, &statbuf)) {
+		perror("Failed to stat " NV_IN);
 		exit(EINVAL);
 	}
 
@@ -59,36 +138,31 @@ int main(int argc, char **argv)
 	if (statbuf.st_size != NV_SIZE)
 		perror("Warning - size invalid");
 
-	buf = malloc(statbuf.st_size);
-	if (!buf) {
-		perror("malloc failed");
-		exit(ENOMEM);
-	}
-
-	actual = fread(buf, 1, statbuf.st_size, f);
-	if (actual != statbuf.st_size) {
-		perror("Failed to read from nv");
+	/* a private mapping, so the macs are patched in memory only and
+	 * just the page holding them is copied */
+	buf = mmap(NULL, statbuf.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		   fd, 0);
+	if (buf == MAP_FAILED) {
+		perror("Failed to map " NV_IN);
 		exit(EINVAL);
 	}
-	fclose(f);
+	close(fd);
 
 	UPD_MAC(MAC0_FILE, MAC0_OFFSET);
 	UPD_MAC(MAC1_FILE, MAC1_OFFSET);
 	UPD_MAC(MAC2_FILE, MAC2_OFFSET);
 	UPD_MAC(MAC3_FILE, MAC3_OFFSET);
 
-	f = fopen(NV_OUT, "w+");
-	if (!f) {
-		perror("Failed to open " NV_OUT);
-		exit(EINVAL);
-	}
-	actual = fwrite(buf, 1, statbuf.st_size, f);
-	if (actual != statbuf.st_size) {
-		perror("Failed to write to nv");
-		exit(EINVAL);
+	/* nothing to write on every boot but the first after a mac or
+	 * firmware change */
+	if (nv_out_matches(buf, statbuf.st_size)) {
+		munmap(buf, statbuf.st_size);
+		return 0;
 	}
 
-	fclose(f);
+	if (write_nv_out(buf, statbuf.st_size))
+		exit(EINVAL);
 
+	munmap(buf, statbuf.st_size);
 	return 0;
 }
@@ -1,7 +1,9 @@
 /* To FreeXperia from a friend :) */
 
 #define NV_IN "/system/etc/firmware/wlan/prima/WCNSS_qcom_wlan_nv.bin"
-#define NV_OUT "/data/misc/wifi/prima/WCNSS_qcom_wlan_nv.bin"
+#define NV_OUT_DIR "/data/misc/wifi/prima"
+#define NV_OUT NV_OUT_DIR "/WCNSS_qcom_wlan_nv.bin"
+#define NV_TMP NV_OUT ".tmp"
 
 #define MAC0_FILE "/data/etc/wlan_macaddr0"
 #define MAC1_FILE "/data/etc/wlan_macaddr1"